@@ -0,0 +1,140 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include "simd_dispatch.h"
+
+// 自适应nprobe：按簇中心距离从近到远探测，用簇半径给出簇内距离的下界，
+// 下界不小于当前第k小的距离时跳过该簇，剩下的簇都不可能更好时提前结束。
+// 簇内任一向量x与中心c的距离不超过该簇的半径r，对内积距离有
+//   1 - <q, x> = (1 - <q, c>) - <q, x - c> >= (1 - <q, c>) - |q| * r
+// slack = 1时用的就是这个严格的下界，结果与固定探测max_probe个簇相同；
+// 高维下半径往往偏大，界很松，slack < 1把半径打折，停得更早，召回随之下降，
+// 可以用calibrate_probe_slack按召回目标选取
+
+// 每个簇的半径：簇内向量到中心的最大欧氏距离。
+// |x - c|^2 = |x|^2 - 2<x, c> + |c|^2，簇内的行是连续的，<x, c>用InnerProductBatch成批计算。
+// 构造要把base扫一遍，应在计时之前建好，通过ProbeParams::bounds传给搜索
+class ClusterBounds {
+public:
+    ClusterBounds(const float* centroids, const float* new_base, const uint32_t* cluster_start, size_t n_clusters,
+                  size_t vecdim)
+        : centroids_(centroids), new_base_(new_base), n_clusters_(n_clusters), radius_(n_clusters), max_radius_(0) {
+        const size_t batch = 256;
+        float xc[batch];
+        for (size_t c = 0; c < n_clusters; ++c) {
+            const float* center = centroids + c * vecdim;
+            float cc = dot(center, center, vecdim), r2 = 0;
+            for (uint32_t i = cluster_start[c]; i < cluster_start[c + 1]; i += batch) {
+                size_t cnt = std::min<size_t>(batch, cluster_start[c + 1] - i);
+                const float* x = new_base + (size_t)i * vecdim;
+                if (vecdim % 8 == 0) InnerProductBatch(x, center, cnt, vecdim, xc);
+                else for (size_t j = 0; j < cnt; ++j) xc[j] = inner_product_scalar(x + j * vecdim, center, vecdim);
+                for (size_t j = 0; j < cnt; ++j) {
+                    const float* row = x + j * vecdim;
+                    float xx = dot(row, row, vecdim);
+                    // 展开式相减有舍入误差，按|x|^2 + |c|^2留一点余量，保证仍是上界
+                    r2 = std::max(r2, xx - 2 * xc[j] + cc + 1e-5f * (xx + cc));
+                }
+            }
+            radius_[c] = std::sqrt(r2);
+            max_radius_ = std::max(max_radius_, radius_[c]);
+        }
+    }
+
+    const float* centroids() const { return centroids_; }
+    const float* new_base() const { return new_base_; }
+    size_t n_clusters() const { return n_clusters_; }
+    float radius(uint32_t cid) const { return radius_[cid]; }
+    float max_radius() const { return max_radius_; }
+
+private:
+    static float dot(const float* a, const float* b, size_t vecdim) {
+        return vecdim % 8 == 0 ? InnerProductSIMD(a, b, vecdim) : inner_product_scalar(a, b, vecdim);
+    }
+
+    const float* centroids_;
+    const float* new_base_;
+    size_t n_clusters_;
+    std::vector<float> radius_;
+    float max_radius_;
+};
+
+struct ProbeParams {
+    size_t max_probe;   // 探测预算：最多探测的簇数，0表示不限
+    float slack;        // 半径的折扣系数，取值[0, 1]
+    size_t min_probe;   // 至少探测的簇数，这些簇不做剪枝
+    const ClusterBounds* bounds;  // 预先建好的簇半径，nullptr时第一次查询从shared_cluster_bounds取
+
+    explicit ProbeParams(size_t max_probe = 0, float slack = 1.0f, size_t min_probe = 1,
+                         const ClusterBounds* bounds = nullptr)
+        : max_probe(max_probe), slack(slack), min_probe(min_probe), bounds(bounds) {}
+
+    // 实际参与排序的簇数
+    size_t budget(size_t n_clusters) const { return max_probe == 0 ? n_clusters : std::min(max_probe, n_clusters); }
+};
+
+// 与shared_coarse_quantizer一样按指针缓存，索引数据在进程内不再改变；查找加锁，多个线程同时查询也安全
+inline const ClusterBounds& shared_cluster_bounds(const float* centroids, const float* new_base,
+                                                  const uint32_t* cluster_start, size_t n_clusters, size_t vecdim) {
+    static std::vector<std::unique_ptr<ClusterBounds>> cache;
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& b : cache) {
+        if (b->centroids() == centroids && b->new_base() == new_base && b->n_clusters() == n_clusters) return *b;
+    }
+    cache.emplace_back(new ClusterBounds(centroids, new_base, cluster_start, n_clusters, vecdim));
+    return *cache.back();
+}
+
+// 搜索用的簇半径：优先用probe里预先建好的
+inline const ClusterBounds& probe_bounds(const ProbeParams& probe, const float* centroids, const float* new_base,
+                                         const uint32_t* cluster_start, size_t n_clusters, size_t vecdim) {
+    return probe.bounds ? *probe.bounds : shared_cluster_bounds(centroids, new_base, cluster_start, n_clusters, vecdim);
+}
+
+// 一条查询的剪枝规则，centroid_dis为1 - <q, c>
+class ProbePruner {
+public:
+    ProbePruner(const ClusterBounds& bounds, const float* query, size_t vecdim, float slack)
+        : bounds_(bounds), scale_(slack * std::sqrt(inner_product_scalar(query, query, vecdim))) {}
+
+    // 簇cid内的距离不可能小于threshold
+    bool skip(float centroid_dis, uint32_t cid, float threshold) const {
+        return centroid_dis - scale_ * bounds_.radius(cid) >= threshold;
+    }
+
+    // 中心距离不小于centroid_dis的簇都不可能小于threshold，簇按中心距离排好序时可以就此停止
+    bool exhausted(float centroid_dis, float threshold) const {
+        return centroid_dis - scale_ * bounds_.max_radius() >= threshold;
+    }
+
+private:
+    const ClusterBounds& bounds_;
+    float scale_;
+};
+
+// 多个线程共享的阈值取各自第k小距离中的最小值，它不小于合并后真正的第k小，用来剪枝是安全的
+inline void atomic_min(std::atomic<float>& a, float v) {
+    float cur = a.load(std::memory_order_relaxed);
+    while (v < cur && !a.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+    }
+}
+
+// 按召回目标选取slack：recall_at(slack)返回一组样本查询上的平均召回，假定随slack单调不减。
+// 在[0, 1]上二分iters次，返回达到target的最小slack；slack = 1也达不到时返回1
+inline float calibrate_probe_slack(float target, const std::function<float(float)>& recall_at, int iters = 8) {
+    float lo = 0, hi = 1;
+    if (recall_at(lo) >= target) return lo;
+    for (int i = 0; i < iters; ++i) {
+        float mid = (lo + hi) / 2;
+        if (recall_at(mid) >= target) hi = mid;
+        else lo = mid;
+    }
+    return hi;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <vector>
+#include <random>
+#include <cmath>
+
+// 基准测试共用的随机数据
+
+// n个vecdim维的单位向量，围绕n_centers个随机中心
+inline std::vector<float> MakeClustered(size_t n, size_t vecdim, size_t n_centers, std::mt19937& gen) {
+    std::normal_distribution<float> normal(0, 1);
+    std::vector<float> centers(n_centers * vecdim);
+    for (auto& x : centers) x = normal(gen);
+    std::vector<float> data(n * vecdim);
+    for (size_t i = 0; i < n; ++i) {
+        const float* c = &centers[gen() % n_centers * vecdim];
+        float* x = &data[i * vecdim];
+        float norm = 0;
+        for (size_t d = 0; d < vecdim; ++d) {
+            x[d] = c[d] + 0.5f * normal(gen);
+            norm += x[d] * x[d];
+        }
+        norm = std::sqrt(norm);
+        for (size_t d = 0; d < vecdim; ++d) x[d] /= norm;
+    }
+    return data;
+}
@@ -0,0 +1,240 @@
+#pragma once
+#include <queue>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include "fs_simd_scan.h"
+
+// 多级级联搜索：每一级是一个距离估计器，对上一级留下的候选重新估计距离，只保留最好的keep个；
+// 第一级扫描整个base。级联的组成和每级保留数用字符串描述，运行时解析，调参不需要重新编译：
+//   "fs4:500k,pq8:100k,fp32"  4bit FastScan留500k个 -> PQ8留100k个 -> 全精度取前k个
+//   "sq8:2k,fp32"             即原来的sq_simd_search（给了sq_codec时为按维度量化的版本）
+// 保留数可以写成绝对个数（5000）或k的倍数（500k）；最后一级不写时为k。
+
+enum CascadeStageKind {
+    CASCADE_FASTSCAN4 = 0,  // 4bit FastScan，PackFastScanCodes打包的编码
+    CASCADE_PQ8,            // 8bit PQ，每段一个字节
+    CASCADE_SQ8,            // 8bit标量量化，有SQ8Codec时按维度量化，否则[-1, 1]均匀量化
+    CASCADE_FLOAT,          // 全精度内积
+    CASCADE_KIND_COUNT
+};
+
+inline const char* cascade_stage_name(CascadeStageKind kind) {
+    static const char* names[CASCADE_KIND_COUNT] = {"fs4", "pq8", "sq8", "fp32"};
+    return kind < CASCADE_KIND_COUNT ? names[kind] : "unknown";
+}
+
+struct CascadeStage {
+    CascadeStageKind kind;
+    size_t keep;        // 保留的候选数，0表示k
+    bool per_k;         // keep是否为k的倍数
+};
+
+// 各级估计器用到的数据，用不到的级别可以留空
+struct CascadeData {
+    size_t base_number;
+    size_t vecdim;
+    float* base;            // 全精度base
+    uint8_t* sq_base;       // SQ8编码：sq_codec为空时是[-1, 1]均匀量化，否则是sq_codec的编码
+    const SQ8Codec* sq_codec;       // 训练好的按维度量化，可以为空
+    const int32_t* sq_code_sums;    // sq_codec编码每行之和，非空时走整数点积
+    uint8_t* pq_codes;      // PQ8编码[base_number][pq_nsub]
+    const uint8_t* pq_packed;       // PackPQCodes打包的pq_codes，全量扫描用，为空时用shared_pq_packed
+    float* pq_center;       // PQ8码本[pq_nsub * pq_ksub][vecdim / pq_nsub]
+    size_t pq_nsub;
+    size_t pq_ksub;
+    uint8_t* fs_packed;     // FastScan打包编码
+    float* fs_center;       // FastScan码本[fs_nsub * 16][vecdim / fs_nsub]
+    size_t fs_nsub;
+};
+
+struct CascadeStageStats {
+    CascadeStageKind kind;
+    size_t input;       // 输入候选数（第一级为base_number）
+    size_t output;      // 保留下来的候选数
+    double us;          // 耗时（微秒）
+};
+
+// 解析级联描述，格式错误时打印原因并返回空
+inline std::vector<CascadeStage> parse_cascade(const std::string& spec) {
+    std::vector<CascadeStage> stages;
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t comma = spec.find(',', pos);
+        if (comma == std::string::npos) comma = spec.size();
+        std::string item = spec.substr(pos, comma - pos);
+        pos = comma + 1;
+
+        size_t colon = item.find(':');
+        std::string name = item.substr(0, colon);
+        CascadeStage stage = {CASCADE_KIND_COUNT, 0, false};
+        for (int kind = 0; kind < CASCADE_KIND_COUNT; ++kind) {
+            if (name == cascade_stage_name((CascadeStageKind)kind)) stage.kind = (CascadeStageKind)kind;
+        }
+        if (stage.kind == CASCADE_KIND_COUNT) {
+            std::cerr << "cascade: unknown stage '" << name << "' in " << spec << "\n";
+            return std::vector<CascadeStage>();
+        }
+        if (colon != std::string::npos) {
+            std::string keep = item.substr(colon + 1);
+            stage.per_k = !keep.empty() && keep.back() == 'k';
+            if (stage.per_k) keep.pop_back();
+            char* end = nullptr;
+            stage.keep = std::strtoul(keep.c_str(), &end, 10);
+            if (keep.empty() || *end != '\0' || stage.keep == 0) {
+                std::cerr << "cascade: bad keep count '" << item << "' in " << spec << "\n";
+                return std::vector<CascadeStage>();
+            }
+        }
+        stages.push_back(stage);
+    }
+    return stages;
+}
+
+// 一级估计：ids为空时估计全部base，否则只估计ids中的候选，结果保留最好的keep个写入out。
+// 查表、量化的query等缓冲都取自ctx
+inline void cascade_run_stage(SearchContext& ctx, const CascadeData& data, CascadeStageKind kind, float* query,
+                              const std::vector<uint32_t>* ids, size_t keep, TopK<>& out) {
+    size_t n = ids ? ids->size() : data.base_number;
+    size_t vecdim = data.vecdim;
+    auto id_at = [&](size_t i) -> uint32_t { return ids ? (*ids)[i] : (uint32_t)i; };
+
+    switch (kind) {
+    case CASCADE_FASTSCAN4: {
+        uint8_t* tables = SearchContext::buffer(ctx.fs_tables, data.fs_nsub * 16);
+        fs_pre_calculate_quantized(data.fs_center, query, tables, 16, vecdim / data.fs_nsub, data.fs_nsub,
+                                   SearchContext::buffer(ctx.lut, data.fs_nsub * 17));
+        if (ids == nullptr) {
+            fs_scan_candidates(ctx, data.fs_packed, data.base_number, tables, data.fs_nsub, keep, ctx.fs_candidates);
+            for (auto& c : ctx.fs_candidates) out.push(c.first, c.second);
+        } else {
+            // 候选不连续，按打包格式取出每段的编码逐个查表
+            size_t pairs = data.fs_nsub / 2;
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t id = id_at(i);
+                const uint8_t* block = data.fs_packed + id / kFastScanBlock * pairs * kFastScanBlock + id % kFastScanBlock;
+                uint32_t score = 0;
+                for (size_t p = 0; p < pairs; ++p) {
+                    uint8_t c = block[p * kFastScanBlock];
+                    score += tables[2 * p * 16 + (c & 0x0F)] + tables[(2 * p + 1) * 16 + (c >> 4)];
+                }
+                out.push(65535.0f - score, id);
+            }
+        }
+        break;
+    }
+    case CASCADE_PQ8: {
+        float* pre_dist = SearchContext::buffer(ctx.lut, data.pq_ksub * data.pq_nsub);
+        pre_calculate(data.pq_center, query, pre_dist, vecdim, data.pq_ksub, vecdim / data.pq_nsub, data.pq_nsub);
+        if (ids == nullptr) {
+            // 全量扫描按块查表，与pq_simd_search相同
+            const uint8_t* packed = data.pq_packed ? data.pq_packed
+                                                   : shared_pq_packed(data.pq_codes, data.base_number, data.pq_nsub);
+            float dis[kBatchRows];
+            for (size_t i = 0; i < n; i += kBatchRows) {
+                size_t cnt = std::min(kBatchRows, n - i);
+                PQAdcScan(packed + i * data.pq_nsub, (cnt + kPQBlock - 1) / kPQBlock, pre_dist, data.pq_nsub,
+                          data.pq_ksub, dis);
+                for (size_t j = 0; j < cnt; ++j) dis[j] = 1 - dis[j];
+                out.push_range(dis, cnt, i);
+            }
+            break;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t id = id_at(i);
+            const uint8_t* code = data.pq_codes + (size_t)id * data.pq_nsub;
+            float dis = 0;
+            for (size_t j = 0; j < data.pq_nsub; ++j) dis += pre_dist[code[j] + j * data.pq_ksub];
+            out.push(1 - dis, id);
+        }
+        break;
+    }
+    case CASCADE_SQ8: {
+        if (data.sq_codec) {
+            SQ8QueryScanner scanner(ctx, *data.sq_codec, data.sq_base, data.sq_code_sums, query);
+            float dis[kBatchRows];
+            if (ids == nullptr) {
+                for (size_t i = 0; i < n; i += kBatchRows) {
+                    size_t cnt = std::min(kBatchRows, n - i);
+                    scanner.distances(i, cnt, dis);
+                    out.push_range(dis, cnt, i);
+                }
+            } else {
+                for (size_t i = 0; i < n; ++i) {
+                    scanner.distances(id_at(i), 1, dis);
+                    out.push(dis[0], id_at(i));
+                }
+            }
+            break;
+        }
+        // 没有训练好的量化时用与sq_simd_search相同的[-1, 1]量化
+        float min_val = -1.0f, max_val = 1.0f;
+        float scale = 255.0f / (max_val - min_val), offset = -min_val;
+        uint8_t* quantized_query = SearchContext::buffer(ctx.quantized_query, vecdim);
+        QuantizeSIMD(query, quantized_query, vecdim, min_val, max_val);
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t id = id_at(i);
+            float dis = InnerProductSIMDNeonQuantized(data.sq_base + (size_t)id * vecdim, quantized_query, vecdim, scale, offset);
+            out.push(1 - dis, id);
+        }
+        break;
+    }
+    default: {
+        float dis[kBatchRows];
+        for (size_t i = 0; i < n; i += kBatchRows) {
+            size_t cnt = std::min(kBatchRows, n - i);
+            if (ids) {
+                InnerProductBatchIds(data.base, ids->data() + i, cnt, query, vecdim, dis);
+                for (size_t j = 0; j < cnt; ++j) dis[j] = 1 - dis[j];
+                out.push_ids(dis, cnt, ids->data() + i);
+            } else {
+                InnerProductBatch(data.base + i * vecdim, query, cnt, vecdim, dis);
+                for (size_t j = 0; j < cnt; ++j) dis[j] = 1 - dis[j];
+                out.push_range(dis, cnt, i);
+            }
+        }
+        break;
+    }
+    }
+}
+
+// 按stages依次执行，返回最后一级的前k个；stats非空时记录每一级的候选数和耗时。
+// 中间各级的候选放在ctx.candidates和ctx.cascade_ids里，最后一级写进ctx.result
+inline TopK<>& cascade_search(SearchContext& ctx, const CascadeData& data, const std::vector<CascadeStage>& stages,
+                              float* query, size_t k, std::vector<CascadeStageStats>* stats = nullptr) {
+    if (stats) stats->clear();
+    std::vector<uint32_t>& ids = ctx.cascade_ids;
+    ids.clear();
+    TopK<>& result = ctx.result;
+    result.reset(k);
+    for (size_t s = 0; s < stages.size(); ++s) {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        bool final_stage = s + 1 == stages.size();
+        size_t keep = stages[s].keep == 0 ? k : stages[s].per_k ? stages[s].keep * k : stages[s].keep;
+        if (final_stage) keep = k;
+        keep = std::min(keep, s == 0 ? data.base_number : ids.size());
+        size_t input = s == 0 ? data.base_number : ids.size();
+
+        TopK<>& top = final_stage ? result : ctx.candidates;
+        top.reset(std::max<size_t>(keep, 1));
+        cascade_run_stage(ctx, data, stages[s].kind, query, s == 0 ? nullptr : &ids, keep, top);
+        top.compact();
+        if (!final_stage) {
+            ids.clear();
+            for (auto& e : top) ids.push_back(e.second);
+        }
+
+        if (stats) {
+            double us = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - t0).count();
+            stats->push_back(CascadeStageStats{stages[s].kind, input, final_stage ? top.size() : ids.size(), us});
+        }
+    }
+    return result;
+}
+
+inline std::priority_queue<std::pair<float, uint32_t>> cascade_search(const CascadeData& data,
+    const std::vector<CascadeStage>& stages, float* query, size_t k, std::vector<CascadeStageStats>* stats = nullptr) {
+    return cascade_search(thread_search_context(), data, stages, query, k, stats).to_queue();
+}
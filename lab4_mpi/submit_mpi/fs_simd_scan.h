@@ -1,108 +1,135 @@
+#pragma once
 #include <queue>
 #include <vector>
-#include <arm_neon.h>
+#include <algorithm>
+#include <cstring>
 #include "pq_simd_scan.h"
 
-// 计算查询向量各段与中心表的点积，量化并存储成4个uint8x16_t表
-void fs_pre_calculate_quantized(float* center, float* query, uint8x16_t tables[4], size_t center_num, size_t center_vecdim) {
-    float tmp[16 * 4]; // 16类 × 4段
-    for (int i = 0; i < 4; ++i) {
-        for (int j = 0; j < center_num; ++j) {
+// 每次Lut16Scan处理的块数，16块共512条向量，分数缓冲1KB留在L1里接着做过滤
+const size_t kFastScanChunkBlocks = 16;
+
+// 计算查询向量各段与中心表的点积，量化成nsub张16项的uint8表。
+// 每段减去自己的最小值，所有段共用一个缩放系数，各段之和的大小顺序与原内积一致。
+// scratch为nsub * 17个float的临时空间，为空时自己分配
+void fs_pre_calculate_quantized(float* center, float* query, uint8_t* tables, size_t center_num, size_t center_vecdim, size_t nsub,
+                                float* scratch = nullptr) {
+    std::vector<float> local;
+    if (scratch == nullptr) {
+        local.resize(nsub * 17);
+        scratch = local.data();
+    }
+    float* tmp = scratch;                 // 每段16类
+    float* seg_min = scratch + nsub * 16;
+    float range = 0;
+    for (size_t i = 0; i < nsub; ++i) {
+        float lo = 0, hi = 0;
+        for (size_t j = 0; j < center_num; ++j) {
             // center的布局是段内连续的
-            tmp[j + i * center_num] = InnerProductSIMDNeon(center + (j + i * center_num) * center_vecdim, query + i * center_vecdim, center_vecdim);
+            float* c = center + (j + i * center_num) * center_vecdim;
+            float ip = center_vecdim % 8 == 0 ? InnerProductSIMDNeon(c, query + i * center_vecdim, center_vecdim)
+                                              : inner_product_scalar(c, query + i * center_vecdim, center_vecdim);
+            tmp[j + i * 16] = ip;
+            lo = j == 0 ? ip : std::min(lo, ip);
+            hi = j == 0 ? ip : std::max(hi, ip);
         }
+        seg_min[i] = lo;
+        range = std::max(range, hi - lo);
     }
+    if (range <= 0) range = 1;
 
-    // 动态估计qmin, qmax
-    float qmin = tmp[0], qmax = tmp[0];
-    for (int i = 0; i < 16 * 4; ++i) {
-        qmin = std::min(qmin, tmp[i]);
-        qmax = std::max(qmax, tmp[i]);
-    }
-    // 为了保险稍微扩一点点
-    float margin = (qmax - qmin) * 0.05f;
-    qmin -= margin;
-    qmax += margin;
+    // 每段16项连续存放，查表时整段载入一个寄存器
+    for (size_t i = 0; i < nsub; ++i) QuantizeSIMD(&tmp[i * 16], tables + i * 16, 16, seg_min[i], seg_min[i] + range);
+}
+
+// FastScan粗排，候选写入candidates（65535 - 分数, id），最多rerank个。
+// 扫描时维护一个量化分数的阈值，每块查表后用SIMD比较，只把不低于阈值的向量压缩写进候选缓冲；
+// 缓冲超过2 * rerank时保留最好的rerank个，阈值提到它们之中最差的分数之上。
+// 缓冲大小和选择的开销只与rerank有关，与base_number无关；缓冲取自ctx
+void fs_scan_candidates(SearchContext& ctx, const uint8_t* base, size_t base_number, const uint8_t* tables, size_t nsub,
+                        size_t rerank, std::vector<std::pair<uint16_t, uint32_t>>& candidates) {
+    size_t chunk = kFastScanChunkBlocks * kFastScanBlock;
+    uint16_t* scores = SearchContext::buffer(ctx.fs_scores, 2 * rerank + chunk);
+    uint32_t* ids = SearchContext::buffer(ctx.fs_ids, 2 * rerank + chunk);
+    size_t cnt = 0;
+    uint32_t threshold = 0;
+
+    // 保留分数最高的rerank个，返回其中最低的分数。
+    // 分数只有16位，先按高8位、再按低8位各统计一次256桶的直方图就能定位第rerank大的分数，不需要排序
+    auto compact = [&]() -> uint16_t {
+        // 分数往往集中在少数几个桶里，4组直方图轮流累加，避免同一个桶上的自增前后等待
+        uint32_t hist[4][256];
+        memset(hist, 0, sizeof(hist));
+        for (size_t i = 0; i < cnt; ++i) ++hist[i & 3][scores[i] >> 8];
+        for (int b = 0; b < 256; ++b) hist[0][b] += hist[1][b] + hist[2][b] + hist[3][b];
+        size_t need = rerank;
+        int hi = 255;
+        while (hist[0][hi] < need) need -= hist[0][hi--];
 
-    uint8_t quantized[16 * 4];
-    QuantizeSIMD(tmp, quantized, 16 * 4, qmin, qmax);
+        memset(hist, 0, sizeof(hist));
+        for (size_t i = 0; i < cnt; ++i) hist[i & 3][scores[i] & 0xFF] += (scores[i] >> 8) == hi;
+        for (int b = 0; b < 256; ++b) hist[0][b] += hist[1][b] + hist[2][b] + hist[3][b];
+        int lo = 255;
+        while (hist[0][lo] < need) need -= hist[0][lo--];
+        uint16_t t = hi << 8 | lo;
 
-    // 将每段的数据分别打包
-    for (int i = 0; i < 4; ++i) {
-        tables[i] = vld1q_u8(quantized + i * 16);
+        // 高于t的全部保留，等于t的保留need个；保留与否约各占一半，写成无分支的形式
+        size_t kept = 0;
+        for (size_t i = 0; i < cnt; ++i) {
+            bool tie = scores[i] == t && need > 0;
+            need -= tie;
+            scores[kept] = scores[i];
+            ids[kept] = ids[i];
+            kept += scores[i] > t || tie;
+        }
+        cnt = kept;
+        return t;
+    };
+
+    size_t n_blocks = (base_number + kFastScanBlock - 1) / kFastScanBlock;
+    size_t block_bytes = nsub / 2 * kFastScanBlock;
+    uint16_t result[kFastScanChunkBlocks * kFastScanBlock];
+    for (size_t b = 0; b < n_blocks && threshold <= 65535; b += kFastScanChunkBlocks) {
+        size_t nb = std::min(kFastScanChunkBlocks, n_blocks - b);
+        Lut16Scan(base + b * block_bytes, nb, tables, nsub, result);
+
+        size_t begin = b * kFastScanBlock;
+        size_t n = std::min(nb * kFastScanBlock, base_number - begin);
+        cnt += FilterU16AtLeast(result, n, threshold, begin, scores + cnt, ids + cnt);
+        if (cnt > 2 * rerank) threshold = compact() + 1u;
     }
+    if (cnt > rerank) compact();
+
+    candidates.resize(cnt);
+    for (size_t i = 0; i < cnt; ++i) candidates[i] = {(uint16_t)(65535 - scores[i]), ids[i]};
 }
 
-// uint32_t* extract_smallest_indices(std::vector<std::pair<uint16_t, uint32_t>>& data, size_t k) {
-//     uint32_t* indices = new uint32_t[k];
-//     for (size_t i = 0; i < k; ++i) {
-//         indices[i] = data[i].second; // 取下标
-//     }
-//     return indices;
-// }
+// FastScan粗排默认保留的候选数（k的倍数）
+const size_t kFSRerankPerK = 500;
 
 // 主查询函数
-std::priority_queue<std::pair<float, uint32_t>> fs_simd_search(uint8_t* base, float* center, float* query,
-    size_t base_number, size_t vecdim, size_t k, size_t center_num, size_t center_vecdim, float* base_full,
-    uint8_t* pq_base, float* pq_center, size_t pq_center_num) {
-
-    // std::priority_queue<std::pair<float, uint32_t>> q;
-    // for(int i=0; i<k;++i) q.push({0, i+1});
+// base为PackFastScanCodes打包后的4bit编码（nsub段，每段16类），粗排后用pq_base（pq_cluster_num段）的PQ结果重排。
+// fs_rerank为FastScan留给PQ的候选数，0表示k * kFSRerankPerK；pq_rerank见pq_simd_search
+TopK<>& fs_simd_search(SearchContext& ctx, uint8_t* base, float* center, float* query,
+    size_t base_number, size_t vecdim, size_t k, size_t center_num, size_t center_vecdim, size_t nsub, float* base_full,
+    uint8_t* pq_base, float* pq_center, size_t pq_center_num, size_t pq_cluster_num, size_t fs_rerank = 0,
+    size_t pq_rerank = 0) {
 
     // 预处理
-    uint8x16_t tables[4];
-    fs_pre_calculate_quantized(center, query, tables, center_num, center_vecdim);
-
-    size_t rerank = k * 500;
-    std::vector<std::pair<uint16_t, uint32_t>> candidates;
-
-    for (int i = 0; i < base_number; i += 16) { // 每批处理16条向量
-        uint8_t idx0_raw[16], idx1_raw[16], idx2_raw[16], idx3_raw[16];
-    
-        for (int j = 0; j < 16 && (i + j) < base_number; ++j) {
-            uint8_t* ptr = base + (i + j) * 4;  // 每个向量4个字节
-    
-            idx0_raw[j] = ptr[0] & 0x0F;  // 第0段
-            idx1_raw[j] = ptr[1] & 0x0F;  // 第1段
-            idx2_raw[j] = ptr[2] & 0x0F;  // 第2段
-            idx3_raw[j] = ptr[3] & 0x0F;  // 第3段
-        }
-    
-        uint8x16_t idx0 = vld1q_u8(idx0_raw);
-        uint8x16_t idx1 = vld1q_u8(idx1_raw);
-        uint8x16_t idx2 = vld1q_u8(idx2_raw);
-        uint8x16_t idx3 = vld1q_u8(idx3_raw);
-    
-        // 使用vqtbl1q_u8快速查表
-        uint8x16_t val0 = vqtbl1q_u8(tables[0], idx0);
-        uint8x16_t val1 = vqtbl1q_u8(tables[1], idx1);
-        uint8x16_t val2 = vqtbl1q_u8(tables[2], idx2);
-        uint8x16_t val3 = vqtbl1q_u8(tables[3], idx3);
-    
-        // 先将每两个段累加成u16
-        uint16x8_t partial0 = vaddl_u8(vget_low_u8(val0), vget_low_u8(val1));
-        uint16x8_t partial1 = vaddl_u8(vget_low_u8(val2), vget_low_u8(val3));
-
-        // 再把partial结果相加
-        uint16x8_t sum_low = vaddq_u16(partial0, partial1);
-
-        uint16x8_t partial2 = vaddl_u8(vget_high_u8(val0), vget_high_u8(val1));
-        uint16x8_t partial3 = vaddl_u8(vget_high_u8(val2), vget_high_u8(val3));
-
-        uint16x8_t sum_high = vaddq_u16(partial2, partial3);
-    
-        uint16_t result[16];
-        vst1q_u16(result, sum_low);
-        vst1q_u16(result + 8, sum_high);
-    
-        for (int j = 0; j < 16 && (i + j) < base_number; ++j) {
-            uint16_t raw_dis = result[j];
-            uint16_t dis = 65535 - raw_dis; 
-        
-            candidates.push_back({dis, i+j});
-        }
-    }
-    std::nth_element(candidates.begin(), candidates.begin() + rerank, candidates.end());
-    candidates.resize(rerank);
-    return pq_simd_search(pq_base, pq_center, query, base_number, vecdim, k, pq_center_num, center_vecdim, 4, base_full, true, &candidates);
-    }
\ No newline at end of file
+    uint8_t* tables = SearchContext::buffer(ctx.fs_tables, nsub * 16);
+    fs_pre_calculate_quantized(center, query, tables, center_num, center_vecdim, nsub, SearchContext::buffer(ctx.lut, nsub * 17));
+
+    size_t rerank = std::min(fs_rerank == 0 ? k * kFSRerankPerK : fs_rerank, base_number);
+    fs_scan_candidates(ctx, base, base_number, tables, nsub, rerank, ctx.fs_candidates);
+
+    return pq_simd_search(ctx, pq_base, pq_center, query, base_number, vecdim, k, pq_center_num, vecdim / pq_cluster_num,
+                          pq_cluster_num, base_full, true, &ctx.fs_candidates, nullptr, pq_rerank);
+}
+
+std::priority_queue<std::pair<float, uint32_t>> fs_simd_search(uint8_t* base, float* center, float* query,
+    size_t base_number, size_t vecdim, size_t k, size_t center_num, size_t center_vecdim, size_t nsub, float* base_full,
+    uint8_t* pq_base, float* pq_center, size_t pq_center_num, size_t pq_cluster_num, size_t fs_rerank = 0,
+    size_t pq_rerank = 0) {
+    return fs_simd_search(thread_search_context(), base, center, query, base_number, vecdim, k, center_num, center_vecdim,
+                          nsub, base_full, pq_base, pq_center, pq_center_num, pq_cluster_num, fs_rerank,
+                          pq_rerank).to_queue();
+}
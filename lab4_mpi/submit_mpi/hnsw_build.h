@@ -0,0 +1,233 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <omp.h>
+#include "hnsw_search.h"
+
+// 分批并行构建HNSW，直接写hnswlib::HierarchicalNSW<float>的内部结构，建好后照常saveIndex、searchKnn。
+// hnswlib的addPoint并行插入时，束搜索每扩展一个点都要锁它的邻接表，连边时逐个锁邻居，
+// 新点的层数超过当前最高层时还要持有global锁，线程一多大部分时间在等锁。这里按批插入：
+//   1. 搜索：本批的点在冻结的图（之前各批插入的点）上并行做贪心下降和efConstruction束搜索，
+//      用启发式选出每层的M个邻居，直接写进自己的邻接表。冻结的图只读，新点的邻接表只有自己写，不需要锁
+//   2. 合并：反向边按(层, 目标点, 新点)排序后分组，每组只改目标点在这一层的邻接表，各组并行；
+//      放不下时与hnswlib一样在原有邻居和新邻居上用启发式裁剪
+// 结果与线程数和调度无关，同样的参数每次建出同一张图。
+// 同一批的点互相看不到，批太大图的质量会下降，所以批大小取已插入点数的batch_ratio，随图变大逐渐变大
+
+struct HNSWBuildParams {
+    size_t num_threads;   // 0表示omp_get_max_threads()
+    float batch_ratio;    // 批大小 = 已插入点数 * batch_ratio（至少1个）
+    size_t max_batch;     // 批大小上限，0表示不限
+    bool verbose;         // 打印耗时和每秒插入的向量数
+
+    HNSWBuildParams() : num_threads(0), batch_ratio(0.02f), max_batch(0), verbose(true) {}
+};
+
+struct HNSWBuildStats {
+    size_t batches;
+    double search_seconds;   // 第一阶段
+    double merge_seconds;    // 第二阶段
+    double seconds;          // 总耗时，含初始化
+
+    double vectors_per_second(size_t n) const { return n / seconds; }
+};
+
+// 把第level层当作hnsw_search_layer0的图
+class HNSWLayerGraph {
+public:
+    HNSWLayerGraph(const hnswlib::HierarchicalNSW<float>& hnsw, int level) : hnsw_(hnsw), level_(level) {}
+
+    size_t size() const { return hnsw_.max_elements_; }
+    size_t degree0() const { return level_ ? hnsw_.maxM_ : hnsw_.maxM0_; }
+    const uint32_t* links0(uint32_t id) const { return hnsw_.get_linklist_at_level(id, level_); }
+    static uint32_t count(const uint32_t* ll) { return *ll & 0xFFFF; }
+
+private:
+    const hnswlib::HierarchicalNSW<float>& hnsw_;
+    int level_;
+};
+
+// 与hnswlib的getNeighborsByHeuristic2相同：cand为到某点的(距离, id)，按距离升序。
+// 不足m个时全部保留；否则从近到远，与已选的点都比与该点远的才选，选够m个为止，结果仍是升序
+inline void hnsw_select_neighbors(const hnswlib::HierarchicalNSW<float>& hnsw, std::vector<SearchContext::Entry>& cand,
+                                  size_t m) {
+    if (cand.size() < m) return;
+    size_t kept = 0;
+    for (size_t i = 0; i < cand.size() && kept < m; ++i) {
+        const char* x = hnsw.getDataByInternalId(cand[i].second);
+        bool good = true;
+        for (size_t j = 0; j < kept; ++j) {
+            if (hnsw.fstdistfunc_(hnsw.getDataByInternalId(cand[j].second), x, hnsw.dist_func_param_) < cand[i].first) {
+                good = false;
+                break;
+            }
+        }
+        if (good) cand[kept++] = cand[i];
+    }
+    cand.resize(kept);
+}
+
+// 第一阶段：在冻结的图（入口ep，最高层max_level）上给新点q找每层的邻居，写进q自己的邻接表
+inline void hnsw_build_links(SearchContext& ctx, hnswlib::HierarchicalNSW<float>& hnsw, uint32_t q, uint32_t ep,
+                             int max_level) {
+    HNSWFloatDistance dist(hnsw, (const float*)hnsw.getDataByInternalId(q));
+    int level = hnsw.element_levels_[q];
+    float ep_dist = dist(ep);
+    ep = hnsw_greedy_search(HNSWGraph(hnsw), dist, ep, max_level, ep_dist, level + 1);
+
+    std::vector<SearchContext::Entry>& cand = ctx.hnsw_top;
+    for (int l = std::min(level, max_level); l >= 0; --l) {
+        hnsw_search_layer0(ctx, HNSWLayerGraph(hnsw, l), dist, ep, ep_dist, hnsw.ef_construction_);
+        std::sort(cand.begin(), cand.end());
+        hnsw_select_neighbors(hnsw, cand, hnsw.M_);
+
+        uint32_t* ll = hnsw.get_linklist_at_level(q, l);
+        ll[0] = cand.size();
+        for (size_t j = 0; j < cand.size(); ++j) ll[j + 1] = cand[j].second;
+        // 下一层从选中的最近点出发
+        ep = cand[0].second;
+        ep_dist = cand[0].first;
+    }
+}
+
+// 一条待加的反向边：第level层to -> from
+struct HNSWEdge {
+    int level;
+    uint32_t to, from;
+
+    bool operator<(const HNSWEdge& o) const {
+        if (level != o.level) return level < o.level;
+        if (to != o.to) return to < o.to;
+        return from < o.from;
+    }
+};
+
+// 第二阶段：edges[begin, end)是同一层同一个目标点的反向边，与目标点原有的邻居合并
+inline void hnsw_merge_links(hnswlib::HierarchicalNSW<float>& hnsw, const HNSWEdge* begin, const HNSWEdge* end,
+                             std::vector<SearchContext::Entry>& cand) {
+    int level = begin->level;
+    uint32_t to = begin->to;
+    uint32_t* ll = hnsw.get_linklist_at_level(to, level);
+    size_t size = HNSWLayerGraph::count(ll);
+    size_t max_size = level ? hnsw.maxM_ : hnsw.maxM0_;
+    if (size + (end - begin) <= max_size) {
+        for (const HNSWEdge* e = begin; e != end; ++e) ll[++size] = e->from;
+        ll[0] = size;
+        return;
+    }
+
+    const char* x = hnsw.getDataByInternalId(to);
+    cand.clear();
+    for (size_t j = 1; j <= size; ++j) {
+        cand.push_back(SearchContext::Entry(hnsw.fstdistfunc_(hnsw.getDataByInternalId(ll[j]), x, hnsw.dist_func_param_), ll[j]));
+    }
+    for (const HNSWEdge* e = begin; e != end; ++e) {
+        cand.push_back(SearchContext::Entry(hnsw.fstdistfunc_(hnsw.getDataByInternalId(e->from), x, hnsw.dist_func_param_), e->from));
+    }
+    std::sort(cand.begin(), cand.end());
+    hnsw_select_neighbors(hnsw, cand, max_size);
+    ll[0] = cand.size();
+    for (size_t j = 0; j < cand.size(); ++j) ll[j + 1] = cand[j].second;
+}
+
+// 把data的n个向量（label为0..n-1）插入空的hnsw，hnsw的容量至少为n。
+// 每个点的层数按顺序用hnsw自己的随机数生成器抽取，与逐个addPoint时相同
+bool hnsw_bulk_build(hnswlib::HierarchicalNSW<float>& hnsw, const float* data, size_t n,
+                     const HNSWBuildParams& params = HNSWBuildParams(), HNSWBuildStats* stats = nullptr) {
+    if (hnsw.cur_element_count != 0 || n > hnsw.max_elements_) {
+        std::cerr << "hnsw_bulk_build: need an empty index with room for " << n << " elements\n";
+        return false;
+    }
+    HNSWBuildStats local_stats;
+    if (stats == nullptr) stats = &local_stats;
+    stats->batches = 0;
+    stats->search_seconds = stats->merge_seconds = 0;
+    if (n == 0) {
+        stats->seconds = 0;
+        return true;
+    }
+    int num_threads = params.num_threads ? (int)params.num_threads : omp_get_max_threads();
+    auto t0 = std::chrono::high_resolution_clock::now();
+
+    for (size_t i = 0; i < n; ++i) hnsw.element_levels_[i] = hnsw.getRandomLevel(hnsw.mult_);
+    hnsw.label_lookup_.reserve(n);
+    for (size_t i = 0; i < n; ++i) hnsw.label_lookup_[i] = i;
+
+    #pragma omp parallel for num_threads(num_threads)
+    for (int i = 0; i < (int)n; ++i) {
+        int level = hnsw.element_levels_[i];
+        memset(hnsw.data_level0_memory_ + i * hnsw.size_data_per_element_, 0, hnsw.size_data_per_element_);
+        hnsw.setExternalLabel(i, i);
+        memcpy(hnsw.getDataByInternalId(i), data + (size_t)i * hnsw.data_size_ / sizeof(float), hnsw.data_size_);
+        if (level > 0) {
+            hnsw.linkLists_[i] = (char*)calloc(hnsw.size_links_per_element_ * level + 1, 1);
+        }
+    }
+    hnsw.enterpoint_node_ = 0;
+    hnsw.maxlevel_ = hnsw.element_levels_[0];
+    hnsw.cur_element_count = 1;
+
+    std::vector<HNSWEdge> edges;
+    std::vector<size_t> groups;
+    for (size_t begin = 1; begin < n; ) {
+        size_t batch = std::max<size_t>(1, begin * params.batch_ratio);
+        if (params.max_batch > 0) batch = std::min(batch, params.max_batch);
+        size_t end = std::min(n, begin + batch);
+        uint32_t ep = hnsw.enterpoint_node_;
+        int max_level = hnsw.maxlevel_;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        #pragma omp parallel for num_threads(num_threads) schedule(dynamic, 4)
+        for (int q = (int)begin; q < (int)end; ++q) hnsw_build_links(thread_search_context(), hnsw, q, ep, max_level);
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        edges.clear();
+        for (size_t q = begin; q < end; ++q) {
+            for (int l = std::min(hnsw.element_levels_[q], max_level); l >= 0; --l) {
+                const uint32_t* ll = hnsw.get_linklist_at_level(q, l);
+                for (uint32_t j = 1; j <= ll[0]; ++j) edges.push_back(HNSWEdge{l, ll[j], (uint32_t)q});
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        groups.clear();
+        for (size_t i = 0; i < edges.size(); ++i) {
+            if (i == 0 || edges[i].level != edges[i - 1].level || edges[i].to != edges[i - 1].to) groups.push_back(i);
+        }
+        groups.push_back(edges.size());
+
+        int n_groups = (int)groups.size() - 1;
+        #pragma omp parallel num_threads(num_threads)
+        {
+            std::vector<SearchContext::Entry> cand;
+            #pragma omp for schedule(dynamic, 16)
+            for (int g = 0; g < n_groups; ++g) {
+                hnsw_merge_links(hnsw, &edges[groups[g]], &edges[groups[g + 1]], cand);
+            }
+        }
+
+        // 层数超过当前最高层的点成为新的入口，同层取先插入的
+        for (size_t q = begin; q < end; ++q) {
+            if (hnsw.element_levels_[q] > hnsw.maxlevel_) {
+                hnsw.maxlevel_ = hnsw.element_levels_[q];
+                hnsw.enterpoint_node_ = q;
+            }
+        }
+        hnsw.cur_element_count = end;
+        stats->search_seconds += std::chrono::duration<double>(t2 - t1).count();
+        stats->merge_seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t2).count();
+        ++stats->batches;
+        begin = end;
+    }
+
+    stats->seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+    if (params.verbose) {
+        std::cerr << "hnsw bulk build: " << n << " vectors, " << stats->batches << " batches, " << num_threads
+                  << " threads, search " << stats->search_seconds << "s, merge " << stats->merge_seconds << "s, total "
+                  << stats->seconds << "s, " << stats->vectors_per_second(n) << " vectors/s\n";
+    }
+    return true;
+}
@@ -0,0 +1,110 @@
+// HNSW构建的吞吐：1、8、32、64个线程下，对比hnswlib的并行addPoint与分批构建hnsw_bulk_build（见hnsw_build.h），
+// 打印每秒插入的向量数、建出的图在ef = 100时的recall@10（与暴力搜索比较），
+// 以及分批构建的图的校验和——它与线程数无关，各行应当相同。
+// 数据是随机生成的聚类数据（单位向量，内积距离）。
+// 编译：g++ hnsw_build_bench.cc -o hnsw_build_bench -O2 -fopenmp -lpthread -std=c++11
+// 运行：./hnsw_build_bench [n 100000] [efConstruction 150] [M 16]
+#include <vector>
+#include <set>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <omp.h>
+#include "hnsw_build.h"
+#include "bench_data.h"
+
+// 暴力搜索的前k个
+std::vector<uint32_t> GroundTruth(const std::vector<float>& base, const std::vector<float>& query, size_t vecdim,
+                                  size_t k) {
+    size_t n = base.size() / vecdim, nq = query.size() / vecdim;
+    std::vector<uint32_t> gt(nq * k);
+    #pragma omp parallel for
+    for (int q = 0; q < (int)nq; ++q) {
+        std::vector<std::pair<float, uint32_t>> dis(n);
+        for (size_t i = 0; i < n; ++i) {
+            dis[i] = std::make_pair(1 - inner_product_scalar(&query[q * vecdim], &base[i * vecdim], vecdim), (uint32_t)i);
+        }
+        std::partial_sort(dis.begin(), dis.begin() + k, dis.end());
+        for (size_t j = 0; j < k; ++j) gt[q * k + j] = dis[j].second;
+    }
+    return gt;
+}
+
+float Recall(hnswlib::HierarchicalNSW<float>& hnsw, const std::vector<float>& query, const std::vector<uint32_t>& gt,
+             size_t vecdim, size_t k) {
+    size_t nq = query.size() / vecdim, hit = 0;
+    hnsw.setEf(100);
+    for (size_t q = 0; q < nq; ++q) {
+        std::set<uint32_t> gtset(gt.begin() + q * k, gt.begin() + (q + 1) * k);
+        for (auto r = hnsw.searchKnn(&query[q * vecdim], k); !r.empty(); r.pop()) hit += gtset.count(r.top().second);
+    }
+    return (float)hit / (nq * k);
+}
+
+// 各层邻接表的FNV-1a校验和
+uint64_t GraphChecksum(const hnswlib::HierarchicalNSW<float>& hnsw) {
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&](const uint32_t* p, size_t cnt) {
+        for (size_t i = 0; i < cnt; ++i) h = (h ^ p[i]) * 1099511628211ull;
+    };
+    for (size_t i = 0; i < hnsw.cur_element_count; ++i) {
+        const uint32_t* ll = hnsw.get_linklist0(i);
+        mix(ll, 1 + (*ll & 0xFFFF));
+        for (int l = 1; l <= hnsw.element_levels_[i]; ++l) {
+            ll = hnsw.get_linklist(i, l);
+            mix(ll, 1 + (*ll & 0xFFFF));
+        }
+    }
+    mix(&hnsw.enterpoint_node_, 1);
+    return h;
+}
+
+int main(int argc, char* argv[]) {
+    size_t n = argc > 1 ? std::atol(argv[1]) : 100000;
+    size_t ef_construction = argc > 2 ? std::atol(argv[2]) : 150;
+    size_t M = argc > 3 ? std::atol(argv[3]) : 16;
+    const size_t vecdim = 96, nq = 1000, k = 10;
+    const size_t threads[] = {1, 8, 32, 64};
+
+    std::mt19937 gen(1);
+    std::vector<float> base = MakeClustered(n, vecdim, 100, gen);
+    std::vector<float> query = MakeClustered(nq, vecdim, 100, gen);
+    std::vector<uint32_t> gt = GroundTruth(base, query, vecdim, k);
+    hnswlib::InnerProductSpace ipspace(vecdim);
+
+    std::cout << n << " x " << vecdim << ", M = " << M << ", efConstruction = " << ef_construction << ", "
+              << omp_get_max_threads() << " hardware threads\n";
+    std::cout << std::left << std::setw(10) << "threads" << std::right << std::setw(16) << "addPoint vec/s"
+              << std::setw(10) << "recall" << std::setw(16) << "bulk vec/s" << std::setw(10) << "recall"
+              << std::setw(10) << "batches" << "   checksum\n";
+    for (size_t t : threads) {
+        double lib_vps;
+        float lib_recall;
+        {
+            hnswlib::HierarchicalNSW<float> hnsw(&ipspace, n, M, ef_construction);
+            auto t0 = std::chrono::high_resolution_clock::now();
+            hnsw.addPoint(base.data(), 0);
+            #pragma omp parallel for num_threads(t)
+            for (int i = 1; i < (int)n; ++i) hnsw.addPoint(base.data() + (size_t)i * vecdim, i);
+            lib_vps = n / std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+            lib_recall = Recall(hnsw, query, gt, vecdim, k);
+        }
+
+        hnswlib::HierarchicalNSW<float> hnsw(&ipspace, n, M, ef_construction);
+        HNSWBuildParams params;
+        params.num_threads = t;
+        params.verbose = false;
+        HNSWBuildStats stats;
+        hnsw_bulk_build(hnsw, base.data(), n, params, &stats);
+        float bulk_recall = Recall(hnsw, query, gt, vecdim, k);
+
+        std::cout << std::left << std::setw(10) << t << std::right << std::fixed << std::setprecision(0)
+                  << std::setw(16) << lib_vps << std::setprecision(4) << std::setw(10) << lib_recall
+                  << std::setprecision(0) << std::setw(16) << stats.vectors_per_second(n) << std::setprecision(4)
+                  << std::setw(10) << bulk_recall << std::setw(10) << stats.batches << "   " << std::hex
+                  << GraphChecksum(hnsw) << std::dec << "\n";
+    }
+    return 0;
+}
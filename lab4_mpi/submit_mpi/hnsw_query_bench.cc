@@ -0,0 +1,94 @@
+// HNSW并发查询的吞吐：同一张图，1、8、32、64个线程同时查询，对比
+//   searchKnn    hnswlib原来的查询，每条查询从VisitedListPool取访问标记，取和还都要加锁
+//   dense        hnsw_search，访问标记在每个线程的SearchContext里，不加锁
+//   sparse       hnsw_search，访问标记用稀疏哈希表
+// 并打印按元素数和ef自动选择的结果。dense、sparse的结果与searchKnn逐条比较，应当完全相同。
+// 数据是随机生成的聚类数据（单位向量，内积距离），图用hnswlib构建。
+// 编译：g++ hnsw_query_bench.cc -o hnsw_query_bench -O2 -fopenmp -lpthread -std=c++11
+// 运行：./hnsw_query_bench [n 100000] [ef 100]
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <functional>
+#include <omp.h>
+#include "hnsw_search.h"
+#include "bench_data.h"
+
+// num_threads个线程分nq条查询，返回每秒查询数
+double Throughput(size_t num_threads, size_t nq, const std::function<void(size_t)>& search) {
+    auto t0 = std::chrono::high_resolution_clock::now();
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic, 16)
+    for (int i = 0; i < (int)nq; ++i) search(i);
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+    return nq / seconds;
+}
+
+// 每个线程的SearchContext都设为mode
+void SetVisitedMode(size_t num_threads, VisitedMode mode) {
+    #pragma omp parallel num_threads(num_threads)
+    thread_search_context().visited.mode = mode;
+}
+
+int main(int argc, char* argv[]) {
+    size_t n = argc > 1 ? std::atol(argv[1]) : 100000;
+    size_t ef = argc > 2 ? std::atol(argv[2]) : 100;
+    const size_t vecdim = 96, nq = 10000, k = 10, M = 16, ef_construction = 150;
+    const size_t threads[] = {1, 8, 32, 64};
+
+    std::mt19937 gen(1);
+    std::vector<float> base = MakeClustered(n, vecdim, 100, gen);
+    std::vector<float> query = MakeClustered(nq, vecdim, 100, gen);
+
+    hnswlib::InnerProductSpace ipspace(vecdim);
+    hnswlib::HierarchicalNSW<float> hnsw(&ipspace, n, M, ef_construction);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    hnsw.addPoint(base.data(), 0);
+    #pragma omp parallel for
+    for (int i = 1; i < (int)n; ++i) hnsw.addPoint(base.data() + (size_t)i * vecdim, i);
+    double build = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+    hnsw.setEf(ef);
+
+    VisitedSet probe;
+    bool auto_sparse = probe.reset(n, ef * hnsw.maxM0_);
+    std::cout << n << " x " << vecdim << ", M = " << M << ", ef = " << ef << ", k = " << k << ", build " << build
+              << "s, " << omp_get_max_threads() << " hardware threads, auto visited set: "
+              << (auto_sparse ? "sparse" : "dense") << "\n";
+
+    // 结果一致性：单线程逐条比较
+    const char* mode_names[] = {"auto", "dense", "sparse"};
+    for (int mode = VISITED_DENSE; mode <= VISITED_SPARSE; ++mode) {
+        thread_search_context().visited.mode = (VisitedMode)mode;
+        size_t mismatch = 0;
+        for (size_t i = 0; i < 1000; ++i) {
+            auto expect = hnsw.searchKnn(&query[i * vecdim], k);
+            auto got = hnsw_search(hnsw, &query[i * vecdim], k, ef);
+            if (expect.size() != got.size()) ++mismatch;
+            for (; !expect.empty() && !got.empty(); expect.pop(), got.pop()) {
+                if (expect.top().second != got.top().second) {
+                    ++mismatch;
+                    break;
+                }
+            }
+        }
+        std::cout << mode_names[mode] << ": " << mismatch << " / 1000 queries differ from searchKnn\n";
+    }
+
+    std::cout << std::left << std::setw(10) << "threads" << std::right << std::setw(14) << "searchKnn"
+              << std::setw(14) << "dense" << std::setw(14) << "sparse" << "   (queries/s)\n";
+    for (size_t t : threads) {
+        double qps_lib = Throughput(t, nq, [&](size_t i) { hnsw.searchKnn(&query[i * vecdim], k); });
+        double qps[2];
+        for (int mode = VISITED_DENSE; mode <= VISITED_SPARSE; ++mode) {
+            SetVisitedMode(t, (VisitedMode)mode);
+            qps[mode - VISITED_DENSE] = Throughput(t, nq, [&](size_t i) {
+                hnsw_search(thread_search_context(), hnsw, &query[i * vecdim], k, ef);
+            });
+        }
+        std::cout << std::left << std::setw(10) << t << std::right << std::fixed << std::setprecision(0)
+                  << std::setw(14) << qps_lib << std::setw(14) << qps[0] << std::setw(14) << qps[1] << "\n";
+    }
+    return 0;
+}
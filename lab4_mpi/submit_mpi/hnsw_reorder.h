@@ -0,0 +1,278 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <unordered_set>
+#include "hnswlib/hnswlib/hnswlib.h"
+
+// 构建后给HNSW的点重新编号，让图上相邻的点在data_level0_memory_里也挨在一起。
+// 内部id按插入顺序分配，并行构建时插入顺序与图的结构无关，一个点的邻居散落在整块内存里，
+// 搜索时每算一个距离都可能是一次cache miss、甚至TLB miss。重排只改内部id：
+// 第0层的记录（邻接表 + 向量 + label）整体搬到新位置，各层邻接表里的id换成新编号，
+// label_lookup_、入口点一起更新，label不变，搜索代码和saveIndex的文件格式都不用改。
+// 三种顺序：
+//   BFS     从入口点在第0层广度优先，最简单
+//   RCM     反向Cuthill-McKee：从度最小的点开始广度优先，同一个点的邻居按度从小到大，最后整体反转
+//   GORDER  Gorder（Wei et al. 2016）：贪心地逐个放点，每次选与最近放下的window个点得分最高的，
+//           得分 = 两点之间的边数 + 共同的入邻居数
+// 第0层的边数为n * maxM0，三种方法都是线性或近似线性的
+
+enum HNSWOrder {
+    HNSW_ORDER_BFS = 0,
+    HNSW_ORDER_RCM,
+    HNSW_ORDER_GORDER
+};
+
+// Gorder的窗口大小，论文中取5
+const size_t kGorderWindow = 5;
+
+// 第0层的出边（CSR），out[begin[v], begin[v + 1])是v的邻居
+struct HNSWAdjacency {
+    std::vector<size_t> begin;
+    std::vector<uint32_t> out;
+
+    size_t degree(uint32_t v) const { return begin[v + 1] - begin[v]; }
+};
+
+inline HNSWAdjacency hnsw_level0_adjacency(const hnswlib::HierarchicalNSW<float>& hnsw) {
+    size_t n = hnsw.cur_element_count;
+    HNSWAdjacency adj;
+    adj.begin.resize(n + 1);
+    adj.begin[0] = 0;
+    for (size_t v = 0; v < n; ++v) adj.begin[v + 1] = adj.begin[v] + (*hnsw.get_linklist0(v) & 0xFFFF);
+    adj.out.resize(adj.begin[n]);
+    for (size_t v = 0; v < n; ++v) {
+        const uint32_t* ll = hnsw.get_linklist0(v);
+        std::copy(ll + 1, ll + 1 + adj.degree(v), adj.out.begin() + adj.begin[v]);
+    }
+    return adj;
+}
+
+// 反向边
+inline HNSWAdjacency hnsw_transpose(const HNSWAdjacency& adj) {
+    size_t n = adj.begin.size() - 1;
+    HNSWAdjacency t;
+    t.begin.assign(n + 1, 0);
+    for (size_t i = 0; i < adj.out.size(); ++i) ++t.begin[adj.out[i] + 1];
+    for (size_t v = 0; v < n; ++v) t.begin[v + 1] += t.begin[v];
+    t.out.resize(adj.out.size());
+    std::vector<size_t> pos(t.begin.begin(), t.begin.end() - 1);
+    for (uint32_t v = 0; v < n; ++v) {
+        for (size_t i = adj.begin[v]; i < adj.begin[v + 1]; ++i) t.out[pos[adj.out[i]]++] = v;
+    }
+    return t;
+}
+
+// 广度优先，seeds依次作为起点（已经访问过的跳过），返回访问顺序。
+// by_degree为true时同一个点的未访问邻居按度从小到大入队（Cuthill-McKee）
+inline std::vector<uint32_t> hnsw_bfs_order(const HNSWAdjacency& adj, const std::vector<uint32_t>& seeds,
+                                            bool by_degree) {
+    size_t n = adj.begin.size() - 1;
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    std::vector<char> visited(n, 0);
+    for (size_t s = 0; s < seeds.size() && order.size() < n; ++s) {
+        if (visited[seeds[s]]) continue;
+        visited[seeds[s]] = 1;
+        size_t head = order.size();
+        order.push_back(seeds[s]);
+        for (; head < order.size(); ++head) {
+            uint32_t v = order[head];
+            size_t first = order.size();
+            for (size_t i = adj.begin[v]; i < adj.begin[v + 1]; ++i) {
+                uint32_t u = adj.out[i];
+                if (visited[u]) continue;
+                visited[u] = 1;
+                order.push_back(u);
+            }
+            if (by_degree) {
+                std::stable_sort(order.begin() + first, order.end(), [&adj](uint32_t a, uint32_t b) {
+                    return adj.degree(a) < adj.degree(b);
+                });
+            }
+        }
+    }
+    return order;
+}
+
+const uint32_t kGorderNone = 0xFFFFFFFF;
+
+// Gorder用的桶队列：每个未放置的点有一个非负整数key，key > 0的点按key挂在桶的双向链表里，
+// 加一、减一、取key最大的点都是O(1)（摊还）
+class GorderQueue {
+public:
+    explicit GorderQueue(size_t n)
+        : key_(n, 0), prev_(n), next_(n), removed_(n, 0), heads_(1, kGorderNone), max_key_(0) {}
+
+    void add(uint32_t v, int delta) {
+        if (removed_[v]) return;
+        if (key_[v] > 0) unlink(v);
+        key_[v] += delta;
+        if (key_[v] > 0) link(v);
+    }
+
+    void remove(uint32_t v) {
+        if (key_[v] > 0) unlink(v);
+        removed_[v] = 1;
+    }
+
+    // key最大的点，没有key > 0的点时返回kGorderNone
+    uint32_t top() {
+        while (max_key_ > 0 && heads_[max_key_] == kGorderNone) --max_key_;
+        return max_key_ > 0 ? heads_[max_key_] : kGorderNone;
+    }
+
+private:
+    void link(uint32_t v) {
+        size_t k = key_[v];
+        if (heads_.size() <= k) heads_.resize(k + 1, kGorderNone);
+        prev_[v] = kGorderNone;
+        next_[v] = heads_[k];
+        if (heads_[k] != kGorderNone) prev_[heads_[k]] = v;
+        heads_[k] = v;
+        max_key_ = std::max(max_key_, k);
+    }
+
+    void unlink(uint32_t v) {
+        if (prev_[v] != kGorderNone) next_[prev_[v]] = next_[v];
+        else heads_[key_[v]] = next_[v];
+        if (next_[v] != kGorderNone) prev_[next_[v]] = prev_[v];
+    }
+
+    std::vector<int> key_;
+    std::vector<uint32_t> prev_, next_;
+    std::vector<char> removed_;
+    std::vector<uint32_t> heads_;
+    size_t max_key_;
+};
+
+// 从start开始的Gorder顺序。v进入窗口时，与v有边的点（出边、入边）和与v有共同入邻居的点key加一，
+// 离开窗口时减一，于是key就是与窗口内各点的得分之和。队列空了（剩下的点与窗口都无关）时按id顺序取下一个
+inline std::vector<uint32_t> hnsw_gorder(const HNSWAdjacency& adj, uint32_t start, size_t window) {
+    size_t n = adj.begin.size() - 1;
+    HNSWAdjacency in = hnsw_transpose(adj);
+    GorderQueue queue(n);
+    auto update = [&](uint32_t v, int delta) {
+        for (size_t i = adj.begin[v]; i < adj.begin[v + 1]; ++i) queue.add(adj.out[i], delta);
+        for (size_t i = in.begin[v]; i < in.begin[v + 1]; ++i) {
+            uint32_t w = in.out[i];
+            queue.add(w, delta);
+            for (size_t j = adj.begin[w]; j < adj.begin[w + 1]; ++j) {
+                if (adj.out[j] != v) queue.add(adj.out[j], delta);
+            }
+        }
+    };
+
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    std::vector<char> placed(n, 0);
+    uint32_t scan = 0;
+    uint32_t v = start;
+    while (true) {
+        placed[v] = 1;
+        queue.remove(v);
+        order.push_back(v);
+        if (order.size() == n) break;
+        if (order.size() > window) update(order[order.size() - 1 - window], -1);
+        update(v, 1);
+
+        v = queue.top();
+        if (v == kGorderNone) {
+            while (placed[scan]) ++scan;
+            v = scan;
+        }
+    }
+    return order;
+}
+
+// 新的顺序：返回new_to_old，第i个新id对应原来的内部id new_to_old[i]
+inline std::vector<uint32_t> hnsw_order(const hnswlib::HierarchicalNSW<float>& hnsw, HNSWOrder order,
+                                        size_t window = kGorderWindow) {
+    size_t n = hnsw.cur_element_count;
+    if (n == 0) return std::vector<uint32_t>();
+    HNSWAdjacency adj = hnsw_level0_adjacency(hnsw);
+    std::vector<uint32_t> seeds(n);
+    for (uint32_t v = 0; v < n; ++v) seeds[v] = v;
+
+    if (order == HNSW_ORDER_GORDER) return hnsw_gorder(adj, hnsw.enterpoint_node_, window);
+    if (order == HNSW_ORDER_RCM) {
+        // 每个连通部分从剩下的度最小的点开始
+        std::stable_sort(seeds.begin(), seeds.end(), [&adj](uint32_t a, uint32_t b) {
+            return adj.degree(a) < adj.degree(b);
+        });
+        std::vector<uint32_t> result = hnsw_bfs_order(adj, seeds, true);
+        std::reverse(result.begin(), result.end());
+        return result;
+    }
+    seeds.insert(seeds.begin(), (uint32_t)hnsw.enterpoint_node_);
+    return hnsw_bfs_order(adj, seeds, false);
+}
+
+// 按new_to_old重新编号：搬第0层的记录和上层邻接表的指针，把所有邻接表里的id换成新编号。
+// 第0层搬到新分配的一块内存里，重排期间要多占一份第0层的内存
+inline bool hnsw_apply_order(hnswlib::HierarchicalNSW<float>& hnsw, const std::vector<uint32_t>& new_to_old) {
+    size_t n = hnsw.cur_element_count;
+    if (new_to_old.size() != n) {
+        std::cerr << "hnsw_apply_order: order has " << new_to_old.size() << " ids, index has " << n << "\n";
+        return false;
+    }
+    size_t record = hnsw.size_data_per_element_;
+    char* level0 = (char*)malloc(hnsw.max_elements_ * record);
+    if (level0 == nullptr) {
+        std::cerr << "hnsw_apply_order: out of memory\n";
+        return false;
+    }
+    std::vector<uint32_t> old_to_new(n);
+    for (uint32_t i = 0; i < n; ++i) old_to_new[new_to_old[i]] = i;
+
+    std::vector<char*> link_lists(n);
+    std::vector<int> levels(n);
+    #pragma omp parallel for
+    for (int i = 0; i < (int)n; ++i) {
+        uint32_t old = new_to_old[i];
+        char* rec = level0 + (size_t)i * record;
+        memcpy(rec, hnsw.data_level0_memory_ + old * record, record);
+        uint32_t* ll = (uint32_t*)(rec + hnsw.offsetLevel0_);
+        for (uint32_t j = 1; j <= (ll[0] & 0xFFFF); ++j) ll[j] = old_to_new[ll[j]];
+
+        levels[i] = hnsw.element_levels_[old];
+        link_lists[i] = hnsw.linkLists_[old];
+        for (int l = 1; l <= levels[i]; ++l) {
+            ll = (uint32_t*)(link_lists[i] + (l - 1) * hnsw.size_links_per_element_);
+            for (uint32_t j = 1; j <= (ll[0] & 0xFFFF); ++j) ll[j] = old_to_new[ll[j]];
+        }
+    }
+    free(hnsw.data_level0_memory_);
+    hnsw.data_level0_memory_ = level0;
+    std::copy(link_lists.begin(), link_lists.end(), hnsw.linkLists_);
+    std::copy(levels.begin(), levels.end(), hnsw.element_levels_.begin());
+
+    for (uint32_t i = 0; i < n; ++i) hnsw.label_lookup_[hnsw.getExternalLabel(i)] = i;
+    std::unordered_set<hnswlib::tableint> deleted;
+    for (auto id : hnsw.deleted_elements) deleted.insert(old_to_new[id]);
+    hnsw.deleted_elements.swap(deleted);
+    hnsw.enterpoint_node_ = old_to_new[hnsw.enterpoint_node_];
+    return true;
+}
+
+inline bool hnsw_reorder(hnswlib::HierarchicalNSW<float>& hnsw, HNSWOrder order, size_t window = kGorderWindow) {
+    return hnsw_apply_order(hnsw, hnsw_order(hnsw, order, window));
+}
+
+// 第0层每条边两端id之差的log2(|gap| + 1)的平均，越小邻居在内存里越近
+inline double hnsw_log_gap(const hnswlib::HierarchicalNSW<float>& hnsw) {
+    double sum = 0;
+    size_t edges = 0;
+    for (size_t v = 0; v < hnsw.cur_element_count; ++v) {
+        const uint32_t* ll = hnsw.get_linklist0(v);
+        for (uint32_t j = 1; j <= (ll[0] & 0xFFFF); ++j) {
+            sum += std::log2(std::fabs((double)ll[j] - (double)v) + 1);
+            ++edges;
+        }
+    }
+    return edges ? sum / edges : 0;
+}
@@ -0,0 +1,184 @@
+#pragma once
+#include <queue>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "hnswlib/hnswlib/hnswlib.h"
+#include "search_context.h"
+
+// HNSW查询。图的遍历写成模板，hnswlib的FP32图和量化图（HNSWSQ8Index，见hnsw_sq.h）共用。
+// 与hnswlib的searchKnn相比，访问标记用ctx.visited：每个线程的SearchContext一份，
+// 不经过VisitedListPool的互斥锁，多线程并发查询时没有争用；
+// 元素很多而ef较小时自动换成稀疏的哈希表（见visited_set.h）。
+// Graph需要提供：size()、degree0()（第0层最大邻居数）、links0(id)、links(id, level)、count(ll)，
+//   邻接表为[邻居数, id...]
+// Dist需要提供：operator()(id)返回与query的距离，prefetch(id)预取向量
+
+// hnswlib图的只读视图，不处理标记删除的元素
+class HNSWGraph {
+public:
+    explicit HNSWGraph(const hnswlib::HierarchicalNSW<float>& hnsw) : hnsw_(hnsw) {}
+
+    size_t size() const { return hnsw_.cur_element_count; }
+    size_t degree0() const { return hnsw_.maxM0_; }
+    const uint32_t* links0(uint32_t id) const { return hnsw_.get_linklist0(id); }
+    const uint32_t* links(uint32_t id, int level) const { return hnsw_.get_linklist(id, level); }
+    // 邻居数只占低16位，高位是删除标记
+    static uint32_t count(const uint32_t* ll) { return *ll & 0xFFFF; }
+
+private:
+    const hnswlib::HierarchicalNSW<float>& hnsw_;
+};
+
+// hnswlib自己的距离函数（InnerProductSpace时为1 - <q, x>），结果与searchKnn一致
+class HNSWFloatDistance {
+public:
+    HNSWFloatDistance(const hnswlib::HierarchicalNSW<float>& hnsw, const float* query) : hnsw_(hnsw), query_(query) {}
+
+    float operator()(uint32_t id) const {
+        return hnsw_.fstdistfunc_(query_, hnsw_.getDataByInternalId(id), hnsw_.dist_func_param_);
+    }
+    void prefetch(uint32_t id) const { __builtin_prefetch(hnsw_.getDataByInternalId(id)); }
+
+private:
+    const hnswlib::HierarchicalNSW<float>& hnsw_;
+    const float* query_;
+};
+
+// 从ep出发在第max_level..min_level层贪心下降，返回第min_level层的最近点，ep_dist同时更新为它的距离
+template <class Graph, class Dist>
+uint32_t hnsw_greedy_search(const Graph& g, const Dist& dist, uint32_t ep, int max_level, float& ep_dist,
+                            int min_level = 1) {
+    for (int level = max_level; level >= min_level; --level) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            const uint32_t* ll = g.links(ep, level);
+            uint32_t size = Graph::count(ll);
+            for (uint32_t j = 1; j <= size; ++j) {
+                float d = dist(ll[j]);
+                if (d < ep_dist) {
+                    ep_dist = d;
+                    ep = ll[j];
+                    changed = true;
+                }
+            }
+        }
+    }
+    return ep;
+}
+
+// 堆只按距离比较，与hnswlib的CompareByFirst相同
+struct EntryLess {
+    bool operator()(const SearchContext::Entry& a, const SearchContext::Entry& b) const { return a.first < b.first; }
+};
+struct EntryGreater {
+    bool operator()(const SearchContext::Entry& a, const SearchContext::Entry& b) const { return a.first > b.first; }
+};
+
+// 与hnswlib的searchBaseLayerST相同的第0层束搜索，两个堆放在ctx里复用：
+// candidates为待扩展的点（小顶堆），top为当前最近的ef个（大顶堆），结束时top里是(距离, 内部id)。
+// Visited为DenseVisited（按值）或SparseVisited&
+template <class Graph, class Dist, class Visited>
+void hnsw_search_layer0(SearchContext& ctx, const Graph& g, const Dist& dist, Visited visited, uint32_t ep,
+                        float ep_dist, size_t ef) {
+    typedef SearchContext::Entry Entry;
+    std::vector<Entry>& candidates = ctx.hnsw_candidates;
+    std::vector<Entry>& top = ctx.hnsw_top;
+    EntryGreater min_first;
+    EntryLess max_first;
+    candidates.clear();
+    top.clear();
+
+    candidates.push_back(Entry(ep_dist, ep));
+    top.push_back(Entry(ep_dist, ep));
+    visited.insert(ep);
+    float lower_bound = ep_dist;
+
+    while (!candidates.empty()) {
+        Entry cur = candidates.front();
+        if (cur.first > lower_bound) break;
+        std::pop_heap(candidates.begin(), candidates.end(), min_first);
+        candidates.pop_back();
+
+        const uint32_t* ll = g.links0(cur.second);
+        uint32_t size = Graph::count(ll);
+        if (size > 0) {
+            visited.prefetch(ll[1]);
+            dist.prefetch(ll[1]);
+        }
+        for (uint32_t j = 1; j <= size; ++j) {
+            uint32_t cand = ll[j];
+            if (j < size) {
+                visited.prefetch(ll[j + 1]);
+                dist.prefetch(ll[j + 1]);
+            }
+            if (!visited.insert(cand)) continue;
+
+            float d = dist(cand);
+            if (top.size() < ef || d < lower_bound) {
+                candidates.push_back(Entry(d, cand));
+                std::push_heap(candidates.begin(), candidates.end(), min_first);
+                // 下一个要扩展的点的邻接表
+                __builtin_prefetch(g.links0(candidates.front().second));
+                top.push_back(Entry(d, cand));
+                std::push_heap(top.begin(), top.end(), max_first);
+                if (top.size() > ef) {
+                    std::pop_heap(top.begin(), top.end(), max_first);
+                    top.pop_back();
+                }
+                lower_bound = top.front().first;
+            }
+        }
+    }
+}
+
+template <class Graph, class Dist>
+void hnsw_search_layer0(SearchContext& ctx, const Graph& g, const Dist& dist, uint32_t ep, float ep_dist, size_t ef) {
+    // 每扩展一个点最多看degree0个邻居，扩展的点数与ef同一量级
+    if (ctx.visited.reset(g.size(), ef * g.degree0())) {
+        hnsw_search_layer0<Graph, Dist, SparseVisited&>(ctx, g, dist, ctx.visited.sparse(), ep, ep_dist, ef);
+    } else {
+        hnsw_search_layer0(ctx, g, dist, ctx.visited.dense(), ep, ep_dist, ef);
+    }
+}
+
+// 与hnsw.searchKnn(query, k)（ef取max(ef, k)）结果相同，只是不加锁
+TopK<>& hnsw_search(SearchContext& ctx, const hnswlib::HierarchicalNSW<float>& hnsw, const float* query, size_t k,
+                    size_t ef) {
+    TopK<>& result = ctx.result;
+    result.reset(k);
+    if (hnsw.cur_element_count == 0) return result;
+
+    HNSWGraph graph(hnsw);
+    HNSWFloatDistance dist(hnsw, query);
+    uint32_t ep = hnsw.enterpoint_node_;
+    float ep_dist = dist(ep);
+    ep = hnsw_greedy_search(graph, dist, ep, hnsw.maxlevel_, ep_dist);
+    hnsw_search_layer0(ctx, graph, dist, ep, ep_dist, std::max(ef, k));
+
+    const std::vector<SearchContext::Entry>& top = ctx.hnsw_top;
+    for (size_t i = 0; i < top.size(); ++i) result.push(top[i].first, (uint32_t)hnsw.getExternalLabel(top[i].second));
+    result.compact();
+    return result;
+}
+
+std::priority_queue<std::pair<float, uint32_t>> hnsw_search(const hnswlib::HierarchicalNSW<float>& hnsw,
+                                                            const float* query, size_t k, size_t ef) {
+    return hnsw_search(thread_search_context(), hnsw, query, k, ef).to_queue();
+}
+
+// 批量查询：queries为连续的nq条查询，第i条的结果写进results[i]，逐条调用hnsw_search。
+// 试过几条查询交错推进、互相掩盖预取延迟，在比缓存大的图上也没有比逐条查询快，没有保留
+void hnsw_search_batch(SearchContext& ctx, const hnswlib::HierarchicalNSW<float>& hnsw, const float* queries, size_t nq,
+                       size_t k, size_t ef, std::priority_queue<std::pair<float, uint32_t>>* results) {
+    size_t vecdim = hnsw.data_size_ / sizeof(float);
+    for (size_t i = 0; i < nq; ++i) results[i] = hnsw_search(ctx, hnsw, queries + i * vecdim, k, ef).to_queue();
+}
+
+std::vector<std::priority_queue<std::pair<float, uint32_t>>> hnsw_search_batch(
+    const hnswlib::HierarchicalNSW<float>& hnsw, const float* queries, size_t nq, size_t k, size_t ef) {
+    std::vector<std::priority_queue<std::pair<float, uint32_t>>> results(nq);
+    hnsw_search_batch(thread_search_context(), hnsw, queries, nq, k, ef, results.data());
+    return results;
+}
@@ -0,0 +1,187 @@
+#pragma once
+#include <queue>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include "hnswlib/hnswlib/hnswlib.h"
+#include "sq_simd_scan.h"
+#include "hnsw_search.h"
+
+// 量化HNSW：图结构取自建好的hnswlib::HierarchicalNSW<float>，第0层每个元素的记录为
+//   [邻居数 + maxM0个邻居id][编码之和int32][SQ8编码vecdim字节][外部label uint32]
+// 不再存FP32向量：DEEP的96维向量是384字节，M = 16时一条记录从hnswlib的524字节降到236字节。
+// 遍历全程用int8权重与u8编码的整数点积（SQ8DotBatch）算量化距离，
+// 最后的ef个候选按label到原始base里取FP32重排，base只在重排时访问。
+// 上层邻接表与hnswlib相同：每个元素level段，每段[邻居数 + maxM个邻居id]。
+// 遍历用hnsw_search.h里的模板，HNSWSQ8Index本身满足其中Graph的要求
+
+struct HNSWSQ8Index {
+    size_t n = 0, vecdim = 0;
+    size_t max_m = 0, max_m0 = 0;
+    int max_level = 0;
+    uint32_t enterpoint = 0;
+    SQ8Codec codec;
+    size_t size_links0 = 0, size_record = 0;     // 第0层邻接表、整条记录的字节数
+    std::vector<char> level0;                    // [n][size_record]
+    std::vector<int> levels;                     // 每个元素所在的最高层
+    std::vector<size_t> upper_offset;            // 元素的上层邻接表在upper_links中的起点
+    std::vector<uint32_t> upper_links;
+
+    size_t size() const { return n; }
+    size_t degree0() const { return max_m0; }
+    static uint32_t count(const uint32_t* ll) { return ll[0]; }
+    // [邻居数, id...]
+    const uint32_t* links0(uint32_t id) const { return (const uint32_t*)(level0.data() + id * size_record); }
+    const uint32_t* links(uint32_t id, int level) const {
+        return upper_links.data() + upper_offset[id] + (level - 1) * (max_m + 1);
+    }
+    const int32_t* code_sum(uint32_t id) const { return (const int32_t*)(level0.data() + id * size_record + size_links0); }
+    const uint8_t* codes(uint32_t id) const { return (const uint8_t*)(code_sum(id) + 1); }
+    uint32_t label(uint32_t id) const {
+        uint32_t l;
+        memcpy(&l, codes(id) + vecdim, sizeof(l));
+        return l;
+    }
+
+    // 按levels排好上层邻接表的起点
+    void init_layout() {
+        size_links0 = (max_m0 + 1) * sizeof(uint32_t);
+        size_record = size_links0 + sizeof(int32_t) + vecdim + sizeof(uint32_t);
+        upper_offset.resize(n);
+        size_t off = 0;
+        for (size_t i = 0; i < n; ++i) {
+            upper_offset[i] = off;
+            off += levels[i] * (max_m + 1);
+        }
+        upper_links.resize(off);
+        level0.resize(n * size_record);
+    }
+};
+
+// 从FP32的HNSW生成量化索引：量化范围在全部向量上按维度训练（clip见SQ8Codec::train），
+// 内部id与邻接关系保持不变。hnsw里不能有标记删除的元素
+void hnsw_sq_build(HNSWSQ8Index& index, const hnswlib::HierarchicalNSW<float>& hnsw, float clip = 0) {
+    index.n = hnsw.cur_element_count;
+    index.vecdim = hnsw.data_size_ / sizeof(float);
+    index.max_m = hnsw.maxM_;
+    index.max_m0 = hnsw.maxM0_;
+    index.max_level = hnsw.maxlevel_;
+    index.enterpoint = hnsw.enterpoint_node_;
+    index.levels.assign(hnsw.element_levels_.begin(), hnsw.element_levels_.begin() + index.n);
+    index.init_layout();
+
+    size_t n = index.n, vecdim = index.vecdim;
+    std::vector<float> data(n * vecdim);
+    for (size_t i = 0; i < n; ++i) memcpy(&data[i * vecdim], hnsw.getDataByInternalId(i), vecdim * sizeof(float));
+    index.codec.train(data.data(), n, vecdim, clip);
+    std::vector<uint8_t> codes(n * vecdim);
+    std::vector<int32_t> sums(n);
+    index.codec.encode(data.data(), n, codes.data(), sums.data());
+
+    for (size_t i = 0; i < n; ++i) {
+        char* rec = index.level0.data() + i * index.size_record;
+        memset(rec, 0, index.size_links0);
+        // hnswlib的邻居数只占低16位，高位是删除标记
+        hnswlib::linklistsizeint* ll = hnsw.get_linklist0(i);
+        uint32_t cnt = hnsw.getListCount(ll);
+        ((uint32_t*)rec)[0] = cnt;
+        memcpy(rec + sizeof(uint32_t), ll + 1, cnt * sizeof(uint32_t));
+        memcpy(rec + index.size_links0, &sums[i], sizeof(int32_t));
+        memcpy(rec + index.size_links0 + sizeof(int32_t), &codes[i * vecdim], vecdim);
+        uint32_t label = hnsw.getExternalLabel(i);
+        memcpy(rec + index.size_links0 + sizeof(int32_t) + vecdim, &label, sizeof(label));
+
+        for (int l = 1; l <= index.levels[i]; ++l) {
+            uint32_t* out = (uint32_t*)index.links(i, l);
+            hnswlib::linklistsizeint* ul = hnsw.get_linklist(i, l);
+            out[0] = hnsw.getListCount(ul);
+            memcpy(out + 1, ul + 1, out[0] * sizeof(uint32_t));
+        }
+    }
+}
+
+// 索引文件：8字节的n、vecdim、max_m、max_m0、max_level、enterpoint，
+// 接着codec的vmin、step，每个元素的层数（int32），第0层记录，上层邻接表
+bool SaveHNSWSQ8(const std::string& path, const HNSWSQ8Index& index) {
+    std::ofstream fout(path, std::ios::out | std::ios::binary);
+    if (!fout.is_open()) return false;
+    uint64_t header[6] = {index.n, index.vecdim, index.max_m, index.max_m0, (uint64_t)index.max_level, index.enterpoint};
+    fout.write((const char*)header, sizeof(header));
+    fout.write((const char*)index.codec.vmin.data(), index.vecdim * sizeof(float));
+    fout.write((const char*)index.codec.step.data(), index.vecdim * sizeof(float));
+    fout.write((const char*)index.levels.data(), index.n * sizeof(int));
+    fout.write(index.level0.data(), index.level0.size());
+    fout.write((const char*)index.upper_links.data(), index.upper_links.size() * sizeof(uint32_t));
+    return fout.good();
+}
+
+bool LoadHNSWSQ8(const std::string& path, HNSWSQ8Index& index) {
+    std::ifstream fin(path, std::ios::in | std::ios::binary);
+    uint64_t header[6];
+    if (!fin.read((char*)header, sizeof(header))) return false;
+    index.n = header[0];
+    index.vecdim = header[1];
+    index.max_m = header[2];
+    index.max_m0 = header[3];
+    index.max_level = (int)header[4];
+    index.enterpoint = (uint32_t)header[5];
+    index.codec.vecdim = index.vecdim;
+    index.codec.vmin.resize(index.vecdim);
+    index.codec.step.resize(index.vecdim);
+    index.levels.resize(index.n);
+    fin.read((char*)index.codec.vmin.data(), index.vecdim * sizeof(float));
+    fin.read((char*)index.codec.step.data(), index.vecdim * sizeof(float));
+    fin.read((char*)index.levels.data(), index.n * sizeof(int));
+    index.init_layout();
+    fin.read(index.level0.data(), index.level0.size());
+    fin.read((char*)index.upper_links.data(), index.upper_links.size() * sizeof(uint32_t));
+    return (bool)fin;
+}
+
+// 一条查询的量化距离1 - <q, x>，x为内部id对应的SQ8编码
+class HNSWSQ8Distance {
+public:
+    HNSWSQ8Distance(SearchContext& ctx, const HNSWSQ8Index& index, const float* query) : index_(index) {
+        query_i8_ = SearchContext::buffer(ctx.query_i8, index.vecdim);
+        bias_ = index.codec.prepare_query_i8(query, query_i8_, scale_);
+    }
+
+    float operator()(uint32_t id) const {
+        int32_t dot;
+        SQ8DotBatch(index_.codes(id), index_.code_sum(id), 1, query_i8_, index_.vecdim, &dot);
+        return 1 - (bias_ + scale_ * dot);
+    }
+    void prefetch(uint32_t id) const { __builtin_prefetch(index_.code_sum(id)); }
+
+private:
+    const HNSWSQ8Index& index_;
+    int8_t* query_i8_;
+    float scale_, bias_;
+};
+
+// 上层贪心下降到第0层，第0层以ef束搜索，ef个候选换成label后用FP32（base_full）重排出k个
+TopK<>& hnsw_sq_search(SearchContext& ctx, const HNSWSQ8Index& index, float* query, float* base_full, size_t k,
+                       size_t ef) {
+    TopK<>& result = ctx.result;
+    result.reset(k);
+    if (index.n == 0) return result;
+
+    HNSWSQ8Distance dist(ctx, index, query);
+    uint32_t ep = index.enterpoint;
+    float ep_dist = dist(ep);
+    ep = hnsw_greedy_search(index, dist, ep, index.max_level, ep_dist);
+    hnsw_search_layer0(ctx, index, dist, ep, ep_dist, std::max(ef, k));
+
+    std::vector<SearchContext::Entry>& top = ctx.hnsw_top;
+    for (size_t i = 0; i < top.size(); ++i) top[i].second = index.label(top[i].second);
+    rerank_entries(top.data(), top.data() + top.size(), base_full, query, index.vecdim, result);
+    result.compact();
+    return result;
+}
+
+std::priority_queue<std::pair<float, uint32_t>> hnsw_sq_search(const HNSWSQ8Index& index, float* query, float* base_full,
+                                                               size_t k, size_t ef) {
+    return hnsw_sq_search(thread_search_context(), index, query, base_full, k, ef).to_queue();
+}
@@ -0,0 +1,140 @@
+// 离线构建IVF索引，输出ivf_openmp_search/ivf_mpi_search使用的四个文件：
+//   <prefix>.center.bin  n_clusters x vecdim 的float质心
+//   <prefix>.data.bin    按簇重排后的new_base，N x vecdim
+//   <prefix>.index.bin   new_to_old，N x 1 的uint32
+//   <prefix>.offset.bin  每个簇在new_base中的起始行，n_clusters x 1 的uint32
+// 每个文件开头都是4字节的行数和4字节的列数，与LoadData的格式一致。
+//
+// 编译：g++ ivf_build.cc -o ivf_build -O2 -fopenmp -std=c++11
+// 运行：./ivf_build <base.fbin> <prefix> [-k 256] [-iter 20] [-sample 0] [-init kmeans++|random]
+//                   [-minibatch 0] [-seed 1234]
+// 例如：./ivf_build files/DEEP100K.base.100k.fbin files/DEEP100K.base.100k.256 -k 256
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include "kmeans.h"
+
+template<typename T>
+T *LoadData(std::string data_path, size_t& n, size_t& d)
+{
+    std::ifstream fin;
+    fin.open(data_path, std::ios::in | std::ios::binary);
+    if (!fin.is_open()) return nullptr;
+    fin.read((char*)&n,4);
+    fin.read((char*)&d,4);
+    T* data = new T[n*d];
+    int sz = sizeof(T);
+    for(size_t i = 0; i < n; ++i){
+        fin.read(((char*)data + i*d*sz), d*sz);
+    }
+    fin.close();
+
+    std::cerr<<"load data "<<data_path<<"\n";
+    std::cerr<<"dimension: "<<d<<"  number:"<<n<<"  size_per_element:"<<sizeof(T)<<"\n";
+
+    return data;
+}
+
+// 写出与LoadData对应的文件；rows为空时按行号顺序写data，否则按rows给出的顺序逐行写
+template<typename T>
+bool SaveData(std::string data_path, const T* data, size_t n, size_t d, const uint32_t* rows = nullptr)
+{
+    std::ofstream fout(data_path, std::ios::out | std::ios::binary);
+    if (!fout.is_open()) return false;
+    uint32_t header[2] = {(uint32_t)n, (uint32_t)d};
+    fout.write((const char*)header, sizeof(header));
+    if (rows == nullptr) {
+        fout.write((const char*)data, n * d * sizeof(T));
+    } else {
+        for (size_t i = 0; i < n; ++i) fout.write((const char*)(data + (size_t)rows[i] * d), d * sizeof(T));
+    }
+    return fout.good();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " <base.fbin> <prefix> [-k 256] [-iter 20] [-sample 0]"
+                  << " [-init kmeans++|random] [-minibatch 0] [-seed 1234]\n";
+        return 1;
+    }
+    std::string base_path = argv[1], prefix = argv[2];
+    KMeansParams params(256);
+    for (int i = 3; i + 1 < argc; i += 2) {
+        std::string opt = argv[i], val = argv[i + 1];
+        if (opt == "-k") params.k = std::atol(val.c_str());
+        else if (opt == "-iter") params.niter = std::atol(val.c_str());
+        else if (opt == "-sample") params.sample = std::atol(val.c_str());
+        else if (opt == "-init") params.kmeanspp = val != "random";
+        else if (opt == "-minibatch") params.minibatch = std::atol(val.c_str());
+        else if (opt == "-seed") params.seed = std::atol(val.c_str());
+        else {
+            std::cerr << "unknown option " << opt << "\n";
+            return 1;
+        }
+    }
+
+    size_t base_number = 0, vecdim = 0;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    float* base = LoadData<float>(base_path, base_number, vecdim);
+    if (base == nullptr) {
+        std::cerr << "cannot open " << base_path << "\n";
+        return 1;
+    }
+    double load_seconds = kmeans_seconds_since(t0);
+    std::cerr << "backend " << simd_kernels().name << ", " << omp_get_max_threads() << " threads\n";
+
+    // 训练
+    auto t1 = std::chrono::high_resolution_clock::now();
+    std::vector<float> centroids(params.k * vecdim);
+    KMeansStats stats;
+    kmeans_train(base, base_number, vecdim, params, centroids.data(), &stats);
+    double train_seconds = kmeans_seconds_since(t1);
+
+    // 全部向量分配到最近的簇
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::vector<uint32_t> assign(base_number);
+    double obj = kmeans_assign(base, base_number, vecdim, centroids.data(), params.k, assign.data()) / base_number;
+    double assign_seconds = kmeans_seconds_since(t2);
+
+    // 按簇计数排序，簇内保持原始编号递增
+    std::vector<uint32_t> offsets(params.k + 1, 0);
+    for (size_t i = 0; i < base_number; ++i) ++offsets[assign[i] + 1];
+    for (size_t c = 0; c < params.k; ++c) offsets[c + 1] += offsets[c];
+    std::vector<uint32_t> new_to_old(base_number);
+    std::vector<uint32_t> pos(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < base_number; ++i) new_to_old[pos[assign[i]]++] = i;
+
+    auto t3 = std::chrono::high_resolution_clock::now();
+    bool ok = SaveData(prefix + ".center.bin", centroids.data(), params.k, vecdim)
+           && SaveData(prefix + ".data.bin", base, base_number, vecdim, new_to_old.data())
+           && SaveData(prefix + ".index.bin", new_to_old.data(), base_number, 1)
+           && SaveData(prefix + ".offset.bin", offsets.data(), params.k, 1);
+    double write_seconds = kmeans_seconds_since(t3);
+    if (!ok) {
+        std::cerr << "failed to write " << prefix << ".*.bin\n";
+        return 1;
+    }
+
+    size_t min_size = base_number, max_size = 0;
+    for (size_t c = 0; c < params.k; ++c) {
+        min_size = std::min<size_t>(min_size, offsets[c + 1] - offsets[c]);
+        max_size = std::max<size_t>(max_size, offsets[c + 1] - offsets[c]);
+    }
+    double iter_total = 0;
+    for (double s : stats.iter_seconds) iter_total += s;
+
+    std::cout << "clusters " << params.k << ", size min " << min_size << " max " << max_size
+              << ", mean squared distance " << obj << "\n";
+    std::cout << "load " << load_seconds << "s, init " << stats.init_seconds << "s, "
+              << stats.iter_seconds.size() << " iterations " << iter_total << "s ("
+              << (stats.iter_seconds.empty() ? 0 : iter_total / stats.iter_seconds.size() * 1000) << "ms/iter), "
+              << "assign " << assign_seconds << "s, write " << write_seconds << "s, total train "
+              << train_seconds << "s\n";
+
+    delete[] base;
+    return 0;
+}
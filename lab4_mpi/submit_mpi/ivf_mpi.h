@@ -1,4 +1,4 @@
-#include "ivfpq_openmp.h"
+#include "ivfsq_openmp.h"
 #include <mpi.h>
 #include <omp.h>
 #include <vector>
@@ -7,114 +7,148 @@
 #include <algorithm>
 #include <cstdint>
 
-std::priority_queue<std::pair<float, uint32_t>> ivf_mpi_search(
+// 各进程的本地结果汇总到rank 0，结果放在ctx.result里，非root进程为空。
+// local_topk可以就是ctx.result：先拷进发送缓冲再重置。收发缓冲都在ctx里，查询时不再分配
+TopK<>& ivf_mpi_gather(SearchContext& ctx, TopK<>& local_topk, size_t k, int rank, int world_size) {
+    typedef SearchContext::Entry Entry;
+    // 不足k个的补满
+    local_topk.compact();
+    std::vector<Entry>& send = ctx.mpi_send;
+    send.assign(local_topk.begin(), local_topk.end());
+    send.resize(k, Entry(1e9f, UINT32_MAX));
+
+    // root 收集所有结果
+    std::vector<Entry>& recv = ctx.mpi_recv;
+    if (rank == 0) recv.resize(world_size * k);
+
+    MPI_Gather(
+        send.data(), sizeof(Entry) * k, MPI_BYTE,
+        recv.data(), sizeof(Entry) * k, MPI_BYTE,
+        0, MPI_COMM_WORLD
+    );
+
+    TopK<>& result = ctx.result;
+    result.reset(k);
+    if (rank == 0) {
+        for (size_t i = 0; i < world_size * k; ++i) {
+            if (recv[i].second != UINT32_MAX) result.push(recv[i].first, recv[i].second);
+        }
+    }
+    result.compact();
+    return result;
+}
+
+TopK<>& ivf_mpi_search(
+    SearchContext& ctx,
     float* query,
     float* centroids,
-    float* new_base, 
-    uint32_t* new_to_old,     
-    uint32_t* cluster_start,  
-    size_t vecdim,             
-    size_t k,                
-    size_t n_clusters,        
-    size_t m,                  
+    float* new_base,
+    uint32_t* new_to_old,
+    uint32_t* cluster_start,
+    size_t vecdim,
+    size_t k,
+    size_t n_clusters,
+    size_t m,
     int rank,                  // 当前进程 rank
     int world_size             // 总进程数
 ) {
-    // 所有进程本地计算最近的 m 个中心
-    std::vector<std::pair<float, uint32_t>> centroid_dists;
-    for (size_t i = 0; i < n_clusters; ++i) {
-        float* center = centroids + i * vecdim;
-        float dis = 1 - InnerProductSIMDNeon(center, query, vecdim);
-        centroid_dists.emplace_back(dis, i);
-    }
-
-    std::partial_sort(centroid_dists.begin(), centroid_dists.begin() + m, centroid_dists.end());
-    std::vector<uint32_t> selected_clusters(m);
-    for (size_t i = 0; i < m; ++i) {
-        selected_clusters[i] = centroid_dists[i].second;
-    }
-
-    // 当前 rank 处理其中的部分簇
-    std::vector<uint32_t> assigned_clusters;
-    for (size_t i = 0; i < m; ++i) {
-        if (i % world_size == rank) {
-            assigned_clusters.push_back(selected_clusters[i]);
-        }
-    }
+    // 所有进程本地计算最近的 m 个中心，当前 rank 处理其中第rank、rank + world_size……个簇
+    ivf_select_clusters(ctx, query, centroids, vecdim, n_clusters, m);
+    const auto& centroid_dists = ctx.centroid_dists;
+    int n_assigned = m > (size_t)rank ? (int)((m - rank + world_size - 1) / world_size) : 0;
 
-    // 每个进程本地 top-k 优先队列（大顶堆）
-    std::priority_queue<std::pair<float, uint32_t>> local_topk;
+    // 每个线程本地 top-k
     size_t num_threads = 1;
-
-    std::vector<std::priority_queue<std::pair<float, uint32_t>>> local_topks(num_threads);
+    ctx.reset_thread_topks(num_threads, k);
+    auto& local_topks = ctx.thread_topks;
 
     #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
-    for (int i = 0; i < assigned_clusters.size(); ++i) {
-        uint32_t cid = assigned_clusters[i];
+    for (int i = 0; i < n_assigned; ++i) {
+        uint32_t cid = centroid_dists[rank + (size_t)i * world_size].second;
         uint32_t begin = cluster_start[cid];
         uint32_t end = cluster_start[cid + 1];
         int tid = omp_get_thread_num();
-        auto& plocal_topk = local_topks[tid];
-
-        for (uint32_t j = begin; j < end; ++j) {
-            float* base_ptr = new_base + j * vecdim;
-            float dis = 1 - InnerProductSIMDNeon(base_ptr, query, vecdim);
-
-            if (plocal_topk.size() < k) {
-                plocal_topk.emplace(dis, new_to_old[j]);
-            } else if (dis < plocal_topk.top().first) {
-                plocal_topk.emplace(dis, new_to_old[j]);
-                plocal_topk.pop();
-            }
-        }
+        ivf_scan_rows(new_base, new_to_old, begin, end, query, vecdim, local_topks[tid]);
     }
 
     // 合并线程结果到本地进程结果
-    for (auto& q : local_topks) {
-        while (!q.empty()) {
-            auto p = q.top(); q.pop();
-            if (local_topk.size() < k) {
-                local_topk.push(p);
-            } else if (p.first < local_topk.top().first) {
-                local_topk.push(p);
-                local_topk.pop();
-            }
-        }
+    TopK<>& local_topk = ctx.result;
+    local_topk.reset(k);
+    for (size_t i = 0; i < num_threads; ++i) {
+        local_topk.merge(local_topks[i]);
     }
 
-    // 将 local_topk 转为数组准备收集
-    std::vector<std::pair<float, uint32_t>> local_vec;
-    while (!local_topk.empty()) {
-        local_vec.push_back(local_topk.top());
-        local_topk.pop();
-    }
-    while (local_vec.size() < k) {
-        local_vec.emplace_back(1e9f, UINT32_MAX); // 补满
-    }
+    return ivf_mpi_gather(ctx, local_topk, k, rank, world_size);
+}
 
-    // root 收集所有结果
-    std::vector<std::pair<float, uint32_t>> all_results;
-    if (rank == 0) {
-        all_results.resize(world_size * k);
-    }
+std::priority_queue<std::pair<float, uint32_t>> ivf_mpi_search(
+    float* query,
+    float* centroids,
+    float* new_base, 
+    uint32_t* new_to_old,     
+    uint32_t* cluster_start,  
+    size_t vecdim,             
+    size_t k,                
+    size_t n_clusters,        
+    size_t m,                  
+    int rank,                  // 当前进程 rank
+    int world_size             // 总进程数
+) {
+    return ivf_mpi_search(thread_search_context(), query, centroids, new_base, new_to_old, cluster_start, vecdim, k,
+                          n_clusters, m, rank, world_size).to_queue();  // 非 root 进程返回空堆
+}
 
-    MPI_Gather(
-        local_vec.data(), sizeof(std::pair<float, uint32_t>) * k, MPI_BYTE,
-        all_results.data(), sizeof(std::pair<float, uint32_t>) * k, MPI_BYTE,
-        0, MPI_COMM_WORLD
-    );
+// 自适应nprobe，规则见adaptive_probe.h。
+// 各进程仍按i % world_size分担排好序的簇，各自用本进程的第k小距离剪枝和提前结束；
+// 本进程的阈值不小于全局的第k小，剪枝是安全的，只是比共享阈值保守一些，查询过程中不需要额外通信
+TopK<>& ivf_mpi_search(
+    SearchContext& ctx,
+    float* query,
+    float* centroids,
+    float* new_base,
+    uint32_t* new_to_old,
+    uint32_t* cluster_start,
+    size_t vecdim,
+    size_t k,
+    size_t n_clusters,
+    const ProbeParams& probe,
+    int rank,
+    int world_size
+) {
+    size_t m = probe.budget(n_clusters);
+    ivf_select_clusters(ctx, query, centroids, vecdim, n_clusters, m);
+    ProbePruner pruner(probe_bounds(probe, centroids, new_base, cluster_start, n_clusters, vecdim), query, vecdim,
+                       probe.slack);
 
-    std::priority_queue<std::pair<float, uint32_t>> final_topk;
-    if (rank == 0) {
-        for (const auto& p : all_results) {
-            if (final_topk.size() < k) {
-                final_topk.push(p);
-            } else if (p.first < final_topk.top().first) {
-                final_topk.push(p);
-                final_topk.pop();
-            }
+    TopK<>& local_topk = ctx.result;
+    local_topk.reset(k);
+    for (size_t i = rank; i < m; i += world_size) {
+        float cdis = ctx.centroid_dists[i].first;
+        uint32_t cid = ctx.centroid_dists[i].second;
+        if (i >= probe.min_probe) {
+            if (pruner.exhausted(cdis, local_topk.threshold())) break;
+            if (pruner.skip(cdis, cid, local_topk.threshold())) continue;
         }
+        ivf_scan_rows(new_base, new_to_old, cluster_start[cid], cluster_start[cid + 1], query, vecdim, local_topk);
+        local_topk.compact();
     }
 
-    return final_topk;  // 非 root 进程可返回空堆
+    return ivf_mpi_gather(ctx, local_topk, k, rank, world_size);
+}
+
+std::priority_queue<std::pair<float, uint32_t>> ivf_mpi_search(
+    float* query,
+    float* centroids,
+    float* new_base,
+    uint32_t* new_to_old,
+    uint32_t* cluster_start,
+    size_t vecdim,
+    size_t k,
+    size_t n_clusters,
+    const ProbeParams& probe,
+    int rank,
+    int world_size
+) {
+    return ivf_mpi_search(thread_search_context(), query, centroids, new_base, new_to_old, cluster_start, vecdim, k,
+                          n_clusters, probe, rank, world_size).to_queue();
 }
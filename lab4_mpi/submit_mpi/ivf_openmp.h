@@ -1,10 +1,13 @@
 #include <omp.h>
+#include <atomic>
+#include <limits>
 #include <utility>
 #include <algorithm>
 #include <cstdint>
 #include "ivf_pthread.h"
 
-std::priority_queue<std::pair<float, uint32_t>> ivf_openmp_search(
+TopK<>& ivf_openmp_search(
+    SearchContext& ctx,
     float* query,
     float* centroids,
     float* new_base,
@@ -17,55 +20,114 @@ std::priority_queue<std::pair<float, uint32_t>> ivf_openmp_search(
     size_t num_threads
 ) {
     // 找出m个簇
-    std::vector<std::pair<float, uint32_t>> centroid_dists;
-    for (size_t i = 0; i < n_clusters; ++i) {
-        float* center = centroids + i * vecdim;
-        float dis = 1 - InnerProductSIMDNeon(center, query, vecdim);
-        centroid_dists.emplace_back(dis, i);
-    }
-    std::partial_sort(centroid_dists.begin(), centroid_dists.begin() + m, centroid_dists.end());
-
-    std::vector<uint32_t> selected_clusters(m);
-    for (size_t i = 0; i < m; ++i) selected_clusters[i] = centroid_dists[i].second;
+    ivf_select_clusters(ctx, query, centroids, vecdim, n_clusters, m);
+    const auto& centroid_dists = ctx.centroid_dists;
 
     // 分配任务
-    std::vector<std::priority_queue<std::pair<float, uint32_t>>> local_topks(num_threads);
+    ctx.reset_thread_topks(num_threads, k);
+    auto& local_topks = ctx.thread_topks;
 
-    // 并行处理 selected_clusters 中的每个簇
+    // 并行处理前m个簇
     #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
     for (int i = 0; i < m; ++i) {
-        uint32_t cid = selected_clusters[i];
+        uint32_t cid = centroid_dists[i].second;
         uint32_t begin = cluster_start[cid];
         uint32_t end = cluster_start[cid + 1];
         int tid = omp_get_thread_num();
-        auto& local_topk = local_topks[tid];
-
-        for (uint32_t j = begin; j < end; ++j) {
-            float* base_ptr = new_base + j * vecdim;
-            float dis = 1 - InnerProductSIMDNeon(base_ptr, query, vecdim);
-
-            if (local_topk.size() < k) {
-                local_topk.emplace(dis, new_to_old[j]);
-            } else if (dis < local_topk.top().first) {
-                local_topk.emplace(dis, new_to_old[j]);
-                local_topk.pop();
-            }
-        }
+        ivf_scan_rows(new_base, new_to_old, begin, end, query, vecdim, local_topks[tid]);
     }
 
     // 合并 top-k
-    std::priority_queue<std::pair<float, uint32_t>> final_topk;
-    for (auto& local_q : local_topks) {
-        while (!local_q.empty()) {
-            auto entry = local_q.top(); local_q.pop();
-            if (final_topk.size() < k) {
-                final_topk.push(entry);
-            } else if (entry.first < final_topk.top().first) {
-                final_topk.push(entry);
-                final_topk.pop();
+    TopK<>& final_topk = ctx.result;
+    final_topk.reset(k);
+    for (size_t i = 0; i < num_threads; ++i) final_topk.merge(local_topks[i]);
+    final_topk.compact();
+    return final_topk;
+}
+
+std::priority_queue<std::pair<float, uint32_t>> ivf_openmp_search(
+    float* query,
+    float* centroids,
+    float* new_base,
+    uint32_t* new_to_old,
+    uint32_t* cluster_start,
+    size_t vecdim,
+    size_t k,
+    size_t n_clusters,
+    size_t m,
+    size_t num_threads
+) {
+    return ivf_openmp_search(thread_search_context(), query, centroids, new_base, new_to_old, cluster_start,
+                             vecdim, k, n_clusters, m, num_threads).to_queue();
+}
+
+// 自适应nprobe，规则见adaptive_probe.h。
+// 簇按中心距离的顺序动态分给各线程，每扫完一个簇用本线程的第k小距离更新共享阈值；
+// 后面的簇先用阈值判断，能跳过的跳过，剩下的都不可能更好时其余迭代直接返回
+TopK<>& ivf_openmp_search(
+    SearchContext& ctx,
+    float* query,
+    float* centroids,
+    float* new_base,
+    uint32_t* new_to_old,
+    uint32_t* cluster_start,
+    size_t vecdim,
+    size_t k,
+    size_t n_clusters,
+    const ProbeParams& probe,
+    size_t num_threads
+) {
+    size_t m = probe.budget(n_clusters);
+    ivf_select_clusters(ctx, query, centroids, vecdim, n_clusters, m);
+    const auto& centroid_dists = ctx.centroid_dists;
+    ProbePruner pruner(probe_bounds(probe, centroids, new_base, cluster_start, n_clusters, vecdim), query, vecdim,
+                       probe.slack);
+
+    ctx.reset_thread_topks(num_threads, k);
+    auto& local_topks = ctx.thread_topks;
+    std::atomic<float> threshold(std::numeric_limits<float>::infinity());
+    std::atomic<bool> done(false);
+
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+    for (int i = 0; i < (int)m; ++i) {
+        if (done.load(std::memory_order_relaxed)) continue;
+        float cdis = centroid_dists[i].first;
+        uint32_t cid = centroid_dists[i].second;
+        if (i >= (int)probe.min_probe) {
+            float t = threshold.load(std::memory_order_relaxed);
+            if (pruner.exhausted(cdis, t)) {
+                done.store(true, std::memory_order_relaxed);
+                continue;
             }
+            if (pruner.skip(cdis, cid, t)) continue;
         }
+
+        auto& local_topk = local_topks[omp_get_thread_num()];
+        ivf_scan_rows(new_base, new_to_old, cluster_start[cid], cluster_start[cid + 1], query, vecdim, local_topk);
+        // compact后threshold才是当前真正的第k小
+        local_topk.compact();
+        atomic_min(threshold, local_topk.threshold());
     }
 
+    TopK<>& final_topk = ctx.result;
+    final_topk.reset(k);
+    for (size_t i = 0; i < num_threads; ++i) final_topk.merge(local_topks[i]);
+    final_topk.compact();
     return final_topk;
 }
+
+std::priority_queue<std::pair<float, uint32_t>> ivf_openmp_search(
+    float* query,
+    float* centroids,
+    float* new_base,
+    uint32_t* new_to_old,
+    uint32_t* cluster_start,
+    size_t vecdim,
+    size_t k,
+    size_t n_clusters,
+    const ProbeParams& probe,
+    size_t num_threads
+) {
+    return ivf_openmp_search(thread_search_context(), query, centroids, new_base, new_to_old, cluster_start,
+                             vecdim, k, n_clusters, probe, num_threads).to_queue();
+}
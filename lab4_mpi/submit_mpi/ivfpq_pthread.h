@@ -3,113 +3,105 @@
 struct PQThreadArg {
     float* query;
     float* base_full;  // 原数据库
-    uint8_t* new_base; // 100000*4
+    uint8_t* new_base; // PackPQCodes打包好的编码，与new_to_old同序
     uint32_t* new_to_old;
     uint32_t* cluster_start;
     float* pre_dist; // PQ预处理距离
     size_t pq_cluster_num; // PQ分段数
     size_t pq_center_num; // PQ每段聚类数
-    std::vector<std::pair<float, uint32_t>> cluster_dist; // 该线程负责的簇距离+簇编号
+    ChunkQueues* queues; // 所有线程共用的块队列，bias为簇中心内积
+    size_t tid;          // 自己的队列编号
     size_t vecdim;
     size_t k;
-    std::priority_queue<std::pair<float, uint32_t>> local_topk;
+    size_t rerank; // 所有线程合计参与重排的候选数
+    TopK<>* local_topk; // 粗排阶段为本线程的候选，重排阶段为本线程的前k个
     bool isPQIVF;
+    std::vector<std::pair<float, uint32_t>>* candidates; // 粗排候选，重排阶段为分给本线程的那一份
 };
 
 void* PQ_search_thread_func(void* arg_void) {
     PQThreadArg* arg = (PQThreadArg*)arg_void;
 
-    size_t rerank = arg->k * 15; // 设置rerank
-    for (auto& cid : arg->cluster_dist) {
-        uint32_t begin = arg->cluster_start[cid.second];
-        uint32_t end = arg->cluster_start[cid.second + 1];
-        double cq_dis = 1 - cid.first;
-
-        for (uint32_t i = begin; i < end; ++i) {
-            float dis = arg->isPQIVF ? 0 : cq_dis;
-            for(uint32_t j = 0; j < arg->pq_cluster_num; ++j){
-                dis += arg->pre_dist[arg->new_base[i * arg->pq_cluster_num + j] + j * arg->pq_center_num];
-            }
-            dis = 1 - dis;
-
-            // 本线程粗排结果
-            if (arg->local_topk.size() < rerank) {
-                arg->local_topk.emplace(dis, arg->new_to_old[i]);
-            } else if (dis < arg->local_topk.top().first) {
-                arg->local_topk.emplace(dis, arg->new_to_old[i]);
-                arg->local_topk.pop();
-            }
-        }
+    // 块可能被任意线程偷走，所以每个线程都按全局的rerank保留候选，合并后的结果与调度无关
+    TopK<>& candidates = *arg->local_topk;
+    candidates.reset(arg->rerank);
+    ScanChunk chunk;
+    float dis[kStealChunkRows];
+    while (arg->queues->next(arg->tid, chunk)) {
+        size_t n = chunk.end - chunk.begin;
+        PQAdcScanRange(arg->new_base, chunk.begin, chunk.end, arg->pre_dist, arg->pq_cluster_num, arg->pq_center_num, dis);
+        float bias = arg->isPQIVF ? 0 : chunk.bias;
+        for (size_t j = 0; j < n; ++j) dis[j] = 1 - (bias + dis[j]);
+
+        // 本线程粗排结果
+        candidates.push_ids(dis, n, arg->new_to_old + chunk.begin);
     }
+    candidates.compact();
 
-    // 对粗排结果全精度重排
-    std::priority_queue<std::pair<float, uint32_t>> precise_heap;
-    while (!arg->local_topk.empty()) {
-        auto top_pair = arg->local_topk.top();
-        uint32_t idx = top_pair.second;
-        arg->local_topk.pop();
-
-        // 计算真实距离
-        float true_dis = InnerProductSIMDNeon(arg->base_full + idx * arg->vecdim, arg->query, arg->vecdim);
-        true_dis = 1 - true_dis;
-
-        if (precise_heap.size() < arg->k) {
-            precise_heap.emplace(true_dis, idx);
-        } else if (true_dis < precise_heap.top().first) {
-            precise_heap.emplace(true_dis, idx);
-            precise_heap.pop();
-        }
-    }
+    return nullptr;
+}
 
-    // 把重排后的 k 个放回 local_topk，方便主线程合并
-    arg->local_topk = std::move(precise_heap);
+void* PQ_rerank_thread_func(void* arg_void) {
+    PQThreadArg* arg = (PQThreadArg*)arg_void;
+
+    // 对分到的粗排结果全精度重排，候选id取出后按块批量计算真实距离，
+    // 重排后的 k 个放回 local_topk，方便主线程合并
+    TopK<>& precise = *arg->local_topk;
+    precise.reset(arg->k);
+    const auto& candidates = *arg->candidates;
+    rerank_entries(candidates.data(), candidates.data() + candidates.size(), arg->base_full, arg->query, arg->vecdim, precise);
 
     return nullptr;
 }
 
-std::priority_queue<std::pair<float, uint32_t>> ivfpq_pthread_search(
-    float* query, 
-    uint8_t* pq_base, 
-    float* pq_center, 
-    float* base_full, // 原数据库
-    float* ivf_center,
-    uint32_t* new_to_old,
-    uint32_t* ivf_cluster_start,
-    size_t vecdim,
-    size_t k, 
-    size_t pq_center_num,  // 256
-    size_t pq_center_vecdim,  // 24
-    size_t pq_cluster_num,  // PQ分的段数 4 这里cluster和center混了ToT 依然沿用SIMD的名称
-    size_t ivf_cluster_num, // 256
-    size_t m, // ivf查找的簇数量
-    size_t num_threads
-){
-    // PQ预处理 可调用PQ_SIMD中的实现
-    float* pre_dist = new float[pq_center_num * pq_cluster_num];
-    pre_calculate(pq_center, query, pre_dist, vecdim, pq_center_num, pq_center_vecdim, pq_cluster_num);
+// 两阶段执行：先并行粗排，合并出全局前rerank个候选，再平均分给各线程做全精度重排，
+// 最后合并各线程的前k个写入ctx.result
+TopK<>& pq_run_threads(SearchContext& ctx, PQThreadArg* thread_args, void** task_args, size_t num_threads) {
+    ThreadPool& pool = global_thread_pool(num_threads - 1);
+    pool.run(PQ_search_thread_func, task_args, num_threads);
 
-    // 找出m个簇
-    std::vector<std::pair<float, uint32_t>> centroid_dists;
-    for (int i = 0; i < ivf_cluster_num; ++i) {
-        float* center = ivf_center + i * vecdim;
-        float dis = InnerProductSIMDNeon(center, query, vecdim);
-        dis = 1 - dis;
-        centroid_dists.emplace_back(dis, i);
+    TopK<>& candidates = ctx.candidates;
+    candidates.reset(thread_args[0].rerank);
+    for (size_t i = 0; i < num_threads; ++i) candidates.merge(*thread_args[i].local_topk);
+    candidates.compact();
+
+    size_t n = candidates.size();
+    for (size_t i = 0; i < num_threads; ++i) {
+        thread_args[i].candidates->assign(candidates.begin() + n * i / num_threads,
+                                          candidates.begin() + n * (i + 1) / num_threads);
     }
-    std::partial_sort(centroid_dists.begin(), centroid_dists.begin() + m, centroid_dists.end());
-    centroid_dists.resize(m);
+    pool.run(PQ_rerank_thread_func, task_args, num_threads);
 
-    // std::vector<uint32_t> selected_clusters;
-    // for (int i = 0; i < m; ++i) selected_clusters.push_back(centroid_dists[i].second);
+    // 合并 top-k
+    TopK<>& final_topk = ctx.result;
+    final_topk.reset(thread_args[0].k);
+    for (size_t i = 0; i < num_threads; ++i) final_topk.merge(*thread_args[i].local_topk);
+    final_topk.compact();
+    return final_topk;
+}
 
-    // 分配任务
-    std::vector<std::vector<std::pair<float, uint32_t>>> thread_tasks(num_threads);
-    for (size_t i = 0; i < centroid_dists.size(); ++i) {
-        thread_tasks[i % num_threads].push_back(centroid_dists[i]);
+// 粗排默认保留的候选数：每个线程k的这么多倍，与原来每个线程各自保留k*15的总量相同
+const size_t kIVFPQRerankPerKThread = 15;
+
+// 选中的簇（ctx.centroid_dists的前m个）切块后平均分到各线程队列，空闲线程互相偷；
+// 填好各线程的参数后执行两阶段搜索。rerank为所有线程合计参与全精度重排的候选数，0表示默认值
+TopK<>& pq_search_clusters(SearchContext& ctx, float* query, uint8_t* pq_base, float* base_full, uint32_t* new_to_old,
+                           uint32_t* ivf_cluster_start, float* pre_dist, size_t vecdim, size_t k, size_t pq_center_num,
+                           size_t pq_cluster_num, size_t m, size_t num_threads, bool isPQIVF, size_t rerank) {
+    num_threads = clamp_search_threads(num_threads);
+    if (rerank == 0) rerank = k * kIVFPQRerankPerKThread * num_threads;
+    ChunkQueues& queues = ctx.queues;
+    queues.reset(num_threads);
+    for (size_t i = 0; i < m; ++i) {
+        uint32_t cid = ctx.centroid_dists[i].second;
+        queues.add_cluster(ivf_cluster_start[cid], ivf_cluster_start[cid + 1], 1 - ctx.centroid_dists[i].first);
     }
+    queues.distribute();
 
-    std::vector<PQThreadArg> thread_args(num_threads);
-    std::vector<pthread_t> threads(num_threads);
+    ctx.reset_thread_topks(num_threads, k);
+    ctx.reset_thread_candidates(num_threads);
+    PQThreadArg thread_args[kMaxSearchThreads];
+    void* task_args[kMaxSearchThreads];
 
     for (size_t i = 0; i < num_threads; ++i) {
         thread_args[i] = PQThreadArg{
@@ -121,43 +113,82 @@ std::priority_queue<std::pair<float, uint32_t>> ivfpq_pthread_search(
             .pre_dist = pre_dist,
             .pq_cluster_num = pq_cluster_num,
             .pq_center_num = pq_center_num,
-            .cluster_dist = thread_tasks[i],
+            .queues = &queues,
+            .tid = i,
             .vecdim = vecdim,
             .k = k,
-            .isPQIVF = false
+            .rerank = std::max(rerank, k),
+            .local_topk = &ctx.thread_topks[i],
+            .isPQIVF = isPQIVF,
+            .candidates = &ctx.thread_candidates[i]
         };
-        pthread_create(&threads[i], nullptr, PQ_search_thread_func, &thread_args[i]);
+        task_args[i] = &thread_args[i];
     }
 
-    for (size_t i = 0; i < num_threads; ++i) {
-        pthread_join(threads[i], nullptr);
-    }
+    // 交给常驻线程池执行，主线程也执行一份任务
+    return pq_run_threads(ctx, thread_args, task_args, num_threads);
+}
 
-    // 合并 top-k
-    std::priority_queue<std::pair<float, uint32_t>> final_topk;
-
-    for (int i = 0; i < num_threads; ++i) {
-        auto& local_q = thread_args[i].local_topk;
-        while (!local_q.empty()) {
-            auto entry = local_q.top(); local_q.pop();
-            if (final_topk.size() < k) {
-                final_topk.push(entry);
-            } else if (entry.first < final_topk.top().first) {
-                final_topk.push(entry);
-                final_topk.pop();
-            }
-        }
-    }
+// pq_base为PackPQCodes打包好的编码（与new_to_old同序）
+TopK<>& ivfpq_pthread_search(
+    SearchContext& ctx,
+    float* query, 
+    uint8_t* pq_base, 
+    float* pq_center, 
+    float* base_full, // 原数据库
+    float* ivf_center,
+    uint32_t* new_to_old,
+    uint32_t* ivf_cluster_start,
+    size_t vecdim,
+    size_t k, 
+    size_t pq_center_num,  // 256
+    size_t pq_center_vecdim,  // 24
+    size_t pq_cluster_num,  // PQ分的段数 4 这里cluster和center混了ToT 依然沿用SIMD的名称
+    size_t ivf_cluster_num, // 256
+    size_t m, // ivf查找的簇数量
+    size_t num_threads,
+    size_t rerank = 0 // 参与全精度重排的候选数，0表示k * kIVFPQRerankPerKThread * num_threads
+){
+    // PQ预处理 可调用PQ_SIMD中的实现
+    float* pre_dist = SearchContext::buffer(ctx.lut, pq_center_num * pq_cluster_num);
+    pre_calculate(pq_center, query, pre_dist, vecdim, pq_center_num, pq_center_vecdim, pq_cluster_num);
 
-    return final_topk;
+    // 找出m个簇
+    ivf_select_clusters(ctx, query, ivf_center, vecdim, ivf_cluster_num, m);
 
+    return pq_search_clusters(ctx, query, pq_base, base_full, new_to_old, ivf_cluster_start, pre_dist, vecdim, k,
+                              pq_center_num, pq_cluster_num, m, num_threads, false, rerank);
 }
 
-// 先PQ再IVF
-std::priority_queue<std::pair<float, uint32_t>> pqivf_pthread_search(
+std::priority_queue<std::pair<float, uint32_t>> ivfpq_pthread_search(
     float* query, 
     uint8_t* pq_base, 
     float* pq_center, 
+    float* base_full,
+    float* ivf_center,
+    uint32_t* new_to_old,
+    uint32_t* ivf_cluster_start,
+    size_t vecdim,
+    size_t k, 
+    size_t pq_center_num,
+    size_t pq_center_vecdim,
+    size_t pq_cluster_num,
+    size_t ivf_cluster_num,
+    size_t m,
+    size_t num_threads,
+    size_t rerank = 0
+){
+    return ivfpq_pthread_search(thread_search_context(), query, pq_base, pq_center, base_full, ivf_center, new_to_old,
+                                ivf_cluster_start, vecdim, k, pq_center_num, pq_center_vecdim, pq_cluster_num,
+                                ivf_cluster_num, m, num_threads, rerank).to_queue();
+}
+
+// 先PQ再IVF
+TopK<>& pqivf_pthread_search(
+    SearchContext& ctx,
+    float* query, 
+    uint8_t* pq_base, // PackPQCodes打包好的编码
+    float* pq_center, 
     float* base_full, // 原数据库
     uint8_t* ivf_center,  // IVF聚类中心向量是4维的uint8
     uint32_t* new_to_old,
@@ -169,14 +200,16 @@ std::priority_queue<std::pair<float, uint32_t>> pqivf_pthread_search(
     size_t pq_cluster_num,  // PQ分的段数 4 这里cluster和center混了ToT 依然沿用SIMD的名称
     size_t ivf_cluster_num, // 256
     size_t m, // ivf查找的簇数量
-    size_t num_threads
+    size_t num_threads,
+    size_t rerank = 0 // 参与全精度重排的候选数，0表示k * kIVFPQRerankPerKThread * num_threads
 ){
     // PQ预处理 可调用PQ_SIMD中的实现
-    float* pre_dist = new float[pq_center_num * pq_cluster_num];
+    float* pre_dist = SearchContext::buffer(ctx.lut, pq_center_num * pq_cluster_num);
     pre_calculate(pq_center, query, pre_dist, vecdim, pq_center_num, pq_center_vecdim, pq_cluster_num);
 
     // 找出m个簇
-    std::vector<std::pair<float, uint32_t>> centroid_dists;
+    auto& centroid_dists = ctx.centroid_dists;
+    centroid_dists.clear();
     for (int i = 0; i < ivf_cluster_num; ++i) {
         uint8_t* center = ivf_center + i * pq_cluster_num;
         float dis = 0;
@@ -186,54 +219,30 @@ std::priority_queue<std::pair<float, uint32_t>> pqivf_pthread_search(
         centroid_dists.emplace_back(dis, i);
     }
     std::partial_sort(centroid_dists.begin(), centroid_dists.begin() + m, centroid_dists.end());
-    centroid_dists.resize(m);
-
-    // 分配任务
-    std::vector<std::vector<std::pair<float, uint32_t>>> thread_tasks(num_threads);
-    for (size_t i = 0; i < centroid_dists.size(); ++i) {
-        thread_tasks[i % num_threads].push_back(centroid_dists[i]);
-    }
-
-    std::vector<PQThreadArg> thread_args(num_threads);
-    std::vector<pthread_t> threads(num_threads);
 
-    for (size_t i = 0; i < num_threads; ++i) {
-        thread_args[i] = PQThreadArg{
-            .query = query,
-            .base_full = base_full,
-            .new_base = pq_base,
-            .new_to_old = new_to_old,
-            .cluster_start = ivf_cluster_start,
-            .pre_dist = pre_dist,
-            .pq_cluster_num = pq_cluster_num,
-            .pq_center_num = pq_center_num,
-            .cluster_dist = thread_tasks[i],
-            .vecdim = vecdim,
-            .k = k,
-            .isPQIVF = true
-        };
-        pthread_create(&threads[i], nullptr, PQ_search_thread_func, &thread_args[i]);
-    }
-
-    for (size_t i = 0; i < num_threads; ++i) {
-        pthread_join(threads[i], nullptr);
-    }
-
-    // 合并 top-k
-    std::priority_queue<std::pair<float, uint32_t>> final_topk;
-
-    for (int i = 0; i < num_threads; ++i) {
-        auto& local_q = thread_args[i].local_topk;
-        while (!local_q.empty()) {
-            auto entry = local_q.top(); local_q.pop();
-            if (final_topk.size() < k) {
-                final_topk.push(entry);
-            } else if (entry.first < final_topk.top().first) {
-                final_topk.push(entry);
-                final_topk.pop();
-            }
-        }
-    }
+    return pq_search_clusters(ctx, query, pq_base, base_full, new_to_old, ivf_cluster_start, pre_dist, vecdim, k,
+                              pq_center_num, pq_cluster_num, m, num_threads, true, rerank);
+}
 
-    return final_topk;
-}
\ No newline at end of file
+std::priority_queue<std::pair<float, uint32_t>> pqivf_pthread_search(
+    float* query, 
+    uint8_t* pq_base, 
+    float* pq_center, 
+    float* base_full,
+    uint8_t* ivf_center,
+    uint32_t* new_to_old,
+    uint32_t* ivf_cluster_start,
+    size_t vecdim,
+    size_t k, 
+    size_t pq_center_num,
+    size_t pq_center_vecdim,
+    size_t pq_cluster_num,
+    size_t ivf_cluster_num,
+    size_t m,
+    size_t num_threads,
+    size_t rerank = 0
+){
+    return pqivf_pthread_search(thread_search_context(), query, pq_base, pq_center, base_full, ivf_center, new_to_old,
+                                ivf_cluster_start, vecdim, k, pq_center_num, pq_center_vecdim, pq_cluster_num,
+                                ivf_cluster_num, m, num_threads, rerank).to_queue();
+}
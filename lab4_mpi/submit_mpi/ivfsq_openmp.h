@@ -0,0 +1,114 @@
+#pragma once
+#include <omp.h>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include "ivfpq_openmp.h"
+
+// IVF-SQ8：倒排表里存按维度量化的8bit编码，与new_base同序（按簇连续），
+// 探测的簇用SQ8QueryScanner扫描（整数点积），粗排出的候选再用全精度base重排。
+// 编码只有new_base的1/4，扫描每行读的字节也只有1/4；重排用原始顺序的base，不再需要new_base
+
+// 粗排候选数 = k * kIVFSQRerank
+const size_t kIVFSQRerank = 4;
+
+struct IVFSQ8Index {
+    SQ8Codec codec;
+    std::vector<uint8_t> codes;   // [N][vecdim]，与new_base同序
+    std::vector<int32_t> code_sums;   // 每行编码之和，整数扫描用
+};
+
+// new_base按维度训练量化范围后编码。训练要对每一维做两次nth_element，离线用sq_build生成文件、
+// 启动时LoadIVFSQ8读入更快
+void ivfsq_build(IVFSQ8Index& index, const float* new_base, size_t base_number, size_t vecdim) {
+    index.codec.train(new_base, base_number, vecdim);
+    index.codes.resize(base_number * vecdim);
+    index.code_sums.resize(base_number);
+    index.codec.encode(new_base, base_number, index.codes.data(), index.code_sums.data());
+}
+
+// 读入sq_build对new_base生成的编码文件（格式见SaveSQ8），并算出每行编码之和。
+// 例如：./sq_build files/DEEP100K.base.100k.256.data.bin files/DEEP100K.base.100k.256
+// 生成files/DEEP100K.base.100k.256.sq8.ubin。文件不存在时返回false，index为空
+bool LoadIVFSQ8(const std::string& path, IVFSQ8Index& index) {
+    size_t n = 0;
+    if (!LoadSQ8(path, index.codec, index.codes, n)) {
+        index.codes.clear();
+        index.code_sums.clear();
+        return false;
+    }
+    index.code_sums.resize(n);
+    index.codec.sums(index.codes.data(), n, index.code_sums.data());
+    return true;
+}
+
+TopK<>& ivfsq_openmp_search(
+    SearchContext& ctx,
+    float* query,
+    const IVFSQ8Index& index,
+    float* base_full,
+    float* centroids,
+    uint32_t* new_to_old,
+    uint32_t* cluster_start,
+    size_t vecdim,
+    size_t k,
+    size_t n_clusters,
+    size_t m,
+    size_t num_threads
+) {
+    ivf_select_clusters(ctx, query, centroids, vecdim, n_clusters, m);
+    const auto& centroid_dists = ctx.centroid_dists;
+
+    // 量化步长折进query
+    SQ8QueryScanner scanner(ctx, index.codec, index.codes.data(), index.code_sums.data(), query);
+
+    size_t rerank = k * kIVFSQRerank;
+    ctx.reset_thread_topks(num_threads, rerank);
+    auto& local_topks = ctx.thread_topks;
+
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+    for (int i = 0; i < (int)m; ++i) {
+        uint32_t cid = centroid_dists[i].second;
+        uint32_t begin = cluster_start[cid];
+        uint32_t end = cluster_start[cid + 1];
+        auto& local_topk = local_topks[omp_get_thread_num()];
+
+        float dis[kBatchRows];
+        for (uint32_t start = begin; start < end; start += kBatchRows) {
+            uint32_t cnt = std::min<uint32_t>(kBatchRows, end - start);
+            scanner.distances(start, cnt, dis);
+            local_topk.push_ids(dis, cnt, new_to_old + start);
+        }
+    }
+
+    // 合并粗排候选，全精度重排
+    TopK<>& candidates = ctx.candidates;
+    candidates.reset(rerank);
+    for (size_t i = 0; i < num_threads; ++i) candidates.merge(local_topks[i]);
+    candidates.compact();
+
+    TopK<>& result = ctx.result;
+    result.reset(k);
+    rerank_entries(candidates.begin(), candidates.end(), base_full, query, vecdim, result);
+    result.compact();
+    return result;
+}
+
+std::priority_queue<std::pair<float, uint32_t>> ivfsq_openmp_search(
+    float* query,
+    const IVFSQ8Index& index,
+    float* base_full,
+    float* centroids,
+    uint32_t* new_to_old,
+    uint32_t* cluster_start,
+    size_t vecdim,
+    size_t k,
+    size_t n_clusters,
+    size_t m,
+    size_t num_threads
+) {
+    return ivfsq_openmp_search(thread_search_context(), query, index, base_full, centroids, new_to_old, cluster_start,
+                               vecdim, k, n_clusters, m, num_threads).to_queue();
+}
@@ -0,0 +1,278 @@
+#pragma once
+#include <vector>
+#include <random>
+#include <chrono>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <omp.h>
+#include "simd_dispatch.h"
+
+// OpenMP并行的k-means（L2距离），IVF建索引和PQ训练共用。
+// 分配步骤把质心打包成16行一组，每64个点一块用InnerProductTile算内积，
+// argmin ||x-c||^2 等价于 argmax (x·c - ||c||^2/2)，不需要单独算每个差向量。
+
+struct KMeansParams {
+    size_t k;           // 簇数
+    size_t niter;       // 迭代轮数
+    size_t sample;      // 训练采样点数，0表示用全部数据
+    bool kmeanspp;      // true用k-means++初始化，否则随机选k个点
+    size_t minibatch;   // >0时使用mini-batch k-means，每轮随机取这么多点
+    unsigned seed;
+    bool verbose;       // 打印每轮的耗时和目标值
+
+    explicit KMeansParams(size_t k_) : k(k_), niter(20), sample(0), kmeanspp(true), minibatch(0),
+                                       seed(1234), verbose(true) {}
+};
+
+struct KMeansStats {
+    double init_seconds;
+    std::vector<double> iter_seconds;
+    std::vector<double> objective;   // 每轮的平均平方距离
+};
+
+const size_t kKMeansBlock = 64; // 分配时每块的点数
+
+inline double kmeans_seconds_since(std::chrono::high_resolution_clock::time_point t) {
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t).count();
+}
+
+// 维度是8的倍数时走SIMD内积
+inline float kmeans_dot(const float* a, const float* b, size_t d) {
+    return d % 8 == 0 ? InnerProductSIMD(a, b, d) : inner_product_scalar(a, b, d);
+}
+
+// 质心打包成16行一组，附带 ||c||^2/2，补齐的行设为无穷大，永远不会被选中
+struct PackedCentroids {
+    size_t k, d, n_panels;
+    std::vector<float> packed;
+    std::vector<float> half_norm;
+
+    PackedCentroids(const float* centroids, size_t k_, size_t d_)
+        : k(k_), d(d_), n_panels((k_ + kTileRows - 1) / kTileRows),
+          packed(n_panels * kTileRows * d_), half_norm(n_panels * kTileRows, std::numeric_limits<float>::infinity()) {
+        for (size_t p = 0; p < n_panels; ++p) {
+            size_t cnt = std::min(kTileRows, k - p * kTileRows);
+            PackTileRows(centroids + p * kTileRows * d, cnt, d, packed.data() + p * kTileRows * d);
+        }
+        for (size_t c = 0; c < k; ++c) half_norm[c] = 0.5f * kmeans_dot(centroids + c * d, centroids + c * d, d);
+    }
+
+    // 连续的nb <= kKMeansBlock个点找最近的质心，best为 x·c - ||c||^2/2 的最大值，tile至少kKMeansBlock*16
+    void nearest(const float* x, size_t nb, uint32_t* best_id, float* best, float* tile) const {
+        for (size_t i = 0; i < nb; ++i) {
+            best[i] = -std::numeric_limits<float>::infinity();
+            best_id[i] = 0;
+        }
+        for (size_t p = 0; p < n_panels; ++p) {
+            InnerProductTile(packed.data() + p * kTileRows * d, x, nb, d, tile);
+            const float* hn = half_norm.data() + p * kTileRows;
+            for (size_t i = 0; i < nb; ++i) {
+                const float* ip = tile + i * kTileRows;
+                for (size_t r = 0; r < kTileRows; ++r) {
+                    float s = ip[r] - hn[r];
+                    if (s > best[i]) {
+                        best[i] = s;
+                        best_id[i] = p * kTileRows + r;
+                    }
+                }
+            }
+        }
+    }
+};
+
+// 每个点分到最近的质心，dist2非空时写出平方距离，返回平方距离之和
+inline double kmeans_assign(const float* x, size_t n, size_t d, const float* centroids, size_t k,
+                            uint32_t* assign, float* dist2 = nullptr) {
+    PackedCentroids pc(centroids, k, d);
+
+    double total = 0;
+    #pragma omp parallel reduction(+:total)
+    {
+        std::vector<float> tile(kKMeansBlock * kTileRows);
+        float best[kKMeansBlock];
+
+        #pragma omp for schedule(dynamic)
+        for (long long i0 = 0; i0 < (long long)n; i0 += kKMeansBlock) {
+            size_t nb = std::min(kKMeansBlock, n - (size_t)i0);
+            pc.nearest(x + i0 * d, nb, assign + i0, best, tile.data());
+
+            for (size_t i = 0; i < nb; ++i) {
+                const float* xi = x + (i0 + i) * d;
+                float dis = std::max(0.0f, kmeans_dot(xi, xi, d) - 2 * best[i]);
+                if (dist2) dist2[i0 + i] = dis;
+                total += dis;
+            }
+        }
+    }
+    return total;
+}
+
+// k-means++：每次按到已选质心的最小平方距离加权抽下一个质心
+inline void kmeans_init_pp(const float* x, size_t n, size_t d, size_t k, std::mt19937& gen, float* centroids) {
+    std::vector<float> min_dis(n, std::numeric_limits<float>::infinity());
+    std::vector<float> norms(n);
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < (long long)n; ++i) norms[i] = kmeans_dot(x + i * d, x + i * d, d);
+
+    size_t chosen = std::uniform_int_distribution<size_t>(0, n - 1)(gen);
+    for (size_t c = 0; c < k; ++c) {
+        const float* center = x + chosen * d;
+        memcpy(centroids + c * d, center, d * sizeof(float));
+        if (c + 1 == k) break;
+
+        float center_norm = norms[chosen];
+        double sum = 0;
+        #pragma omp parallel for schedule(static) reduction(+:sum)
+        for (long long i = 0; i < (long long)n; ++i) {
+            float dis = norms[i] + center_norm - 2 * kmeans_dot(x + i * d, center, d);
+            if (dis < min_dis[i]) min_dis[i] = std::max(0.0f, dis);
+            sum += min_dis[i];
+        }
+
+        // 按min_dis加权抽样；所有点都与已选质心重合时随机取
+        double target = std::uniform_real_distribution<double>(0, sum)(gen);
+        chosen = std::uniform_int_distribution<size_t>(0, n - 1)(gen);
+        if (sum > 0) {
+            for (size_t i = 0; i < n; ++i) {
+                target -= min_dis[i];
+                if (target <= 0) {
+                    chosen = i;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// 空簇从最大的簇中分裂：复制其质心并加一点对称扰动
+inline void kmeans_split_empty(size_t d, size_t k, std::vector<size_t>& counts, float* centroids, std::mt19937& gen) {
+    std::uniform_real_distribution<float> jitter(-1.0f, 1.0f);
+    for (size_t c = 0; c < k; ++c) {
+        if (counts[c] > 0) continue;
+        size_t big = std::max_element(counts.begin(), counts.end()) - counts.begin();
+        for (size_t j = 0; j < d; ++j) {
+            float eps = 1e-4f * jitter(gen) * (std::fabs(centroids[big * d + j]) + 1e-3f);
+            centroids[c * d + j] = centroids[big * d + j] + eps;
+            centroids[big * d + j] -= eps;
+        }
+        counts[c] = counts[big] / 2;
+        counts[big] -= counts[c];
+    }
+}
+
+// 训练k个质心写入centroids[k][d]
+inline void kmeans_train(const float* x, size_t n, size_t d, const KMeansParams& params, float* centroids,
+                         KMeansStats* stats = nullptr) {
+    size_t k = params.k;
+    std::mt19937 gen(params.seed);
+    KMeansStats local_stats;
+    if (stats == nullptr) stats = &local_stats;
+
+    // 采样训练集
+    const float* xs = x;
+    std::vector<float> sample_buf;
+    size_t ns = n;
+    if (params.sample > 0 && params.sample < n) {
+        ns = params.sample;
+        std::vector<size_t> perm(n);
+        for (size_t i = 0; i < n; ++i) perm[i] = i;
+        for (size_t i = 0; i < ns; ++i) std::swap(perm[i], perm[std::uniform_int_distribution<size_t>(i, n - 1)(gen)]);
+        std::sort(perm.begin(), perm.begin() + ns);
+        sample_buf.resize(ns * d);
+        for (size_t i = 0; i < ns; ++i) memcpy(&sample_buf[i * d], x + perm[i] * d, d * sizeof(float));
+        xs = sample_buf.data();
+    }
+    if (ns < k) {
+        std::cerr << "kmeans: " << ns << " training points for " << k << " clusters\n";
+        k = ns;
+    }
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    if (params.kmeanspp) {
+        kmeans_init_pp(xs, ns, d, k, gen, centroids);
+    } else {
+        std::vector<size_t> perm(ns);
+        for (size_t i = 0; i < ns; ++i) perm[i] = i;
+        for (size_t c = 0; c < k; ++c) {
+            std::swap(perm[c], perm[std::uniform_int_distribution<size_t>(c, ns - 1)(gen)]);
+            memcpy(centroids + c * d, xs + perm[c] * d, d * sizeof(float));
+        }
+    }
+    stats->init_seconds = kmeans_seconds_since(t0);
+    if (params.verbose) {
+        std::cerr << "kmeans: " << ns << " x " << d << " -> " << k << " clusters, init "
+                  << (params.kmeanspp ? "k-means++" : "random") << " " << stats->init_seconds << "s\n";
+    }
+
+    int num_threads = omp_get_max_threads();
+    std::vector<uint32_t> assign;
+    std::vector<size_t> mb_counts(k, 0); // mini-batch下每个质心累计分到的点数
+
+    for (size_t iter = 0; iter < params.niter; ++iter) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        double obj;
+
+        if (params.minibatch > 0) {
+            // mini-batch：随机取一批点，质心按 1/累计点数 的步长向分到的点移动
+            size_t nb = std::min(params.minibatch, ns);
+            std::vector<float> batch(nb * d);
+            for (size_t i = 0; i < nb; ++i) {
+                size_t idx = std::uniform_int_distribution<size_t>(0, ns - 1)(gen);
+                memcpy(&batch[i * d], xs + idx * d, d * sizeof(float));
+            }
+            assign.resize(nb);
+            obj = kmeans_assign(batch.data(), nb, d, centroids, k, assign.data()) / nb;
+            for (size_t i = 0; i < nb; ++i) {
+                uint32_t c = assign[i];
+                float eta = 1.0f / ++mb_counts[c];
+                for (size_t j = 0; j < d; ++j) centroids[c * d + j] += eta * (batch[i * d + j] - centroids[c * d + j]);
+            }
+        } else {
+            // Lloyd：全部采样点重新分配后求均值，每个线程先累加到自己的缓冲
+            assign.resize(ns);
+            obj = kmeans_assign(xs, ns, d, centroids, k, assign.data()) / ns;
+
+            std::vector<double> sums((size_t)num_threads * k * d, 0.0);
+            std::vector<size_t> counts_t((size_t)num_threads * k, 0);
+            #pragma omp parallel num_threads(num_threads)
+            {
+                int tid = omp_get_thread_num();
+                double* s = sums.data() + (size_t)tid * k * d;
+                size_t* cnt = counts_t.data() + (size_t)tid * k;
+                #pragma omp for schedule(static)
+                for (long long i = 0; i < (long long)ns; ++i) {
+                    uint32_t c = assign[i];
+                    ++cnt[c];
+                    for (size_t j = 0; j < d; ++j) s[c * d + j] += xs[i * d + j];
+                }
+            }
+
+            std::vector<size_t> counts(k, 0);
+            for (int t = 0; t < num_threads; ++t) {
+                for (size_t c = 0; c < k; ++c) counts[c] += counts_t[(size_t)t * k + c];
+            }
+            #pragma omp parallel for schedule(static)
+            for (long long c = 0; c < (long long)k; ++c) {
+                if (counts[c] == 0) continue;
+                for (size_t j = 0; j < d; ++j) {
+                    double v = 0;
+                    for (int t = 0; t < num_threads; ++t) v += sums[((size_t)t * k + c) * d + j];
+                    centroids[c * d + j] = v / counts[c];
+                }
+            }
+            kmeans_split_empty(d, k, counts, centroids, gen);
+        }
+
+        stats->iter_seconds.push_back(kmeans_seconds_since(t1));
+        stats->objective.push_back(obj);
+        if (params.verbose) {
+            std::cerr << "  iter " << iter << "  objective " << obj << "  " << stats->iter_seconds.back() * 1000 << "ms\n";
+        }
+    }
+
+    // 采样点少于k时剩余质心复制已有的
+    for (size_t c = k; c < params.k; ++c) memcpy(centroids + c * d, centroids + (c % k) * d, d * sizeof(float));
+}
@@ -1,5 +1,6 @@
 #include <vector>
 #include <cstring>
+#include <cstdlib>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -19,24 +20,31 @@
 // #include "ivf_openmp.h"
 // #include "ivfpq_pthread.h"
 // #include "ivfpq_openmp.h"
+// #include "cascade.h"
 #include "ivf_mpi.h"
+#include "hnsw_sq.h"
+#include "hnsw_build.h"
+#include "hnsw_reorder.h"
+#include "mapped_array.h"
 // 可以自行添加需要的头文件
 
 using namespace hnswlib;
 
+// 数据文件用mmap映射，不再逐行读到堆上，同一节点的多个进程共用页缓存。
+// 文件不存在或大小与头部不符时（原因MapData已打印），required的文件直接退出，
+// 其余的返回nullptr，依赖它的数据留空，用到它的search不能调用
 template<typename T>
-T *LoadData(std::string data_path, size_t& n, size_t& d)
+T *LoadData(std::string data_path, size_t& n, size_t& d, bool required = true)
 {
-    std::ifstream fin;
-    fin.open(data_path, std::ios::in | std::ios::binary);
-    fin.read((char*)&n,4);
-    fin.read((char*)&d,4);
-    T* data = new T[n*d];
-    int sz = sizeof(T);
-    for(int i = 0; i < n; ++i){
-        fin.read(((char*)data + i*d*sz), d*sz);
+    T* data = MapData<T>(data_path, n, d);
+    if (data == nullptr) {
+        if (required) {
+            std::cerr << "cannot load required file " << data_path << "\n";
+            std::exit(1);
+        }
+        std::cerr << "skip optional file " << data_path << "\n";
+        return nullptr;
     }
-    fin.close();
 
     std::cerr<<"load data "<<data_path<<"\n";
     std::cerr<<"dimension: "<<d<<"  number:"<<n<<"  size_per_element:"<<sizeof(T)<<"\n";
@@ -59,14 +67,19 @@ void build_index(float* base, size_t base_number, size_t vecdim)
     InnerProductSpace ipspace(vecdim);
     appr_alg = new HierarchicalNSW<float>(&ipspace, base_number, M, efConstruction);
 
-    appr_alg->addPoint(base, 0);
-    #pragma omp parallel for
-    for(int i = 1; i < base_number; ++i) {
-        appr_alg->addPoint(base + 1ll*vecdim*i, i);
-    }
+    // 分批并行构建（见hnsw_build.h）：搜索冻结的图时不加锁，反向边在合并阶段按目标点分组写入，
+    // 取代原来omp parallel for里逐个addPoint，结束时打印每秒插入的向量数
+    hnsw_bulk_build(*appr_alg, base, base_number);
+    // 按Gorder重新编号（见hnsw_reorder.h），图上相邻的点在内存里也相邻，label不变
+    hnsw_reorder(*appr_alg, HNSW_ORDER_GORDER);
 
     char path_index[1024] = "files/hnsw.index";
     appr_alg->saveIndex(path_index);
+
+    // 量化版本（见hnsw_sq.h）：同一张图，第0层只存SQ8编码，FP32向量只在重排时从base读取
+    HNSWSQ8Index sq_index;
+    hnsw_sq_build(sq_index, *appr_alg);
+    SaveHNSWSQ8("files/hnsw.sq8.index", sq_index);
 }
 
 
@@ -81,32 +94,77 @@ int main(int argc, char *argv[])
     auto test_gt = LoadData<int>(data_path + "DEEP100K.gt.query.100k.top100.bin", test_number, test_gt_d);
     auto base = LoadData<float>(data_path + "DEEP100K.base.100k.fbin", base_number, vecdim);
 
-    auto sq_base = LoadData<uint8_t>(q_data_path + "DEEP100K.base.100k.ubin", base_number, vecdim);
+    // 下面各种量化数据只有对应的search用到，文件缺少时为空
+    auto sq_base = LoadData<uint8_t>(q_data_path + "DEEP100K.base.100k.ubin", base_number, vecdim, false);
+    // 按维度训练的SQ（sq_build生成），文件不存在时sq_trained_codes为空
+    SQ8Codec sq_codec;
+    std::vector<uint8_t> sq_trained_codes;
+    size_t sq_trained_number = 0;
+    std::string sq_trained_path = q_data_path + "DEEP100K.base.100k.sq8.ubin";
+    if (!LoadSQ8(sq_trained_path, sq_codec, sq_trained_codes, sq_trained_number)) {
+        std::cerr << "skip optional file " << sq_trained_path << "\n";
+    } else if (sq_codec.vecdim != vecdim || sq_trained_number != base_number) {
+        std::cerr << "skip " << sq_trained_path << ": " << sq_trained_number << " x " << sq_codec.vecdim
+                  << " does not match base " << base_number << " x " << vecdim << "\n";
+        sq_codec = SQ8Codec();
+        sq_trained_codes.clear();
+        sq_trained_number = 0;
+    }
+    // 每行编码之和，有了它sq_simd_search走整数点积
+    std::vector<int32_t> sq_code_sums(sq_trained_number);
+    sq_codec.sums(sq_trained_codes.data(), sq_trained_number, sq_code_sums.data());
 
     size_t center_vecdim = 0, center_num_total = 0;
     size_t center_num = 0, cluster_num = 0;
-    auto pq_base = LoadData<uint8_t>(q_data_path + "DEEP100K.base.100k_4_256.quantized.bin", base_number, cluster_num);
-    auto pq_center = LoadData<float>(q_data_path + "DEEP100K.base.100k_4_256.center.bin", center_num_total, center_vecdim);
-    center_num = center_num_total / cluster_num;
-
-    size_t fs_center_num = 0;
-    auto fs_base = LoadData<uint8_t>(q_data_path + "DEEP100K.base.100k_4_16.quantized.bin", base_number, cluster_num);
-    auto fs_center = LoadData<float>(q_data_path + "DEEP100K.base.100k_4_16.center.bin", fs_center_num, center_vecdim);
-    fs_center_num /= 4;
+    auto pq_base = LoadData<uint8_t>(q_data_path + "DEEP100K.base.100k_4_256.quantized.bin", base_number, cluster_num, false);
+    auto pq_center = LoadData<float>(q_data_path + "DEEP100K.base.100k_4_256.center.bin", center_num_total, center_vecdim, false);
+    size_t pq_nsub = cluster_num;
+    // 全量扫描用的ADC格式：16条一块、块内按段存放
+    std::vector<uint8_t> pq_packed;
+    if (pq_base && pq_center) {
+        center_num = center_num_total / pq_nsub;
+        pq_packed.resize((base_number + kPQBlock - 1) / kPQBlock * pq_nsub * kPQBlock);
+        PackPQCodes(pq_base, base_number, pq_nsub, pq_packed.data());
+    }
+
+    size_t fs_center_num = 0, fs_nsub = 0;
+    auto fs_base = LoadData<uint8_t>(q_data_path + "DEEP100K.base.100k_4_16.quantized.bin", base_number, fs_nsub, false);
+    auto fs_center = LoadData<float>(q_data_path + "DEEP100K.base.100k_4_16.center.bin", fs_center_num, center_vecdim, false);
+    // 文件里每段一个字节，启动时打包成32条一块、两段一字节的FastScan格式
+    std::vector<uint8_t> fs_packed;
+    if (fs_base && fs_center) {
+        fs_center_num /= fs_nsub;
+        fs_packed.resize((base_number + kFastScanBlock - 1) / kFastScanBlock * fs_nsub * 16);
+        PackFastScanCodes(fs_base, base_number, fs_nsub, fs_packed.data());
+    }
     
     // ivf相关数据，和ivfpq共用
     size_t ivf_n_clusters = 0, idx_size = 0, offset_num = 0;
     auto ivf_center = LoadData<float>(q_data_path + "DEEP100K.base.100k.256.center.bin", ivf_n_clusters, vecdim);//256*96
     auto ivf_data = LoadData<float>(q_data_path + "DEEP100K.base.100k.256.data.bin", base_number, vecdim);//100000*96
     auto ivf_index = LoadData<uint32_t>(q_data_path + "DEEP100K.base.100k.256.index.bin", base_number, idx_size);//100000*1
-    auto ivf_offset = LoadData<uint32_t>(q_data_path + "DEEP100K.base.100k.256.offset.bin", offset_num, idx_size);//256*1
+    auto ivf_offset_file = LoadData<uint32_t>(q_data_path + "DEEP100K.base.100k.256.offset.bin", offset_num, idx_size);//256*1
+    // 文件里只有每个簇的起点，映射的大小正好是文件大小，补上末尾的base_number才能读cluster_start[cid + 1]
+    std::vector<uint32_t> ivf_offset_vec(ivf_offset_file, ivf_offset_file + offset_num);
+    ivf_offset_vec.push_back(base_number);
+    auto ivf_offset = ivf_offset_vec.data();
+
+    // ivf-sq8：ivf_data按维度量化成uint8，占用为ivf_data的1/4。编码离线用sq_build生成（见LoadIVFSQ8），
+    // 文件不存在时为空索引
+    IVFSQ8Index ivfsq_index;
+    LoadIVFSQ8(q_data_path + "DEEP100K.base.100k.256.sq8.ubin", ivfsq_index);
 
     // ivfpq
     size_t ivfpq_cluster_num = 0, ivfpq_center_num_total = 0;
     size_t ivfpq_center_num = 0, ivfpq_center_vecdim = 0;
-    auto ivfpq_base = LoadData<uint8_t>(q_data_path + "DEEP100K.base.100k.256.pq_12_256.data.bin", base_number, ivfpq_cluster_num);//100000*4 or 100000*12
-    auto ivfpq_center = LoadData<float>(q_data_path + "DEEP100K.base.100k.256.pq_12_256.center.bin", ivfpq_center_num_total, ivfpq_center_vecdim);//256*4*24 or 256*12*8
-    ivfpq_center_num = ivfpq_center_num_total / ivfpq_cluster_num;
+    auto ivfpq_base = LoadData<uint8_t>(q_data_path + "DEEP100K.base.100k.256.pq_12_256.data.bin", base_number, ivfpq_cluster_num, false);//100000*4 or 100000*12
+    auto ivfpq_center = LoadData<float>(q_data_path + "DEEP100K.base.100k.256.pq_12_256.center.bin", ivfpq_center_num_total, ivfpq_center_vecdim, false);//256*4*24 or 256*12*8
+    std::vector<uint8_t> ivfpq_packed;
+    if (ivfpq_base && ivfpq_center) {
+        ivfpq_center_num = ivfpq_center_num_total / ivfpq_cluster_num;
+        ivfpq_packed.resize((base_number + kPQBlock - 1) / kPQBlock * ivfpq_cluster_num * kPQBlock);
+        PackPQCodes(ivfpq_base, base_number, ivfpq_cluster_num, ivfpq_packed.data());
+    }
 
     // 读取pqivf相关数据 仅作测试
     // auto pqivf_base = LoadData<uint8_t>(q_data_path + "r.DEEP100K.base.100k.4_256.256.data.bin", base_number, ivfpq_cluster_num);//100000*4
@@ -114,12 +172,41 @@ int main(int argc, char *argv[])
     // auto pqivf_ivf_center = LoadData<uint8_t>(q_data_path + "r.DEEP100K.base.100k.4_256.256.center.bin", ivf_n_clusters, ivfpq_cluster_num); // 256*4
     // auto pqivf_index = LoadData<uint32_t>(q_data_path + "r.DEEP100K.base.100k.4_256.256.index.bin", base_number, idx_size);//100000*1
     // auto pqivf_offset = LoadData<uint32_t>(q_data_path + "r.DEEP100K.base.100k.4_256.256.offset.bin", offset_num, idx_size);//256*1
+    // std::vector<uint8_t> pqivf_packed((base_number + kPQBlock - 1) / kPQBlock * ivfpq_cluster_num * kPQBlock);
+    // PackPQCodes(pqivf_base, base_number, ivfpq_cluster_num, pqivf_packed.data());
+
+    // 量化HNSW（build_index生成），文件不存在时为空索引
+    HNSWSQ8Index hnsw_sq_index;
+    LoadHNSWSQ8(q_data_path + "hnsw.sq8.index", hnsw_sq_index);
 
     // 只测试前2000条查询
     test_number = 2000;
 
     const size_t k = 10;
 
+    // 级联搜索的组成由环境变量ANN_CASCADE指定（格式见cascade.h），默认与fs_simd_search相同
+    // const char* cascade_spec = std::getenv("ANN_CASCADE");
+    // auto cascade_stages = parse_cascade(cascade_spec ? cascade_spec : "fs4:500k,pq8:100k,fp32");
+    // sq8级有训练好的sq_codec时用它，没有时退回[-1, 1]量化的sq_base
+    // CascadeData cascade_data = {base_number, vecdim, base,
+    //                             sq_trained_number ? sq_trained_codes.data() : sq_base, sq_trained_number ? &sq_codec : nullptr, sq_code_sums.data(),
+    //                             pq_base, pq_packed.data(), pq_center, pq_nsub, center_num, fs_packed.data(), fs_center, fs_nsub};
+
+    // 自适应nprobe（见adaptive_probe.h）：最多探测64个簇，slack按召回目标在前200条查询上二分选出。
+    // 簇半径在计时之前建好，查询时不再扫base
+    // ClusterBounds ivf_bounds(ivf_center, ivf_data, ivf_offset, ivf_n_clusters, vecdim);
+    // ProbeParams ivf_probe(64, 1.0f, 1, &ivf_bounds);
+    // ivf_probe.slack = calibrate_probe_slack(0.95f, [&](float slack) {
+    //     size_t hit = 0, n_calib = 200;
+    //     for (size_t q = 0; q < n_calib; ++q) {
+    //         auto r = ivf_openmp_search(test_query + q * vecdim, ivf_center, ivf_data, ivf_index, ivf_offset, vecdim, k,
+    //                                    ivf_n_clusters, ProbeParams(ivf_probe.max_probe, slack, 1, &ivf_bounds), 1);
+    //         std::set<uint32_t> gtset(test_gt + q * test_gt_d, test_gt + q * test_gt_d + k);
+    //         for (; !r.empty(); r.pop()) hit += gtset.count(r.top().second);
+    //     }
+    //     return (float)hit / (n_calib * k);
+    // });
+
     std::vector<SearchResult> results;
     results.resize(test_number);
 
@@ -154,27 +241,41 @@ int main(int argc, char *argv[])
         
 		// sq_simd
 		// auto res = sq_simd_search(sq_base, test_query + i*vecdim, base_number, vecdim, k, base);
+		// auto res = sq_simd_search(sq_codec, sq_trained_codes.data(), test_query + i*vecdim, base_number, vecdim, k, base, k, sq_code_sums.data());
 		
         // pq_simd
-        // auto res = pq_simd_search(pq_base, pq_center, test_query + i*vecdim, base_number, vecdim, k, center_num, center_vecdim, cluster_num, base);
+        // auto res = pq_simd_search(pq_base, pq_center, test_query + i*vecdim, base_number, vecdim, k, center_num, center_vecdim, pq_nsub, base, false, nullptr, pq_packed.data());
         
         // fs_simd
-        // auto res = fs_simd_search(fs_base, fs_center, test_query + i*vecdim, base_number, vecdim, k, fs_center_num, center_vecdim, base, pq_base, pq_center, center_num);
+        // auto res = fs_simd_search(fs_packed.data(), fs_center, test_query + i*vecdim, base_number, vecdim, k, fs_center_num, center_vecdim, fs_nsub, base, pq_base, pq_center, center_num, pq_nsub);
         
+        // 级联
+        // auto res = cascade_search(cascade_data, cascade_stages, test_query + i*vecdim, k);
+
         // ivf-pthread
         // auto res = ivf_pthread_search(test_query + i*vecdim, ivf_center, ivf_data, ivf_index, ivf_offset, vecdim, k, ivf_n_clusters, 256, 8);
 
         // ivf-omp
         // auto res = ivf_openmp_search(test_query + i*vecdim, ivf_center, ivf_data, ivf_index, ivf_offset, vecdim, k, ivf_n_clusters, 4, 1);
+        // auto res = ivf_openmp_search(test_query + i*vecdim, ivf_center, ivf_data, ivf_index, ivf_offset, vecdim, k, ivf_n_clusters, ivf_probe, 1);
+
+        // ivf-sq8
+        // auto res = ivfsq_openmp_search(test_query + i*vecdim, ivfsq_index, base, ivf_center, ivf_index, ivf_offset, vecdim, k, ivf_n_clusters, 8, 1);
 
         // ivfpq-pthread
-        // auto res = ivfpq_pthread_search(test_query + i*vecdim, ivfpq_base, ivfpq_center, base, ivf_center, ivf_index, ivf_offset, vecdim, k, ivfpq_center_num, ivfpq_center_vecdim, ivfpq_cluster_num, ivf_n_clusters, 56, 7);
+        // auto res = ivfpq_pthread_search(test_query + i*vecdim, ivfpq_packed.data(), ivfpq_center, base, ivf_center, ivf_index, ivf_offset, vecdim, k, ivfpq_center_num, ivfpq_center_vecdim, ivfpq_cluster_num, ivf_n_clusters, 56, 7);
 
         // ivfpq-omp
-        // auto res = ivfpq_openmp_search(test_query + i*vecdim, ivfpq_base, ivfpq_center, base, ivf_center, ivf_index, ivf_offset, vecdim, k, ivfpq_center_num, ivfpq_center_vecdim, ivfpq_cluster_num, ivf_n_clusters, 56, 8);
+        // auto res = ivfpq_openmp_search(test_query + i*vecdim, ivfpq_packed.data(), ivfpq_center, base, ivf_center, ivf_index, ivf_offset, vecdim, k, ivfpq_center_num, ivfpq_center_vecdim, ivfpq_cluster_num, ivf_n_clusters, 56, 8);
 
         // pqivf
-        // auto res = pqivf_pthread_search(test_query + i*vecdim, pqivf_base, pqivf_pq_center, base, pqivf_ivf_center, pqivf_index, pqivf_offset, vecdim, k, ivfpq_center_num, ivfpq_center_vecdim, ivfpq_cluster_num, ivf_n_clusters, 256, 8);
+        // auto res = pqivf_pthread_search(test_query + i*vecdim, pqivf_packed.data(), pqivf_pq_center, base, pqivf_ivf_center, pqivf_index, pqivf_offset, vecdim, k, ivfpq_center_num, ivfpq_center_vecdim, ivfpq_cluster_num, ivf_n_clusters, 256, 8);
+
+        // hnsw-sq8
+        // auto res = hnsw_sq_search(hnsw_sq_index, test_query + i*vecdim, base, k, 100);
+
+        // ivf-mpi 自适应nprobe
+        // auto res = ivf_mpi_search(test_query + i * vecdim, ivf_center, ivf_data, ivf_index, ivf_offset, vecdim, k, ivf_n_clusters, ivf_probe, rank, size);
 
         // ivf-mpi
         auto res = ivf_mpi_search(test_query + i * vecdim,ivf_center, ivf_data, ivf_index, ivf_offset, vecdim, k, ivf_n_clusters, 8, rank, size);
@@ -0,0 +1,108 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// 用mmap读取.fbin/.bin文件（4字节行数 + 4字节列数 + 数据），不再拷贝到堆上。
+// 映射是MAP_PRIVATE的：没有写过的页直接就是页缓存里的页，同一节点上的多个MPI进程
+// 映射同一个文件时共用一份物理内存；个别代码写入时按页复制，不会改动文件。
+
+enum MapAdvice {
+    kMapNormal     = 0,
+    kMapSequential = 1,  // MADV_SEQUENTIAL：顺序扫描，加大预读
+    kMapWillNeed   = 2,  // MADV_WILLNEED：立即开始异步预读
+    kMapHugePage   = 4,  // MADV_HUGEPAGE：允许使用透明大页（文件系统支持时）
+    kMapPopulate   = 8,  // MAP_POPULATE：映射时就把所有页读入，之后访问不再缺页
+};
+
+template<typename T>
+class MappedArray {
+public:
+    MappedArray() : addr_(nullptr), bytes_(0), n_(0), d_(0) {}
+    ~MappedArray() { close(); }
+
+    MappedArray(const MappedArray&) = delete;
+    MappedArray& operator=(const MappedArray&) = delete;
+
+    // 映射文件，检查头部与文件大小是否一致，失败时打印原因并返回false
+    bool open(const std::string& path, int advice = kMapWillNeed) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "mmap: cannot open " << path << "\n";
+            return false;
+        }
+        struct stat st;
+        uint32_t header[2];
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header) || pread(fd, header, sizeof(header), 0) != sizeof(header)) {
+            std::cerr << "mmap: " << path << " has no header\n";
+            ::close(fd);
+            return false;
+        }
+        size_t expect = sizeof(header) + (size_t)header[0] * header[1] * sizeof(T);
+        if ((size_t)st.st_size != expect) {
+            std::cerr << "mmap: " << path << " is " << st.st_size << " bytes, header " << header[0] << " x "
+                      << header[1] << " needs " << expect << "\n";
+            ::close(fd);
+            return false;
+        }
+
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        if (advice & kMapPopulate) flags |= MAP_POPULATE;
+#endif
+        void* addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            std::cerr << "mmap: mapping " << path << " failed\n";
+            return false;
+        }
+        addr_ = addr;
+        bytes_ = st.st_size;
+        n_ = header[0];
+        d_ = header[1];
+
+        if (advice & kMapSequential) madvise(addr_, bytes_, MADV_SEQUENTIAL);
+        if (advice & kMapWillNeed) madvise(addr_, bytes_, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+        if (advice & kMapHugePage) madvise(addr_, bytes_, MADV_HUGEPAGE);
+#endif
+        return true;
+    }
+
+    void close() {
+        if (addr_ != nullptr) munmap(addr_, bytes_);
+        addr_ = nullptr;
+        bytes_ = n_ = d_ = 0;
+    }
+
+    // 数据紧跟在8字节头部之后，对T是对齐的
+    T* data() const { return addr_ ? (T*)((char*)addr_ + 2 * sizeof(uint32_t)) : nullptr; }
+    size_t rows() const { return n_; }
+    size_t cols() const { return d_; }
+    size_t size() const { return n_ * d_; }
+
+private:
+    void* addr_;
+    size_t bytes_;
+    size_t n_, d_;
+};
+
+// 映射文件并返回数据指针，映射保留到进程结束；用来直接替换main.cc中的LoadData
+template<typename T>
+T* MapData(const std::string& path, size_t& n, size_t& d, int advice = kMapWillNeed) {
+    static std::vector<std::unique_ptr<MappedArray<T>>> mapped;
+    std::unique_ptr<MappedArray<T>> arr(new MappedArray<T>());
+    if (!arr->open(path, advice)) return nullptr;
+    n = arr->rows();
+    d = arr->cols();
+    T* data = arr->data();
+    mapped.push_back(std::move(arr));
+    return data;
+}
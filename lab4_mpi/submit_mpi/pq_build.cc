@@ -0,0 +1,143 @@
+// 离线训练PQ码本并编码，输出pq_simd_search/fs_simd_search/ivfpq_*_search读入的文件：
+//   普通模式：<prefix>_<m>_<ksub>.center.bin     m*ksub x dsub 的float码本
+//             <prefix>_<m>_<ksub>.quantized.bin  N x m 的uint8编码，与base同序
+//   残差模式（-ivf）：输入为ivf_build的输出前缀，对 new_base - 所属簇中心 训练和编码
+//             <prefix>.pq_<m>_<ksub>.center.bin  m*ksub x dsub 的float码本
+//             <prefix>.pq_<m>_<ksub>.data.bin    N x m 的uint8编码，与new_base同序
+// 每个文件开头都是4字节的行数和4字节的列数，与LoadData的格式一致。
+//
+// 编译：g++ pq_build.cc -o pq_build -O2 -fopenmp -std=c++11
+// 运行：./pq_build <base.fbin | ivf_prefix> <prefix> [-m 4] [-ksub 256] [-iter 20] [-sample 0] [-ivf 0|1] [-seed 1234]
+// 例如：./pq_build files/DEEP100K.base.100k.fbin files/DEEP100K.base.100k -m 4 -ksub 16
+//       ./pq_build files/DEEP100K.base.100k.256 files/DEEP100K.base.100k.256 -m 12 -ivf 1
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include "pq_train.h"
+
+template<typename T>
+T *LoadData(std::string data_path, size_t& n, size_t& d)
+{
+    std::ifstream fin;
+    fin.open(data_path, std::ios::in | std::ios::binary);
+    if (!fin.is_open()) return nullptr;
+    fin.read((char*)&n,4);
+    fin.read((char*)&d,4);
+    T* data = new T[n*d];
+    int sz = sizeof(T);
+    for(size_t i = 0; i < n; ++i){
+        fin.read(((char*)data + i*d*sz), d*sz);
+    }
+    fin.close();
+
+    std::cerr<<"load data "<<data_path<<"\n";
+    std::cerr<<"dimension: "<<d<<"  number:"<<n<<"  size_per_element:"<<sizeof(T)<<"\n";
+
+    return data;
+}
+
+template<typename T>
+bool SaveData(std::string data_path, const T* data, size_t n, size_t d)
+{
+    std::ofstream fout(data_path, std::ios::out | std::ios::binary);
+    if (!fout.is_open()) return false;
+    uint32_t header[2] = {(uint32_t)n, (uint32_t)d};
+    fout.write((const char*)header, sizeof(header));
+    fout.write((const char*)data, n * d * sizeof(T));
+    return fout.good();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " <base.fbin | ivf_prefix> <prefix> [-m 4] [-ksub 256] [-iter 20]"
+                  << " [-sample 0] [-ivf 0|1] [-seed 1234]\n";
+        return 1;
+    }
+    std::string input = argv[1], prefix = argv[2];
+    size_t m = 4;
+    bool residual = false;
+    KMeansParams params(256);
+    params.verbose = false;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        std::string opt = argv[i], val = argv[i + 1];
+        if (opt == "-m") m = std::atol(val.c_str());
+        else if (opt == "-ksub") params.k = std::atol(val.c_str());
+        else if (opt == "-iter") params.niter = std::atol(val.c_str());
+        else if (opt == "-sample") params.sample = std::atol(val.c_str());
+        else if (opt == "-ivf") residual = std::atol(val.c_str()) != 0;
+        else if (opt == "-seed") params.seed = std::atol(val.c_str());
+        else {
+            std::cerr << "unknown option " << opt << "\n";
+            return 1;
+        }
+    }
+    if (params.k == 0 || params.k > 256) {
+        std::cerr << "ksub must be in [1, 256]\n";
+        return 1;
+    }
+
+    // 读入数据，残差模式下还需要IVF的簇中心和每行所属的簇
+    size_t base_number = 0, vecdim = 0;
+    float* base = nullptr;
+    float* ivf_center = nullptr;
+    std::vector<uint32_t> list_ids;
+    if (residual) {
+        size_t n_clusters = 0, offset_num = 0, one = 0;
+        base = LoadData<float>(input + ".data.bin", base_number, vecdim);
+        ivf_center = LoadData<float>(input + ".center.bin", n_clusters, vecdim);
+        uint32_t* offset = LoadData<uint32_t>(input + ".offset.bin", offset_num, one);
+        if (base == nullptr || ivf_center == nullptr || offset == nullptr) {
+            std::cerr << "cannot open " << input << ".{data,center,offset}.bin\n";
+            return 1;
+        }
+        list_ids.resize(base_number);
+        for (size_t c = 0; c < offset_num; ++c) {
+            size_t end = c + 1 < offset_num ? offset[c + 1] : base_number;
+            for (size_t i = offset[c]; i < end; ++i) list_ids[i] = c;
+        }
+        delete[] offset;
+    } else {
+        base = LoadData<float>(input, base_number, vecdim);
+        if (base == nullptr) {
+            std::cerr << "cannot open " << input << "\n";
+            return 1;
+        }
+    }
+    if (m == 0 || vecdim % m != 0) {
+        std::cerr << "vecdim " << vecdim << " is not divisible by m " << m << "\n";
+        return 1;
+    }
+    size_t dsub = vecdim / m, ksub = params.k;
+    const uint32_t* ids = residual ? list_ids.data() : nullptr;
+    std::cerr << "backend " << simd_kernels().name << ", " << omp_get_max_threads() << " threads, "
+              << m << " subspaces x " << ksub << " centers, dsub " << dsub << (residual ? ", residual\n" : "\n");
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    std::vector<float> codebook(m * ksub * dsub);
+    pq_train(base, base_number, vecdim, m, params, codebook.data(), ivf_center, ids);
+    double train_seconds = kmeans_seconds_since(t0);
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    std::vector<uint8_t> codes(base_number * m);
+    double err = pq_encode(base, base_number, vecdim, m, ksub, codebook.data(), codes.data(), ivf_center, ids);
+    double encode_seconds = kmeans_seconds_since(t1);
+
+    std::string name = residual ? prefix + ".pq_" : prefix + "_";
+    name += std::to_string(m) + "_" + std::to_string(ksub);
+    bool ok = SaveData(name + ".center.bin", codebook.data(), m * ksub, dsub)
+           && SaveData(name + (residual ? ".data.bin" : ".quantized.bin"), codes.data(), base_number, m);
+    if (!ok) {
+        std::cerr << "failed to write " << name << ".*.bin\n";
+        return 1;
+    }
+
+    std::cout << "train " << train_seconds << "s, encode " << encode_seconds << "s ("
+              << base_number / encode_seconds << " vectors/s), mean squared error " << err / base_number << "\n";
+
+    delete[] base;
+    delete[] ivf_center;
+    return 0;
+}
@@ -1,6 +1,8 @@
+#pragma once
 #include <queue>
 #include <vector>
-#include <arm_neon.h>
+#include <memory>
+#include <mutex>
 #include "sq_simd_scan.h"
 
 // 利用InnerProductSIMDNeon进行24个float32运算
@@ -13,18 +15,45 @@ void pre_calculate(float* b1, float* b2, float* dist, size_t vecdim, size_t cent
     }
 }
 
-std::priority_queue<std::pair<float, uint32_t>> pq_simd_search(uint8_t* base, float* center, float* query, size_t base_number, size_t vecdim,
-    size_t k, size_t center_num, size_t center_vecdim, size_t cluster_num, 
-    float* base_full, bool for_candidates = false, std::vector<std::pair<uint16_t, uint32_t>>* cand = nullptr) {
-   std::priority_queue<std::pair<float, uint32_t>> q;
+// 按base指针缓存PackPQCodes打包好的编码，供没有传packed的调用共用，每份base只打包一次。
+// 与shared_coarse_quantizer一样加锁，多个线程可以同时查询；base的内容在进程内不再改变
+inline const uint8_t* shared_pq_packed(const uint8_t* base, size_t base_number, size_t cluster_num) {
+    struct Packed {
+        const uint8_t* base;
+        size_t base_number, cluster_num;
+        std::vector<uint8_t> codes;
+    };
+    static std::vector<std::unique_ptr<Packed>> cache;
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& p : cache) {
+        if (p->base == base && p->base_number == base_number && p->cluster_num == cluster_num) return p->codes.data();
+    }
+    cache.emplace_back(new Packed{base, base_number, cluster_num, std::vector<uint8_t>()});
+    Packed& p = *cache.back();
+    p.codes.resize((base_number + kPQBlock - 1) / kPQBlock * cluster_num * kPQBlock);
+    PackPQCodes(base, base_number, cluster_num, p.codes.data());
+    return p.codes.data();
+}
+
+// PQ粗排默认保留的候选数（k的倍数）
+const size_t kPQRerankPerK = 100;
 
+// base为每行cluster_num字节的编码，只用于候选模式的逐个查表；
+// 全量扫描时用packed（PackPQCodes打包好的base）按块查表，为空时用shared_pq_packed缓存的一份。
+// rerank为粗排保留、参与全精度重排的候选数，0表示k * kPQRerankPerK
+TopK<>& pq_simd_search(SearchContext& ctx, uint8_t* base, float* center, float* query, size_t base_number, size_t vecdim,
+    size_t k, size_t center_num, size_t center_vecdim, size_t cluster_num, 
+    float* base_full, bool for_candidates = false, std::vector<std::pair<uint16_t, uint32_t>>* cand = nullptr,
+    const uint8_t* packed = nullptr, size_t rerank = 0) {
    // 预处理
-   float* pre_dist = new float[center_num * cluster_num];
+   float* pre_dist = SearchContext::buffer(ctx.lut, center_num * cluster_num);
    pre_calculate(center, query, pre_dist, vecdim, center_num, center_vecdim, cluster_num);
 
    // 存储所有找到的候选
-   size_t rerank = k * 100; // 设置rerank
-   std::priority_queue<std::pair<float, uint32_t>> candidates;
+   if (rerank == 0) rerank = k * kPQRerankPerK;
+   TopK<>& candidates = ctx.candidates;
+   candidates.reset(std::max(rerank, k));
 
    if(for_candidates){
         for(auto& pr : *cand){
@@ -36,58 +65,36 @@ std::priority_queue<std::pair<float, uint32_t>> pq_simd_search(uint8_t* base, fl
             dis = 1 - dis; // 计算距离
 
             // 存储候选项
-            if(candidates.size() < rerank){
-                    candidates.push({dis, i});
-            }else{
-                    if(dis < candidates.top().first){
-                        candidates.push({dis, i});
-                        candidates.pop();
-                    }
-            }
+            candidates.push(dis, i);
         }
         // if(idx_array) delete[] idx_array;
     }
    else{
-        for (int i = 0; i < base_number; ++i) {
-            // 使用预处理结果计算粗略的距离
-            float dis = 0;
-            for(int j = 0; j < cluster_num; ++j){
-                dis += pre_dist[base[i * cluster_num + j] + center_num * j]; // base[i*cluster_num + j] 是聚类中心编号
-            }
-            dis = 1 - dis; // 计算距离
-
-            // 存储候选项
-            if(candidates.size() < rerank){
-                    candidates.push({dis, i});
-            }else{
-                    if(dis < candidates.top().first){
-                        candidates.push({dis, i});
-                        candidates.pop();
-                    }
-            }
+        if (packed == nullptr) packed = shared_pq_packed(base, base_number, cluster_num);
+        // 每次查kBatchRows条（16的倍数），距离缓冲留在L1里
+        float dis[kBatchRows];
+        for (size_t i = 0; i < base_number; i += kBatchRows) {
+            size_t cnt = std::min(kBatchRows, base_number - i);
+            PQAdcScan(packed + i * cluster_num, (cnt + kPQBlock - 1) / kPQBlock, pre_dist, cluster_num, center_num, dis);
+            for (size_t j = 0; j < cnt; ++j) dis[j] = 1 - dis[j]; // 计算距离
+            candidates.push_range(dis, cnt, i);
         }
     }
 
-   // 进行全精度重排序
-   while(!candidates.empty()){
-        auto cand = candidates.top();
-        candidates.pop();
-        int i = cand.second;
-        float dis = InnerProductSIMDNeon(base_full + i * vecdim, query, vecdim);
-        dis = 1 - dis;
-
-        // 维护最大堆
-        if (q.size() < k) {
-            q.push({dis, i});
-        } else {
-            if (dis < q.top().first) {
-                q.push({dis, i});
-                q.pop();
-            }
-        }
-   }
-
-   delete[] pre_dist;
+   // 进行全精度重排序，候选id取出后按块批量计算
+   candidates.compact();
+   TopK<>& q = ctx.result;
+   q.reset(k);
+   rerank_entries(candidates.begin(), candidates.end(), base_full, query, vecdim, q);
+   q.compact();
    return q;
 }
 
+std::priority_queue<std::pair<float, uint32_t>> pq_simd_search(uint8_t* base, float* center, float* query, size_t base_number, size_t vecdim,
+    size_t k, size_t center_num, size_t center_vecdim, size_t cluster_num, 
+    float* base_full, bool for_candidates = false, std::vector<std::pair<uint16_t, uint32_t>>* cand = nullptr,
+    const uint8_t* packed = nullptr, size_t rerank = 0) {
+   return pq_simd_search(thread_search_context(), base, center, query, base_number, vecdim, k, center_num, center_vecdim,
+                         cluster_num, base_full, for_candidates, cand, packed, rerank).to_queue();
+}
+
@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include <random>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <omp.h>
+#include "kmeans.h"
+
+// PQ训练与编码，输出与pq_simd_search/fs_simd_search/ivfpq_*_search读入的格式一致：
+// codebook[m * ksub][dsub]，第j段的ksub个中心连续存放；codes[n][m]，每段一个字节（4bit编码也占一个字节）。
+// centroids和list_ids非空时为IVFPQ的残差模式：第i行先减去centroids[list_ids[i]]再训练/编码。
+
+// 取第i行第j段（残差模式下减去簇中心）写入out[dsub]
+inline void pq_subvector(const float* x, size_t i, size_t j, size_t d, size_t dsub,
+                         const float* centroids, const uint32_t* list_ids, float* out) {
+    const float* xi = x + i * d + j * dsub;
+    if (centroids == nullptr) {
+        memcpy(out, xi, dsub * sizeof(float));
+    } else {
+        const float* ci = centroids + (size_t)list_ids[i] * d + j * dsub;
+        for (size_t t = 0; t < dsub; ++t) out[t] = xi[t] - ci[t];
+    }
+}
+
+// 每段独立做k-means，params.k即每段中心数ksub；params.sample>0时所有段共用同一组采样行
+inline void pq_train(const float* x, size_t n, size_t d, size_t m, const KMeansParams& params, float* codebook,
+                     const float* centroids = nullptr, const uint32_t* list_ids = nullptr) {
+    size_t dsub = d / m, ksub = params.k;
+    std::vector<size_t> rows(n);
+    for (size_t i = 0; i < n; ++i) rows[i] = i;
+    if (params.sample > 0 && params.sample < n) {
+        std::mt19937 gen(params.seed);
+        for (size_t i = 0; i < params.sample; ++i) std::swap(rows[i], rows[std::uniform_int_distribution<size_t>(i, n - 1)(gen)]);
+        rows.resize(params.sample);
+        std::sort(rows.begin(), rows.end());
+    }
+    size_t ns = rows.size();
+
+    KMeansParams sub_params = params;
+    sub_params.sample = 0;
+    std::vector<float> sub(ns * dsub);
+    for (size_t j = 0; j < m; ++j) {
+        #pragma omp parallel for schedule(static)
+        for (long long i = 0; i < (long long)ns; ++i) {
+            pq_subvector(x, rows[i], j, d, dsub, centroids, list_ids, &sub[i * dsub]);
+        }
+        if (params.verbose) std::cerr << "pq: subspace " << j << "/" << m << "\n";
+        sub_params.seed = params.seed + j;
+        kmeans_train(sub.data(), ns, dsub, sub_params, codebook + j * ksub * dsub);
+    }
+}
+
+// 每行每段取最近的中心编号写入codes[n][m]，返回量化误差（平方距离）之和
+inline double pq_encode(const float* x, size_t n, size_t d, size_t m, size_t ksub, const float* codebook, uint8_t* codes,
+                        const float* centroids = nullptr, const uint32_t* list_ids = nullptr) {
+    size_t dsub = d / m;
+    std::vector<PackedCentroids> books;
+    for (size_t j = 0; j < m; ++j) books.emplace_back(codebook + j * ksub * dsub, ksub, dsub);
+
+    double total = 0;
+    #pragma omp parallel reduction(+:total)
+    {
+        std::vector<float> block(kKMeansBlock * dsub);
+        std::vector<float> tile(kKMeansBlock * kTileRows);
+        uint32_t best_id[kKMeansBlock];
+        float best[kKMeansBlock];
+
+        #pragma omp for schedule(dynamic)
+        for (long long i0 = 0; i0 < (long long)n; i0 += kKMeansBlock) {
+            size_t nb = std::min(kKMeansBlock, n - (size_t)i0);
+            for (size_t j = 0; j < m; ++j) {
+                // 一块行的第j段收集成连续的[nb][dsub]，与该段的码本按tile计算
+                for (size_t i = 0; i < nb; ++i) pq_subvector(x, i0 + i, j, d, dsub, centroids, list_ids, &block[i * dsub]);
+                books[j].nearest(block.data(), nb, best_id, best, tile.data());
+                for (size_t i = 0; i < nb; ++i) {
+                    codes[(i0 + i) * m + j] = (uint8_t)best_id[i];
+                    const float* s = &block[i * dsub];
+                    total += std::max(0.0f, kmeans_dot(s, s, dsub) - 2 * best[i]);
+                }
+            }
+        }
+    }
+    return total;
+}
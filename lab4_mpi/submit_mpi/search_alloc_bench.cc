@@ -0,0 +1,221 @@
+// 查询热路径的堆分配计数：替换全局operator new统计次数，对比原接口与带SearchContext的重载。
+// 先用同一个SearchContext跑几条查询让缓冲长到稳定的大小，再统计之后每条查询的分配次数和耗时。
+// 数据是随机生成的（聚类中心、PQ编码都是随机的），只看分配和速度，不看召回。
+// 编译：g++ search_alloc_bench.cc -o search_alloc_bench -O2 -fopenmp -lpthread -std=c++11
+// 运行：./search_alloc_bench [num_threads]
+#include <new>
+#include <atomic>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <functional>
+#include "ivfpq_openmp.h"
+#include "cascade.h"
+
+static std::atomic<size_t> g_alloc_count(0);
+
+void* operator new(size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+struct BenchData {
+    size_t base_number, vecdim, n_clusters, pq_nsub, pq_ksub, fs_nsub;
+    std::vector<float> base, query, centroids, pq_center, fs_center;
+    std::vector<uint8_t> sq_base, pq_codes, pq_packed, fs_packed, ivfpq_packed;
+    SQ8Codec sq_codec;
+    std::vector<uint8_t> sq_codes;
+    std::vector<int32_t> sq_code_sums;
+    std::vector<uint32_t> new_to_old, cluster_start;
+    std::vector<float> new_base;
+};
+
+BenchData MakeData(size_t base_number, size_t nq) {
+    BenchData d;
+    d.base_number = base_number;
+    d.vecdim = 96;
+    d.n_clusters = 64;
+    d.pq_nsub = 4;
+    d.pq_ksub = 256;
+    d.fs_nsub = 4;
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> dist(-0.2f, 0.2f);
+    auto fill = [&](std::vector<float>& v, size_t n) {
+        v.resize(n);
+        for (size_t i = 0; i < n; ++i) v[i] = dist(gen);
+    };
+    fill(d.base, base_number * d.vecdim);
+    fill(d.query, nq * d.vecdim);
+    fill(d.centroids, d.n_clusters * d.vecdim);
+    fill(d.pq_center, d.pq_nsub * d.pq_ksub * (d.vecdim / d.pq_nsub));
+    fill(d.fs_center, d.fs_nsub * 16 * (d.vecdim / d.fs_nsub));
+
+    d.sq_base.resize(base_number * d.vecdim);
+    QuantizeSIMD(d.base.data(), d.sq_base.data(), d.sq_base.size(), -1.0f, 1.0f);
+    d.sq_codec.train(d.base.data(), base_number, d.vecdim);
+    d.sq_codes.resize(base_number * d.vecdim);
+    d.sq_code_sums.resize(base_number);
+    d.sq_codec.encode(d.base.data(), base_number, d.sq_codes.data(), d.sq_code_sums.data());
+
+    // PQ和FastScan编码随机取
+    std::vector<uint8_t> fs_codes(base_number * d.fs_nsub);
+    d.pq_codes.resize(base_number * d.pq_nsub);
+    for (auto& c : d.pq_codes) c = gen() & 0xFF;
+    for (auto& c : fs_codes) c = gen() & 0x0F;
+    d.pq_packed.resize((base_number + kPQBlock - 1) / kPQBlock * d.pq_nsub * kPQBlock);
+    PackPQCodes(d.pq_codes.data(), base_number, d.pq_nsub, d.pq_packed.data());
+    d.fs_packed.resize((base_number + kFastScanBlock - 1) / kFastScanBlock * d.fs_nsub * 16);
+    PackFastScanCodes(fs_codes.data(), base_number, d.fs_nsub, d.fs_packed.data());
+
+    // 每行随机分到一个簇，按簇重排
+    std::vector<std::vector<uint32_t>> lists(d.n_clusters);
+    for (size_t i = 0; i < base_number; ++i) lists[gen() % d.n_clusters].push_back(i);
+    d.cluster_start.push_back(0);
+    for (auto& list : lists) {
+        for (uint32_t id : list) {
+            d.new_to_old.push_back(id);
+            d.new_base.insert(d.new_base.end(), d.base.begin() + id * d.vecdim, d.base.begin() + (id + 1) * d.vecdim);
+        }
+        d.cluster_start.push_back(d.new_to_old.size());
+    }
+    std::vector<uint8_t> ivfpq_codes(base_number * d.pq_nsub);
+    for (size_t i = 0; i < base_number; ++i) {
+        for (size_t j = 0; j < d.pq_nsub; ++j) ivfpq_codes[i * d.pq_nsub + j] = d.pq_codes[d.new_to_old[i] * d.pq_nsub + j];
+    }
+    d.ivfpq_packed.resize(d.pq_packed.size());
+    PackPQCodes(ivfpq_codes.data(), base_number, d.pq_nsub, d.ivfpq_packed.data());
+    return d;
+}
+
+// 先跑warmup条查询，再统计nq条查询的平均分配次数和微秒数
+void Bench(const char* name, size_t nq, size_t vecdim, const std::vector<float>& query,
+           const std::function<void(float*)>& search) {
+    const size_t warmup = 5;
+    for (size_t i = 0; i < warmup; ++i) search((float*)query.data() + i % nq * vecdim);
+
+    size_t before = g_alloc_count.load();
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < nq; ++i) search((float*)query.data() + i * vecdim);
+    double us = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - t0).count();
+    size_t allocs = g_alloc_count.load() - before;
+
+    std::cout << std::left << std::setw(24) << name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(10) << (double)allocs / nq << " allocs/query"
+              << std::setprecision(1) << std::setw(10) << us / nq << " us/query\n";
+}
+
+int main(int argc, char* argv[]) {
+    size_t num_threads = argc > 1 ? std::atol(argv[1]) : 4;
+    const size_t nq = 200, k = 10, nprobe = 8;
+    BenchData d = MakeData(100000, nq);
+    size_t vecdim = d.vecdim, n = d.base_number, dsub = vecdim / d.pq_nsub;
+    SearchContext ctx;
+
+    std::cout << "backend " << simd_kernels().name << ", " << num_threads << " threads, "
+              << n << " x " << vecdim << ", k = " << k << "\n";
+
+    Bench("plain", nq, vecdim, d.query, [&](float* q) {
+        plain_simd_search(d.base.data(), q, n, vecdim, k);
+    });
+    Bench("plain + ctx", nq, vecdim, d.query, [&](float* q) {
+        plain_simd_search(ctx, d.base.data(), q, n, vecdim, k);
+    });
+    Bench("sq", nq, vecdim, d.query, [&](float* q) {
+        sq_simd_search(d.sq_base.data(), q, n, vecdim, k, d.base.data());
+    });
+    Bench("sq + ctx", nq, vecdim, d.query, [&](float* q) {
+        sq_simd_search(ctx, d.sq_base.data(), q, n, vecdim, k, d.base.data());
+    });
+    Bench("pq", nq, vecdim, d.query, [&](float* q) {
+        pq_simd_search(d.pq_codes.data(), d.pq_center.data(), q, n, vecdim, k, d.pq_ksub, dsub, d.pq_nsub,
+                       d.base.data(), false, nullptr, d.pq_packed.data());
+    });
+    Bench("pq + ctx", nq, vecdim, d.query, [&](float* q) {
+        pq_simd_search(ctx, d.pq_codes.data(), d.pq_center.data(), q, n, vecdim, k, d.pq_ksub, dsub, d.pq_nsub,
+                       d.base.data(), false, nullptr, d.pq_packed.data());
+    });
+    Bench("pq unpacked + ctx", nq, vecdim, d.query, [&](float* q) {
+        pq_simd_search(ctx, d.pq_codes.data(), d.pq_center.data(), q, n, vecdim, k, d.pq_ksub, dsub, d.pq_nsub,
+                       d.base.data());
+    });
+    Bench("fs", nq, vecdim, d.query, [&](float* q) {
+        fs_simd_search(d.fs_packed.data(), d.fs_center.data(), q, n, vecdim, k, 16, vecdim / d.fs_nsub, d.fs_nsub,
+                       d.base.data(), d.pq_codes.data(), d.pq_center.data(), d.pq_ksub, d.pq_nsub);
+    });
+    Bench("fs + ctx", nq, vecdim, d.query, [&](float* q) {
+        fs_simd_search(ctx, d.fs_packed.data(), d.fs_center.data(), q, n, vecdim, k, 16, vecdim / d.fs_nsub, d.fs_nsub,
+                       d.base.data(), d.pq_codes.data(), d.pq_center.data(), d.pq_ksub, d.pq_nsub);
+    });
+    CascadeData cascade_data = {n, vecdim, d.base.data(), d.sq_codes.data(), &d.sq_codec, d.sq_code_sums.data(),
+                                d.pq_codes.data(), d.pq_packed.data(), d.pq_center.data(), d.pq_nsub, d.pq_ksub,
+                                d.fs_packed.data(), d.fs_center.data(), d.fs_nsub};
+    auto cascade_stages = parse_cascade("fs4:500k,pq8:100k,fp32");
+    Bench("cascade", nq, vecdim, d.query, [&](float* q) {
+        cascade_search(cascade_data, cascade_stages, q, k);
+    });
+    Bench("cascade + ctx", nq, vecdim, d.query, [&](float* q) {
+        cascade_search(ctx, cascade_data, cascade_stages, q, k);
+    });
+    auto cascade_sq_stages = parse_cascade("sq8:2k,pq8:100,fp32");
+    Bench("cascade sq8 + ctx", nq, vecdim, d.query, [&](float* q) {
+        cascade_search(ctx, cascade_data, cascade_sq_stages, q, k);
+    });
+    auto cascade_pq_stages = parse_cascade("pq8:100k,fp32");
+    Bench("cascade pq8 + ctx", nq, vecdim, d.query, [&](float* q) {
+        cascade_search(ctx, cascade_data, cascade_pq_stages, q, k);
+    });
+    Bench("ivf_pthread", nq, vecdim, d.query, [&](float* q) {
+        ivf_pthread_search(q, d.centroids.data(), d.new_base.data(), d.new_to_old.data(), d.cluster_start.data(),
+                           vecdim, k, d.n_clusters, nprobe, num_threads);
+    });
+    Bench("ivf_pthread + ctx", nq, vecdim, d.query, [&](float* q) {
+        ivf_pthread_search(ctx, q, d.centroids.data(), d.new_base.data(), d.new_to_old.data(), d.cluster_start.data(),
+                           vecdim, k, d.n_clusters, nprobe, num_threads);
+    });
+    Bench("ivf_openmp", nq, vecdim, d.query, [&](float* q) {
+        ivf_openmp_search(q, d.centroids.data(), d.new_base.data(), d.new_to_old.data(), d.cluster_start.data(),
+                          vecdim, k, d.n_clusters, nprobe, num_threads);
+    });
+    Bench("ivf_openmp + ctx", nq, vecdim, d.query, [&](float* q) {
+        ivf_openmp_search(ctx, q, d.centroids.data(), d.new_base.data(), d.new_to_old.data(), d.cluster_start.data(),
+                          vecdim, k, d.n_clusters, nprobe, num_threads);
+    });
+    Bench("ivfpq_pthread", nq, vecdim, d.query, [&](float* q) {
+        ivfpq_pthread_search(q, d.ivfpq_packed.data(), d.pq_center.data(), d.base.data(), d.centroids.data(),
+                             d.new_to_old.data(), d.cluster_start.data(), vecdim, k, d.pq_ksub, dsub, d.pq_nsub,
+                             d.n_clusters, nprobe, num_threads);
+    });
+    Bench("ivfpq_pthread + ctx", nq, vecdim, d.query, [&](float* q) {
+        ivfpq_pthread_search(ctx, q, d.ivfpq_packed.data(), d.pq_center.data(), d.base.data(), d.centroids.data(),
+                             d.new_to_old.data(), d.cluster_start.data(), vecdim, k, d.pq_ksub, dsub, d.pq_nsub,
+                             d.n_clusters, nprobe, num_threads);
+    });
+    Bench("ivfpq_openmp", nq, vecdim, d.query, [&](float* q) {
+        ivfpq_openmp_search(q, d.ivfpq_packed.data(), d.pq_center.data(), d.base.data(), d.centroids.data(),
+                            d.new_to_old.data(), d.cluster_start.data(), vecdim, k, d.pq_ksub, dsub, d.pq_nsub,
+                            d.n_clusters, nprobe, num_threads);
+    });
+    Bench("ivfpq_openmp + ctx", nq, vecdim, d.query, [&](float* q) {
+        ivfpq_openmp_search(ctx, q, d.ivfpq_packed.data(), d.pq_center.data(), d.base.data(), d.centroids.data(),
+                            d.new_to_old.data(), d.cluster_start.data(), vecdim, k, d.pq_ksub, dsub, d.pq_nsub,
+                            d.n_clusters, nprobe, num_threads);
+    });
+    return 0;
+}
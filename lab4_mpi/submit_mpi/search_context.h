@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "topk.h"
+#include "work_stealing.h"
+#include "coarse_quantizer.h"
+#include "visited_set.h"
+
+// 每条查询的临时内存：PQ/FastScan查找表、量化后的query、粗排候选、各线程的top-k等。
+// 缓冲只增不减，用同一个SearchContext连续查询时，尺寸稳定后搜索过程中不再有堆分配。
+// 各搜索函数带SearchContext的重载把结果留在ctx.result里返回；原来的接口用thread_search_context()
+// 调用这些重载，只多一次结果转成priority_queue的分配。
+// 一个SearchContext同一时刻只能给一条查询使用。
+
+// pthread版本一次查询最多使用的线程数，线程参数放在栈上
+const size_t kMaxSearchThreads = 64;
+
+// 线程数限制在[1, kMaxSearchThreads]，超出时截断，不会写出栈上的线程参数数组
+inline size_t clamp_search_threads(size_t num_threads) {
+    return std::max<size_t>(1, std::min(num_threads, kMaxSearchThreads));
+}
+
+struct SearchContext {
+    typedef std::pair<float, uint32_t> Entry;
+
+    std::vector<float> lut;                     // PQ查找表[nsub][ksub]
+    std::vector<uint8_t> fs_tables;             // FastScan量化表[nsub][16]
+    std::vector<uint8_t> quantized_query;       // SQ量化后的query
+    std::vector<int8_t> query_i8;               // SQ8整数扫描的int8权重
+    std::vector<Entry> centroid_dists;          // IVF选中的簇中心及距离
+    TopK<> coarse;                              // IVF粗排的top-m
+    std::vector<std::pair<uint16_t, uint32_t>> fs_candidates;  // FastScan粗排候选
+    std::vector<uint16_t> fs_scores;            // FastScan阈值过滤的缓冲
+    std::vector<uint32_t> fs_ids;
+    TopK<> candidates;                          // 粗排候选
+    TopK<> result;                              // 最终结果
+    ChunkQueues queues;                         // pthread版本的块队列
+    std::vector<TopK<>> thread_topks;           // 每个线程（任务）自己的top-k
+    std::vector<std::vector<Entry>> thread_candidates;  // IVFPQ每个线程分到的重排候选
+    std::vector<Entry> mpi_send, mpi_recv;      // MPI版本汇总结果的收发缓冲
+    std::vector<uint32_t> cascade_ids;          // 级联搜索上一级留下的候选
+    std::vector<Entry> hnsw_candidates;         // HNSW束搜索待扩展的点（小顶堆）
+    std::vector<Entry> hnsw_top;                // HNSW束搜索当前最近的ef个（大顶堆）
+    VisitedSet visited;                         // HNSW的访问标记，每个线程一份，不加锁
+
+    SearchContext() : coarse(1), candidates(1), result(1), queues(1) {}
+
+    // 返回至少n个元素的缓冲
+    template <class T>
+    static T* buffer(std::vector<T>& buf, size_t n) {
+        if (buf.size() < n) buf.resize(n);
+        return buf.data();
+    }
+
+    // 前n个线程的top-k都重置为k
+    void reset_thread_topks(size_t n, size_t k) {
+        if (thread_topks.size() < n) thread_topks.resize(n, TopK<>(k));
+        for (size_t i = 0; i < n; ++i) thread_topks[i].reset(k);
+    }
+
+    void reset_thread_candidates(size_t n) {
+        if (thread_candidates.size() < n) thread_candidates.resize(n);
+        for (size_t i = 0; i < n; ++i) thread_candidates[i].clear();
+    }
+};
+
+// 每个线程一份，原来的接口都用它
+inline SearchContext& thread_search_context() {
+    static thread_local SearchContext ctx;
+    return ctx;
+}
@@ -0,0 +1,1166 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "simd_types.h"
+
+#ifdef ANN_SIMD_X86
+#include <cpuid.h>
+#endif
+#if defined(ANN_SIMD_NEON_DOTPROD) && !defined(__ARM_FEATURE_DOTPROD)
+#include <sys/auxv.h>
+#ifndef HWCAP_ASIMDDP
+#define HWCAP_ASIMDDP (1 << 20)
+#endif
+#endif
+
+// 运行时SIMD分派：启动时按CPUID选出最高可用的后端，所有内核通过SimdKernels函数表调用
+// 可以用环境变量 ANN_SIMD=scalar/neon/sse4/avx2/avx512 强制指定（不支持时退回最高可用级别）
+
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_NEON,
+    SIMD_SSE4,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    SIMD_LEVEL_COUNT
+};
+
+struct SimdKernels {
+    SimdLevel level;
+    const char* name;
+    // 8路/16路累加的内积，vecdim需是对应路数的倍数
+    float (*inner_product8)(const float* a, const float* b, size_t vecdim);
+    float (*inner_product16)(const float* a, const float* b, size_t vecdim);
+    // 4bit FastScan：codes为n_blocks个PackFastScanCodes打包好的32条向量块，tables[nsub][16]，
+    // out[b*32 + l] = Σ_j tables[j*16 + 第b块第l条向量第j段的编码]，16位饱和累加
+    void (*lut16_scan)(const uint8_t* codes, size_t n_blocks, const uint8_t* tables, size_t nsub, uint16_t* out);
+    // 阈值过滤：scores[i] >= threshold的项把分数和id0 + i依次压缩写入out_scores/out_ids，返回写入个数
+    size_t (*filter_u16_ge)(const uint16_t* scores, size_t n, uint16_t threshold, uint32_t id0,
+                            uint16_t* out_scores, uint32_t* out_ids);
+    // n行与同一个query的内积：ids为空时取base中连续的n行，否则取base[ids[i]]行
+    void (*inner_product_batch)(const float* base, const uint32_t* ids, size_t n,
+                                const float* query, size_t vecdim, float* out);
+    // GEMM式分块内积：packed为PackTileRows打包好的16行base，out[q*16 + r]为第q条query与第r行的内积
+    void (*inner_product_tile)(const float* packed, const float* query, size_t nq, size_t vecdim, float* out);
+    // 8bit PQ的ADC查表：codes为n_blocks个PackPQCodes打包好的16条向量块，lut[nsub][ksub]为float距离表，
+    // out[b*16 + l] = Σ_j lut[j*ksub + 第b块第l条向量第j段的编码]，按j的顺序累加
+    void (*pq_adc_scan)(const uint8_t* codes, size_t n_blocks, const float* lut, size_t nsub, size_t ksub, float* out);
+    // 单条query与n_panels组PackTileRows打包好的16行（每组vecdim * 16个float，依次相连）的内积，
+    // out[p*16 + r]为第p组第r行的内积
+    void (*inner_product_panels)(const float* packed, size_t n_panels, const float* query, size_t vecdim, float* out);
+    // 8bit标量量化编码与float权重的内积：codes为连续的n行，每行vecdim个uint8，
+    // out[i] = Σ_d weights[d] * codes[i*vecdim + d]
+    void (*sq8_inner_product_batch)(const uint8_t* codes, size_t n, const float* weights, size_t vecdim, float* out);
+    // 8bit编码与int8权重的整数内积：out[i] = Σ_d query[d] * codes[i*vecdim + d]。
+    // code_sums[i]为第i行编码之和，只有把query平移成u8再做u8点积的内核（NEON udot）会用到。
+    // 同一级别下按CPU是否支持VNNI/udot选用不同的实现，见sq8_dot_batch_for
+    void (*sq8_dot_batch)(const uint8_t* codes, const int32_t* code_sums, size_t n, const int8_t* query,
+                          size_t vecdim, int32_t* out);
+};
+
+// inner_product_tile一次处理的base行数
+const size_t kTileRows = 16;
+// lut16_scan一块的向量数
+const size_t kFastScanBlock = 32;
+// pq_adc_scan一块的向量数
+const size_t kPQBlock = 16;
+
+inline const char* simd_level_name(SimdLevel level) {
+    static const char* names[SIMD_LEVEL_COUNT] = {"scalar", "neon", "sse4", "avx2", "avx512"};
+    return level < SIMD_LEVEL_COUNT ? names[level] : "unknown";
+}
+
+// ------------------------------- CPU检测 -------------------------------
+// 参照hnswlib.h中AVXCapable()/AVX512Capable()的做法，额外检查AVX2与FMA
+
+#ifdef ANN_SIMD_X86
+static inline void simd_cpuid(unsigned int out[4], unsigned int leaf, unsigned int subleaf) {
+    __cpuid_count(leaf, subleaf, out[0], out[1], out[2], out[3]);
+}
+
+static inline uint64_t simd_xgetbv(unsigned int index) {
+    uint32_t eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((uint64_t)edx << 32) | eax;
+}
+
+inline bool SimdSSE4Capable() {
+    unsigned int info[4];
+    if (__get_cpuid_max(0, nullptr) < 1) return false;
+    simd_cpuid(info, 1, 0);
+    bool ssse3 = (info[2] & (1u << 9)) != 0;
+    bool sse41 = (info[2] & (1u << 19)) != 0;
+    return ssse3 && sse41;
+}
+
+inline bool SimdAVX2Capable() {
+    unsigned int info[4];
+    if (__get_cpuid_max(0, nullptr) < 7) return false;
+
+    // CPU support
+    simd_cpuid(info, 1, 0);
+    bool fma = (info[2] & (1u << 12)) != 0;
+    bool osxsave = (info[2] & (1u << 27)) != 0;
+    bool avx = (info[2] & (1u << 28)) != 0;
+    simd_cpuid(info, 7, 0);
+    bool avx2 = (info[1] & (1u << 5)) != 0;
+    if (!(fma && osxsave && avx && avx2)) return false;
+
+    // OS support，需要保存XMM/YMM状态
+    return (simd_xgetbv(0) & 0x6) == 0x6;
+}
+
+inline bool SimdAVX512Capable() {
+    if (!SimdAVX2Capable()) return false;
+
+    unsigned int info[4];
+    simd_cpuid(info, 7, 0);
+    bool avx512f = (info[1] & (1u << 16)) != 0;
+
+    // OS support，还需要保存opmask与ZMM状态
+    return avx512f && (simd_xgetbv(0) & 0xe6) == 0xe6;
+}
+
+// vpdpbusd的两种编码：AVX512_VNNI（叶7 ECX第11位，ymm版本还要VL）和AVX-VNNI（叶7子叶1 EAX第4位）
+inline bool SimdAVX512VNNICapable() {
+    if (!SimdAVX512Capable()) return false;
+
+    unsigned int info[4];
+    simd_cpuid(info, 7, 0);
+    bool avx512bw = (info[1] & (1u << 30)) != 0;
+    bool avx512vl = (info[1] & (1u << 31)) != 0;
+    bool vnni = (info[2] & (1u << 11)) != 0;
+    return avx512bw && avx512vl && vnni;
+}
+
+inline bool SimdAVXVNNICapable() {
+    if (!SimdAVX2Capable()) return false;
+
+    unsigned int info[4];
+    simd_cpuid(info, 7, 0);
+    if (info[0] < 1) return false;
+    simd_cpuid(info, 7, 1);
+    return (info[0] & (1u << 4)) != 0;
+}
+#endif
+
+#ifdef ANN_SIMD_NEON
+inline bool SimdNeonDotProdCapable() {
+#if defined(__ARM_FEATURE_DOTPROD)
+    return true;
+#elif defined(ANN_SIMD_NEON_DOTPROD)
+    return (getauxval(AT_HWCAP) & HWCAP_ASIMDDP) != 0;
+#else
+    return false;
+#endif
+}
+#endif
+
+inline bool simd_level_supported(SimdLevel level) {
+    switch (level) {
+    case SIMD_SCALAR:
+        return true;
+#ifdef ANN_SIMD_NEON
+    case SIMD_NEON:
+        return true;
+#endif
+#ifdef ANN_SIMD_X86
+    case SIMD_SSE4:
+        return SimdSSE4Capable();
+    case SIMD_AVX2:
+        return SimdAVX2Capable();
+    case SIMD_AVX512:
+        return SimdAVX512Capable();
+#endif
+    default:
+        return false;
+    }
+}
+
+inline SimdLevel simd_best_level() {
+    for (int l = SIMD_LEVEL_COUNT - 1; l > SIMD_SCALAR; --l) {
+        if (simd_level_supported((SimdLevel)l)) return (SimdLevel)l;
+    }
+    return SIMD_SCALAR;
+}
+
+// ------------------------------- 内核 -------------------------------
+
+// 通用内积模板，V为各后端的simd封装
+template <class V>
+inline float InnerProductKernel(const float* a, const float* b, size_t vecdim) {
+    V sum;
+    for (size_t i = 0; i < vecdim; i += V::kLanes) {
+        sum = V::fmadd(V(a + i), V(b + i), sum);
+    }
+    return sum.reduce_add();
+}
+
+// 多行分块内积：R行为一组，每段query只载入一次供R行共用，
+// R个累加器互不依赖，横向规约推迟到整行算完后4个一起做
+template <class V, int R>
+inline void InnerProductRows(const float* const* rows, const float* query, size_t vecdim, float* out) {
+    V acc[R];
+    for (size_t i = 0; i < vecdim; i += V::kLanes) {
+        V q(query + i);
+#pragma GCC unroll 8
+        for (int r = 0; r < R; ++r) acc[r] = V::fmadd(V(rows[r] + i), q, acc[r]);
+    }
+#pragma GCC unroll 2
+    for (int r = 0; r < R; r += 4) V::reduce_add4(acc[r], acc[r + 1], acc[r + 2], acc[r + 3], out + r);
+}
+
+inline const float* BatchRow(const float* base, const uint32_t* ids, size_t i, size_t vecdim) {
+    return ids ? base + (size_t)ids[i] * vecdim : base + i * vecdim;
+}
+
+// 维度编译期已知（DEEP100K为96维）时，query整段预先放进寄存器，块与块之间不再重新读取
+template <class V, int R, size_t D>
+inline void InnerProductBatchFixed(const float* base, const uint32_t* ids, size_t n, const float* query, float* out) {
+    const int kChunks = D / V::kLanes;
+    V q[kChunks];
+#pragma GCC unroll 16
+    for (int j = 0; j < kChunks; ++j) q[j] = V(query + j * V::kLanes);
+
+    size_t i = 0;
+    for (; i + R <= n; i += R) {
+        const float* rows[R];
+        for (int r = 0; r < R; ++r) rows[r] = BatchRow(base, ids, i + r, D);
+        if (ids != nullptr && i + 2 * R <= n) {
+            // 按id取行是随机访问，提前预取下一组
+            for (int r = 0; r < R; ++r) {
+                const float* next = BatchRow(base, ids, i + R + r, D);
+                for (size_t off = 0; off < D; off += 16) __builtin_prefetch(next + off);
+            }
+        }
+
+        V acc[R];
+#pragma GCC unroll 16
+        for (int j = 0; j < kChunks; ++j) {
+#pragma GCC unroll 8
+            for (int r = 0; r < R; ++r) acc[r] = V::fmadd(V(rows[r] + j * V::kLanes), q[j], acc[r]);
+        }
+#pragma GCC unroll 2
+        for (int r = 0; r < R; r += 4) V::reduce_add4(acc[r], acc[r + 1], acc[r + 2], acc[r + 3], out + i + r);
+    }
+    for (; i < n; ++i) out[i] = InnerProductKernel<V>(BatchRow(base, ids, i, D), query, D);
+}
+
+template <class V, int R>
+inline void InnerProductBatchKernel(const float* base, const uint32_t* ids, size_t n,
+                                    const float* query, size_t vecdim, float* out) {
+    if (vecdim == 96) {
+        InnerProductBatchFixed<V, R, 96>(base, ids, n, query, out);
+        return;
+    }
+    size_t i = 0;
+    for (; i + R <= n; i += R) {
+        const float* rows[R];
+        for (int r = 0; r < R; ++r) rows[r] = BatchRow(base, ids, i + r, vecdim);
+        InnerProductRows<V, R>(rows, query, vecdim, out + i);
+    }
+    for (; i < n; ++i) out[i] = InnerProductKernel<V>(BatchRow(base, ids, i, vecdim), query, vecdim);
+}
+
+// GEMM式微内核：16行base按维度转置打包，每一维广播MR条query的一个分量与之相乘，
+// MR x 16个结果一直留在累加器里，没有横向规约；V必须是16路的封装
+template <class V, int MR>
+inline void InnerProductTileRows(const float* packed, const float* query, size_t vecdim, float* out) {
+    V acc[MR];
+    for (size_t d = 0; d < vecdim; ++d) {
+        V b(packed + d * kTileRows);
+#pragma GCC unroll 16
+        for (int m = 0; m < MR; ++m) acc[m] = V::fmadd(V(query[m * vecdim + d]), b, acc[m]);
+    }
+#pragma GCC unroll 16
+    for (int m = 0; m < MR; ++m) acc[m].storeu(out + m * kTileRows);
+}
+
+template <class V, int MR>
+inline void InnerProductTileKernel(const float* packed, const float* query, size_t nq, size_t vecdim, float* out) {
+    size_t q = 0;
+    for (; q + MR <= nq; q += MR) {
+        InnerProductTileRows<V, MR>(packed, query + q * vecdim, vecdim, out + q * kTileRows);
+    }
+    // 尾部先按2条一组，最后单条
+    for (; q + 2 <= nq; q += 2) {
+        InnerProductTileRows<V, 2>(packed, query + q * vecdim, vecdim, out + q * kTileRows);
+    }
+    if (q < nq) {
+        InnerProductTileRows<V, 1>(packed, query + q * vecdim, vecdim, out + q * kTileRows);
+    }
+}
+
+// 单条query与多组16行：NP组的累加器互不依赖，掩盖fma的延迟
+// （InnerProductTileRows<V, 1>每一维都要等上一次fma的结果）
+template <class V, int NP>
+inline void InnerProductPanelsKernel(const float* packed, size_t n_panels, const float* query, size_t vecdim, float* out) {
+    size_t panel = kTileRows * vecdim;
+    size_t p = 0;
+    for (; p + NP <= n_panels; p += NP) {
+        const float* base = packed + p * panel;
+        V acc[NP];
+        for (size_t d = 0; d < vecdim; ++d) {
+            V q(query[d]);
+#pragma GCC unroll 16
+            for (int i = 0; i < NP; ++i) acc[i] = V::fmadd(q, V(base + i * panel + d * kTileRows), acc[i]);
+        }
+#pragma GCC unroll 16
+        for (int i = 0; i < NP; ++i) acc[i].storeu(out + (p + i) * kTileRows);
+    }
+    for (; p < n_panels; ++p) InnerProductTileRows<V, 1>(packed + p * panel, query, vecdim, out + p * kTileRows);
+}
+
+// 8bit编码的多行内积：编码按V的路数载入后转成float，与权重fma；
+// 与InnerProductRows一样R行共用一次权重载入，vecdim不是路数倍数的部分逐个补上
+template <class V, int R>
+inline void SQ8InnerProductBatchKernel(const uint8_t* codes, size_t n, const float* weights, size_t vecdim, float* out) {
+    size_t body = vecdim / V::kLanes * V::kLanes;
+    size_t i = 0;
+    for (; i + R <= n; i += R) {
+        const uint8_t* rows = codes + i * vecdim;
+        V acc[R];
+        for (size_t d = 0; d < body; d += V::kLanes) {
+            V w(weights + d);
+#pragma GCC unroll 8
+            for (int r = 0; r < R; ++r) acc[r] = V::fmadd(V(rows + r * vecdim + d), w, acc[r]);
+        }
+#pragma GCC unroll 2
+        for (int r = 0; r < R; r += 4) V::reduce_add4(acc[r], acc[r + 1], acc[r + 2], acc[r + 3], out + i + r);
+        for (size_t d = body; d < vecdim; ++d) {
+            for (int r = 0; r < R; ++r) out[i + r] += weights[d] * rows[r * vecdim + d];
+        }
+    }
+    for (; i < n; ++i) {
+        const uint8_t* row = codes + i * vecdim;
+        V acc;
+        for (size_t d = 0; d < body; d += V::kLanes) acc = V::fmadd(V(row + d), V(weights + d), acc);
+        float sum = acc.reduce_add();
+        for (size_t d = body; d < vecdim; ++d) sum += weights[d] * row[d];
+        out[i] = sum;
+    }
+}
+
+// 8bit编码与int8权重的整数点积，D封装一条点积指令：每次D::kBytes维，load_query载入权重，
+// dot载入编码（必要时扩展）后乘加进int32累加器。寄存器都按引用传，模板本身不带target也不涉及向量传值。
+// D::kQueryOffset非0时点积指令是u8 x u8，权重被平移成query + kQueryOffset，
+// 结果要减掉kQueryOffset * Σcodes，Σcodes由code_sums给出
+template <class D, int R>
+inline void SQ8DotRows(const uint8_t* rows, const int32_t* code_sums, const int8_t* query, size_t vecdim, int32_t* out) {
+    size_t body = vecdim / D::kBytes * D::kBytes;
+    typename D::reg acc[R];
+#pragma GCC unroll 8
+    for (int r = 0; r < R; ++r) D::zero(acc[r]);
+    for (size_t d = 0; d < body; d += D::kBytes) {
+        typename D::qreg q;
+        D::load_query(q, query + d);
+#pragma GCC unroll 8
+        for (int r = 0; r < R; ++r) D::dot(acc[r], rows + r * vecdim + d, q);
+    }
+#pragma GCC unroll 2
+    for (int r = 0; r + 4 <= R; r += 4) D::reduce_add4(acc[r], acc[r + 1], acc[r + 2], acc[r + 3], out + r);
+    for (int r = R / 4 * 4; r < R; ++r) out[r] = D::reduce_add(acc[r]);
+    for (int r = 0; r < R; ++r) {
+        const uint8_t* row = rows + r * vecdim;
+        int32_t tail = 0, tail_sum = 0;
+        for (size_t d = body; d < vecdim; ++d) {
+            tail += query[d] * row[d];
+            tail_sum += row[d];
+        }
+        if (D::kQueryOffset != 0) out[r] -= D::kQueryOffset * (code_sums[r] - tail_sum);
+        out[r] += tail;
+    }
+}
+
+template <class D, int R>
+inline void SQ8DotBatchKernel(const uint8_t* codes, const int32_t* code_sums, size_t n, const int8_t* query,
+                              size_t vecdim, int32_t* out) {
+    size_t i = 0;
+    for (; i + R <= n; i += R) SQ8DotRows<D, R>(codes + i * vecdim, code_sums + i, query, vecdim, out + i);
+    for (; i < n; ++i) SQ8DotRows<D, 1>(codes + i * vecdim, code_sums + i, query, vecdim, out + i);
+}
+
+inline float inner_product_scalar(const float* a, const float* b, size_t vecdim) {
+    float dis = 0;
+    for (size_t d = 0; d < vecdim; ++d) {
+        dis += a[d] * b[d];
+    }
+    return dis;
+}
+
+inline void inner_product_batch_scalar(const float* base, const uint32_t* ids, size_t n,
+                                       const float* query, size_t vecdim, float* out) {
+    for (size_t i = 0; i < n; ++i) out[i] = inner_product_scalar(BatchRow(base, ids, i, vecdim), query, vecdim);
+}
+
+inline void inner_product_tile_scalar(const float* packed, const float* query, size_t nq, size_t vecdim, float* out) {
+    for (size_t q = 0; q < nq; ++q) {
+        float* o = out + q * kTileRows;
+        for (size_t r = 0; r < kTileRows; ++r) o[r] = 0;
+        for (size_t d = 0; d < vecdim; ++d) {
+            for (size_t r = 0; r < kTileRows; ++r) o[r] += query[q * vecdim + d] * packed[d * kTileRows + r];
+        }
+    }
+}
+
+inline void inner_product_panels_scalar(const float* packed, size_t n_panels, const float* query, size_t vecdim, float* out) {
+    for (size_t p = 0; p < n_panels; ++p) inner_product_tile_scalar(packed + p * kTileRows * vecdim, query, 1, vecdim, out + p * kTileRows);
+}
+
+inline void sq8_inner_product_batch_scalar(const uint8_t* codes, size_t n, const float* weights, size_t vecdim,
+                                           float* out) {
+    for (size_t i = 0; i < n; ++i) {
+        float sum = 0;
+        for (size_t d = 0; d < vecdim; ++d) sum += weights[d] * codes[i * vecdim + d];
+        out[i] = sum;
+    }
+}
+
+inline void sq8_dot_batch_scalar(const uint8_t* codes, const int32_t* code_sums, size_t n, const int8_t* query,
+                                 size_t vecdim, int32_t* out) {
+    for (size_t i = 0; i < n; ++i) {
+        int32_t sum = 0;
+        for (size_t d = 0; d < vecdim; ++d) sum += query[d] * codes[i * vecdim + d];
+        out[i] = sum;
+    }
+}
+
+inline void lut16_scan_scalar(const uint8_t* codes, size_t n_blocks, const uint8_t* tables, size_t nsub, uint16_t* out) {
+    for (size_t b = 0; b < n_blocks; ++b) {
+        uint32_t acc[kFastScanBlock] = {0};
+        for (size_t p = 0; p < nsub / 2; ++p) {
+            const uint8_t* c = codes + (b * (nsub / 2) + p) * kFastScanBlock;
+            for (size_t l = 0; l < kFastScanBlock; ++l) {
+                acc[l] += tables[2 * p * 16 + (c[l] & 0x0F)] + tables[(2 * p + 1) * 16 + (c[l] >> 4)];
+            }
+        }
+        for (size_t l = 0; l < kFastScanBlock; ++l) out[b * kFastScanBlock + l] = acc[l] < 65535 ? acc[l] : 65535;
+    }
+}
+
+// 没有gather指令的后端（标量、SSE4、NEON）共用：每段逐通道取表项，16个通道的累加互不依赖
+inline void pq_adc_scan_scalar(const uint8_t* codes, size_t n_blocks, const float* lut, size_t nsub, size_t ksub, float* out) {
+    for (size_t b = 0; b < n_blocks; ++b) {
+        float acc[kPQBlock] = {0};
+        for (size_t j = 0; j < nsub; ++j) {
+            const uint8_t* c = codes + (b * nsub + j) * kPQBlock;
+            const float* t = lut + j * ksub;
+            for (size_t l = 0; l < kPQBlock; ++l) acc[l] += t[c[l]];
+        }
+        for (size_t l = 0; l < kPQBlock; ++l) out[b * kPQBlock + l] = acc[l];
+    }
+}
+
+inline size_t filter_u16_ge_scalar(const uint16_t* scores, size_t n, uint16_t threshold, uint32_t id0,
+                                   uint16_t* out_scores, uint32_t* out_ids) {
+    size_t cnt = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (scores[i] >= threshold) {
+            out_scores[cnt] = scores[i];
+            out_ids[cnt++] = id0 + i;
+        }
+    }
+    return cnt;
+}
+
+// 比较得到的位掩码中每个通道占bits_per_lane位，逐个取出置位的通道写出
+inline size_t filter_emit_mask(uint64_t mask, int bits_per_lane, const uint16_t* scores, uint32_t id0,
+                               uint16_t* out_scores, uint32_t* out_ids) {
+    size_t cnt = 0;
+    while (mask) {
+        int l = __builtin_ctzll(mask) / bits_per_lane;
+        out_scores[cnt] = scores[l];
+        out_ids[cnt++] = id0 + l;
+        mask &= mask - 1;
+    }
+    return cnt;
+}
+
+#ifdef ANN_SIMD_NEON
+inline float inner_product8_neon(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd8float32>(a, b, vecdim);
+}
+
+inline float inner_product16_neon(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd16float32>(a, b, vecdim);
+}
+
+// NEON有32个寄存器，96维query占24个，4行一组时累加器正好放得下
+inline void inner_product_batch_neon(const float* base, const uint32_t* ids, size_t n,
+                                     const float* query, size_t vecdim, float* out) {
+    InnerProductBatchKernel<simd8float32, 4>(base, ids, n, query, vecdim, out);
+}
+
+// 16路占4个q寄存器，6条query的累加器共24个，加上base和广播值正好在32个以内
+inline void inner_product_tile_neon(const float* packed, const float* query, size_t nq, size_t vecdim, float* out) {
+    InnerProductTileKernel<simd16float32, 6>(packed, query, nq, vecdim, out);
+}
+
+// 4组共16个累加器
+inline void inner_product_panels_neon(const float* packed, size_t n_panels, const float* query, size_t vecdim, float* out) {
+    InnerProductPanelsKernel<simd16float32, 4>(packed, n_panels, query, vecdim, out);
+}
+
+inline void sq8_inner_product_batch_neon(const uint8_t* codes, size_t n, const float* weights, size_t vecdim,
+                                         float* out) {
+    SQ8InnerProductBatchKernel<simd8float32, 4>(codes, n, weights, vecdim, out);
+}
+
+// SQ8DotRows的NEON实现：每次8维，编码和权重都扩展成s16后vmlal乘加到int32
+struct sq8dot_neon {
+    typedef int32x4_t reg;
+    typedef int16x8_t qreg;
+    static const int kBytes = 8;
+    static const int kQueryOffset = 0;
+
+    static void zero(reg& a) { a = vdupq_n_s32(0); }
+    static void load_query(qreg& q, const int8_t* p) { q = vmovl_s8(vld1_s8(p)); }
+    static void dot(reg& acc, const uint8_t* p, const qreg& q) {
+        int16x8_t c = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p)));
+        acc = vmlal_high_s16(vmlal_s16(acc, vget_low_s16(c), vget_low_s16(q)), c, q);
+    }
+    static int32_t reduce_add(const reg& a) { return vaddvq_s32(a); }
+    static void reduce_add4(const reg& a, const reg& b, const reg& c, const reg& d, int32_t* out) {
+        vst1q_s32(out, vpaddq_s32(vpaddq_s32(a, b), vpaddq_s32(c, d)));
+    }
+};
+
+inline void sq8_dot_batch_neon(const uint8_t* codes, const int32_t* code_sums, size_t n, const int8_t* query,
+                               size_t vecdim, int32_t* out) {
+    SQ8DotBatchKernel<sq8dot_neon, 4>(codes, code_sums, n, query, vecdim, out);
+}
+
+#ifdef ANN_SIMD_NEON_DOTPROD
+// udot只有u8 x u8：权重翻转最高位即加上128变成u8，一条指令做16维，结果减去128 * Σcodes
+struct sq8dot_neon_udot {
+    typedef uint32x4_t reg;
+    typedef uint8x16_t qreg;
+    static const int kBytes = 16;
+    static const int kQueryOffset = 128;
+
+    ANN_TARGET_NEON_DOTPROD static void zero(reg& a) { a = vdupq_n_u32(0); }
+    ANN_TARGET_NEON_DOTPROD static void load_query(qreg& q, const int8_t* p) {
+        q = veorq_u8(vreinterpretq_u8_s8(vld1q_s8(p)), vdupq_n_u8(0x80));
+    }
+    ANN_TARGET_NEON_DOTPROD static void dot(reg& acc, const uint8_t* p, const qreg& q) { acc = vdotq_u32(acc, vld1q_u8(p), q); }
+    ANN_TARGET_NEON_DOTPROD static int32_t reduce_add(const reg& a) { return (int32_t)vaddvq_u32(a); }
+    ANN_TARGET_NEON_DOTPROD static void reduce_add4(const reg& a, const reg& b, const reg& c, const reg& d, int32_t* out) {
+        vst1q_s32(out, vreinterpretq_s32_u32(vpaddq_u32(vpaddq_u32(a, b), vpaddq_u32(c, d))));
+    }
+};
+
+ANN_KERNEL_NEON_DOTPROD inline void sq8_dot_batch_neon_udot(const uint8_t* codes, const int32_t* code_sums, size_t n,
+                                                            const int8_t* query, size_t vecdim, int32_t* out) {
+    SQ8DotBatchKernel<sq8dot_neon_udot, 4>(codes, code_sums, n, query, vecdim, out);
+}
+#endif
+
+// 每组32字节分两个q寄存器，低/高4位各查一次表，4个u16x8累加器覆盖32条向量
+inline void lut16_scan_neon(const uint8_t* codes, size_t n_blocks, const uint8_t* tables, size_t nsub, uint16_t* out) {
+    uint8x16_t mask = vdupq_n_u8(0x0F);
+    for (size_t b = 0; b < n_blocks; ++b) {
+        uint16x8_t acc[4] = {vdupq_n_u16(0), vdupq_n_u16(0), vdupq_n_u16(0), vdupq_n_u16(0)};
+        for (size_t p = 0; p < nsub / 2; ++p) {
+            const uint8_t* c = codes + (b * (nsub / 2) + p) * kFastScanBlock;
+            uint8x16_t t_lo = vld1q_u8(tables + 2 * p * 16), t_hi = vld1q_u8(tables + (2 * p + 1) * 16);
+            for (int h = 0; h < 2; ++h) {
+                uint8x16_t v = vld1q_u8(c + h * 16);
+                uint8x16_t r0 = vqtbl1q_u8(t_lo, vandq_u8(v, mask));
+                uint8x16_t r1 = vqtbl1q_u8(t_hi, vshrq_n_u8(v, 4));
+                uint16x8_t s_lo = vaddl_u8(vget_low_u8(r0), vget_low_u8(r1));
+                uint16x8_t s_hi = vaddl_u8(vget_high_u8(r0), vget_high_u8(r1));
+                acc[2 * h] = vqaddq_u16(acc[2 * h], s_lo);
+                acc[2 * h + 1] = vqaddq_u16(acc[2 * h + 1], s_hi);
+            }
+        }
+        for (int i = 0; i < 4; ++i) vst1q_u16(out + b * kFastScanBlock + i * 8, acc[i]);
+    }
+}
+
+// 8个u16比较后窄化成每通道8位的64位掩码
+inline size_t filter_u16_ge_neon(const uint16_t* scores, size_t n, uint16_t threshold, uint32_t id0,
+                                 uint16_t* out_scores, uint32_t* out_ids) {
+    uint16x8_t thr = vdupq_n_u16(threshold);
+    size_t cnt = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint16x8_t ge = vcgeq_u16(vld1q_u16(scores + i), thr);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(ge)), 0);
+        if (mask) cnt += filter_emit_mask(mask & 0x0101010101010101ull, 8, scores + i, id0 + i, out_scores + cnt, out_ids + cnt);
+    }
+    return cnt + filter_u16_ge_scalar(scores + i, n - i, threshold, id0 + i, out_scores + cnt, out_ids + cnt);
+}
+#endif
+
+#ifdef ANN_SIMD_X86
+ANN_KERNEL_SSE4 inline float inner_product8_sse4(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd8float32>(a, b, vecdim);
+}
+
+ANN_KERNEL_SSE4 inline float inner_product16_sse4(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd16float32>(a, b, vecdim);
+}
+
+ANN_KERNEL_SSE4 inline void inner_product_batch_sse4(const float* base, const uint32_t* ids, size_t n,
+                                                     const float* query, size_t vecdim, float* out) {
+    InnerProductBatchKernel<simd8float32, 4>(base, ids, n, query, vecdim, out);
+}
+
+// SSE只有16个xmm，16路占4个，2条query一组
+ANN_KERNEL_SSE4 inline void inner_product_tile_sse4(const float* packed, const float* query, size_t nq,
+                                                    size_t vecdim, float* out) {
+    InnerProductTileKernel<simd16float32, 2>(packed, query, nq, vecdim, out);
+}
+
+ANN_KERNEL_SSE4 inline void inner_product_panels_sse4(const float* packed, size_t n_panels, const float* query,
+                                                      size_t vecdim, float* out) {
+    InnerProductPanelsKernel<simd16float32, 2>(packed, n_panels, query, vecdim, out);
+}
+
+ANN_KERNEL_SSE4 inline void sq8_inner_product_batch_sse4(const uint8_t* codes, size_t n, const float* weights,
+                                                         size_t vecdim, float* out) {
+    SQ8InnerProductBatchKernel<simd8float32, 4>(codes, n, weights, vecdim, out);
+}
+
+// SQ8DotRows的SSE4实现：每次8维，扩展成i16后用madd，两两相加成4个int32
+struct sq8dot_sse4 {
+    typedef __m128i reg;
+    typedef __m128i qreg;
+    static const int kBytes = 8;
+    static const int kQueryOffset = 0;
+
+    ANN_TARGET_SSE4 static void zero(reg& a) { a = _mm_setzero_si128(); }
+    ANN_TARGET_SSE4 static void load_query(qreg& q, const int8_t* p) { q = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)p)); }
+    ANN_TARGET_SSE4 static void dot(reg& acc, const uint8_t* p, const qreg& q) {
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)p)), q));
+    }
+    ANN_TARGET_SSE4 static int32_t reduce_add(const reg& a) {
+        __m128i s = _mm_add_epi32(a, _mm_shuffle_epi32(a, 0x4E));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+        return _mm_cvtsi128_si32(s);
+    }
+    ANN_TARGET_SSE4 static void reduce_add4(const reg& a, const reg& b, const reg& c, const reg& d, int32_t* out) {
+        _mm_storeu_si128((__m128i*)out, _mm_hadd_epi32(_mm_hadd_epi32(a, b), _mm_hadd_epi32(c, d)));
+    }
+};
+
+ANN_KERNEL_SSE4 inline void sq8_dot_batch_sse4(const uint8_t* codes, const int32_t* code_sums, size_t n,
+                                               const int8_t* query, size_t vecdim, int32_t* out) {
+    SQ8DotBatchKernel<sq8dot_sse4, 4>(codes, code_sums, n, query, vecdim, out);
+}
+
+// pshufb查表。查出的16个u8按u16看，低字节是偶数号向量、高字节是奇数号向量，
+// 分别用and/移位取出后饱和累加，省掉逐字节的展开，最后再交织回原顺序
+ANN_KERNEL_SSE4 inline void lut16_scan_sse4(const uint8_t* codes, size_t n_blocks, const uint8_t* tables, size_t nsub, uint16_t* out) {
+    __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i low_byte = _mm_set1_epi16(0x00FF);
+    for (size_t b = 0; b < n_blocks; ++b) {
+        __m128i even[2] = {_mm_setzero_si128(), _mm_setzero_si128()};
+        __m128i odd[2] = {_mm_setzero_si128(), _mm_setzero_si128()};
+        for (size_t p = 0; p < nsub / 2; ++p) {
+            const uint8_t* c = codes + (b * (nsub / 2) + p) * kFastScanBlock;
+            __m128i t_lo = _mm_loadu_si128((const __m128i*)(tables + 2 * p * 16));
+            __m128i t_hi = _mm_loadu_si128((const __m128i*)(tables + (2 * p + 1) * 16));
+            for (int h = 0; h < 2; ++h) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(c + h * 16));
+                __m128i r0 = _mm_shuffle_epi8(t_lo, _mm_and_si128(v, mask));
+                __m128i r1 = _mm_shuffle_epi8(t_hi, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+                even[h] = _mm_adds_epu16(even[h], _mm_and_si128(r0, low_byte));
+                even[h] = _mm_adds_epu16(even[h], _mm_and_si128(r1, low_byte));
+                odd[h] = _mm_adds_epu16(odd[h], _mm_srli_epi16(r0, 8));
+                odd[h] = _mm_adds_epu16(odd[h], _mm_srli_epi16(r1, 8));
+            }
+        }
+        for (int h = 0; h < 2; ++h) {
+            _mm_storeu_si128((__m128i*)(out + b * kFastScanBlock + h * 16), _mm_unpacklo_epi16(even[h], odd[h]));
+            _mm_storeu_si128((__m128i*)(out + b * kFastScanBlock + h * 16 + 8), _mm_unpackhi_epi16(even[h], odd[h]));
+        }
+    }
+}
+
+// 无符号比较：x >= t 等价于 max(x, t) == x
+ANN_KERNEL_SSE4 inline size_t filter_u16_ge_sse4(const uint16_t* scores, size_t n, uint16_t threshold, uint32_t id0,
+                                                 uint16_t* out_scores, uint32_t* out_ids) {
+    __m128i thr = _mm_set1_epi16((short)threshold);
+    size_t cnt = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(scores + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_max_epu16(x, thr), x));
+        if (mask) cnt += filter_emit_mask(mask & 0x5555, 2, scores + i, id0 + i, out_scores + cnt, out_ids + cnt);
+    }
+    return cnt + filter_u16_ge_scalar(scores + i, n - i, threshold, id0 + i, out_scores + cnt, out_ids + cnt);
+}
+
+// 每段16字节编码扩展成两组8个32位下标，直接从float表gather
+ANN_KERNEL_AVX2 inline void pq_adc_scan_avx2(const uint8_t* codes, size_t n_blocks, const float* lut, size_t nsub, size_t ksub, float* out) {
+    for (size_t b = 0; b < n_blocks; ++b) {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        for (size_t j = 0; j < nsub; ++j) {
+            __m128i c = _mm_loadu_si128((const __m128i*)(codes + (b * nsub + j) * kPQBlock));
+            const float* t = lut + j * ksub;
+            acc0 = _mm256_add_ps(acc0, _mm256_i32gather_ps(t, _mm256_cvtepu8_epi32(c), 4));
+            acc1 = _mm256_add_ps(acc1, _mm256_i32gather_ps(t, _mm256_cvtepu8_epi32(_mm_unpackhi_epi64(c, c)), 4));
+        }
+        _mm256_storeu_ps(out + b * kPQBlock, acc0);
+        _mm256_storeu_ps(out + b * kPQBlock + 8, acc1);
+    }
+}
+
+ANN_KERNEL_AVX2 inline float inner_product8_avx2(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd8float32_avx2>(a, b, vecdim);
+}
+
+ANN_KERNEL_AVX2 inline float inner_product16_avx2(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd16float32_avx2>(a, b, vecdim);
+}
+
+ANN_KERNEL_AVX2 inline void inner_product_batch_avx2(const float* base, const uint32_t* ids, size_t n,
+                                                     const float* query, size_t vecdim, float* out) {
+    InnerProductBatchKernel<simd8float32_avx2, 4>(base, ids, n, query, vecdim, out);
+}
+
+// 6x16的经典sgemm微内核：12个ymm累加器 + 2个base + 1个广播
+ANN_KERNEL_AVX2 inline void inner_product_tile_avx2(const float* packed, const float* query, size_t nq,
+                                                    size_t vecdim, float* out) {
+    InnerProductTileKernel<simd16float32_avx2, 6>(packed, query, nq, vecdim, out);
+}
+
+// 4组共8个ymm累加器
+ANN_KERNEL_AVX2 inline void inner_product_panels_avx2(const float* packed, size_t n_panels, const float* query,
+                                                      size_t vecdim, float* out) {
+    InnerProductPanelsKernel<simd16float32_avx2, 4>(packed, n_panels, query, vecdim, out);
+}
+
+ANN_KERNEL_AVX2 inline void sq8_inner_product_batch_avx2(const uint8_t* codes, size_t n, const float* weights,
+                                                         size_t vecdim, float* out) {
+    SQ8InnerProductBatchKernel<simd8float32_avx2, 8>(codes, n, weights, vecdim, out);
+}
+
+// SQ8DotRows的AVX2实现：每次16维扩展成i16后madd。VNNI的版本只换掉权重载入和乘加
+struct sq8dot_avx2 {
+    typedef __m256i reg;
+    typedef __m256i qreg;
+    static const int kBytes = 16;
+    static const int kQueryOffset = 0;
+
+    ANN_TARGET_AVX2 static void zero(reg& a) { a = _mm256_setzero_si256(); }
+    ANN_TARGET_AVX2 static void load_query(qreg& q, const int8_t* p) {
+        q = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)p));
+    }
+    ANN_TARGET_AVX2 static void dot(reg& acc, const uint8_t* p, const qreg& q) {
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p)), q));
+    }
+    ANN_TARGET_AVX2 static int32_t reduce_add(const reg& a) {
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+        return sq8dot_sse4::reduce_add(s);
+    }
+    // hadd在两个128位通道内各做一遍，得到[a b c d]的低半和高半，相加即是4行的和
+    ANN_TARGET_AVX2 static void reduce_add4(const reg& a, const reg& b, const reg& c, const reg& d, int32_t* out) {
+        __m256i t = _mm256_hadd_epi32(_mm256_hadd_epi32(a, b), _mm256_hadd_epi32(c, d));
+        _mm_storeu_si128((__m128i*)out, _mm_add_epi32(_mm256_castsi256_si128(t), _mm256_extracti128_si256(t, 1)));
+    }
+};
+
+ANN_KERNEL_AVX2 inline void sq8_dot_batch_avx2(const uint8_t* codes, const int32_t* code_sums, size_t n,
+                                               const int8_t* query, size_t vecdim, int32_t* out) {
+    SQ8DotBatchKernel<sq8dot_avx2, 8>(codes, code_sums, n, query, vecdim, out);
+}
+
+#ifdef ANN_SIMD_AVXVNNI
+// vpdpbusd：u8 x s8每4个字节乘加进一个int32，一条指令做32维
+struct sq8dot_avxvnni : sq8dot_avx2 {
+    static const int kBytes = 32;
+
+    ANN_TARGET_AVXVNNI static void load_query(qreg& q, const int8_t* p) { q = _mm256_loadu_si256((const __m256i*)p); }
+    ANN_TARGET_AVXVNNI static void dot(reg& acc, const uint8_t* p, const qreg& q) {
+        acc = _mm256_dpbusd_avx_epi32(acc, _mm256_loadu_si256((const __m256i*)p), q);
+    }
+};
+
+ANN_KERNEL_AVXVNNI inline void sq8_dot_batch_avxvnni(const uint8_t* codes, const int32_t* code_sums, size_t n,
+                                                     const int8_t* query, size_t vecdim, int32_t* out) {
+    SQ8DotBatchKernel<sq8dot_avxvnni, 8>(codes, code_sums, n, query, vecdim, out);
+}
+#endif
+
+// 一组32字节正好一个ymm，表广播到两个128位通道
+ANN_KERNEL_AVX2 inline void lut16_scan_avx2(const uint8_t* codes, size_t n_blocks, const uint8_t* tables, size_t nsub, uint16_t* out) {
+    __m256i mask = _mm256_set1_epi8(0x0F);
+    __m256i low_byte = _mm256_set1_epi16(0x00FF);
+    for (size_t b = 0; b < n_blocks; ++b) {
+        __m256i even = _mm256_setzero_si256(), odd = _mm256_setzero_si256();
+        for (size_t p = 0; p < nsub / 2; ++p) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(codes + (b * (nsub / 2) + p) * kFastScanBlock));
+            __m256i t_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(tables + 2 * p * 16)));
+            __m256i t_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(tables + (2 * p + 1) * 16)));
+            __m256i r0 = _mm256_shuffle_epi8(t_lo, _mm256_and_si256(v, mask));
+            __m256i r1 = _mm256_shuffle_epi8(t_hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+            even = _mm256_adds_epu16(even, _mm256_and_si256(r0, low_byte));
+            even = _mm256_adds_epu16(even, _mm256_and_si256(r1, low_byte));
+            odd = _mm256_adds_epu16(odd, _mm256_srli_epi16(r0, 8));
+            odd = _mm256_adds_epu16(odd, _mm256_srli_epi16(r1, 8));
+        }
+        // unpack在每个128位通道内交织：lo为向量0-7和16-23，hi为8-15和24-31
+        __m256i lo = _mm256_unpacklo_epi16(even, odd), hi = _mm256_unpackhi_epi16(even, odd);
+        _mm256_storeu_si256((__m256i*)(out + b * kFastScanBlock), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + b * kFastScanBlock + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+}
+
+ANN_KERNEL_AVX2 inline size_t filter_u16_ge_avx2(const uint16_t* scores, size_t n, uint16_t threshold, uint32_t id0,
+                                                 uint16_t* out_scores, uint32_t* out_ids) {
+    __m256i thr = _mm256_set1_epi16((short)threshold);
+    size_t cnt = 0, i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(scores + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_max_epu16(x, thr), x));
+        if (mask) cnt += filter_emit_mask(mask & 0x55555555u, 2, scores + i, id0 + i, out_scores + cnt, out_ids + cnt);
+    }
+    return cnt + filter_u16_ge_scalar(scores + i, n - i, threshold, id0 + i, out_scores + cnt, out_ids + cnt);
+}
+
+ANN_KERNEL_AVX512 inline float inner_product8_avx512(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd8float32_avx2>(a, b, vecdim);
+}
+
+ANN_KERNEL_AVX512 inline float inner_product16_avx512(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd16float32_avx512>(a, b, vecdim);
+}
+
+// 96维query只占6个zmm；实测8行一组时行指针计算被向量化反而更慢，与AVX2一样取4行
+ANN_KERNEL_AVX512 inline void inner_product_batch_avx512(const float* base, const uint32_t* ids, size_t n,
+                                                         const float* query, size_t vecdim, float* out) {
+    if (vecdim % 16 == 0) {
+        InnerProductBatchKernel<simd16float32_avx512, 4>(base, ids, n, query, vecdim, out);
+    } else {
+        InnerProductBatchKernel<simd8float32_avx2, 4>(base, ids, n, query, vecdim, out);
+    }
+}
+// 16路只占1个zmm，8条query一组；试过12条，实测没有更快
+ANN_KERNEL_AVX512 inline void inner_product_tile_avx512(const float* packed, const float* query, size_t nq,
+                                                        size_t vecdim, float* out) {
+    InnerProductTileKernel<simd16float32_avx512, 8>(packed, query, nq, vecdim, out);
+}
+
+ANN_KERNEL_AVX512 inline void inner_product_panels_avx512(const float* packed, size_t n_panels, const float* query,
+                                                          size_t vecdim, float* out) {
+    InnerProductPanelsKernel<simd16float32_avx512, 8>(packed, n_panels, query, vecdim, out);
+}
+
+// 实测zmm上的cvtepu8反而比两条ymm慢，与AVX2用同一版
+ANN_KERNEL_AVX512 inline void sq8_inner_product_batch_avx512(const uint8_t* codes, size_t n, const float* weights,
+                                                             size_t vecdim, float* out) {
+    SQ8InnerProductBatchKernel<simd8float32_avx2, 8>(codes, n, weights, vecdim, out);
+}
+
+// EVEX编码的vpdpbusd，同样只用ymm：96维一行是3个ymm，用zmm反而要拆出尾部
+struct sq8dot_avx512vnni : sq8dot_avx2 {
+    static const int kBytes = 32;
+
+    ANN_TARGET_AVX512VNNI static void load_query(qreg& q, const int8_t* p) { q = _mm256_loadu_si256((const __m256i*)p); }
+    ANN_TARGET_AVX512VNNI static void dot(reg& acc, const uint8_t* p, const qreg& q) {
+        acc = _mm256_dpbusd_epi32(acc, _mm256_loadu_si256((const __m256i*)p), q);
+    }
+};
+
+ANN_KERNEL_AVX512VNNI inline void sq8_dot_batch_avx512vnni(const uint8_t* codes, const int32_t* code_sums, size_t n,
+                                                           const int8_t* query, size_t vecdim, int32_t* out) {
+    SQ8DotBatchKernel<sq8dot_avx512vnni, 8>(codes, code_sums, n, query, vecdim, out);
+}
+
+// 16个分数扩展成32位后比较，用压缩存储一次写出所有通过的id和分数
+ANN_KERNEL_AVX512 inline size_t filter_u16_ge_avx512(const uint16_t* scores, size_t n, uint16_t threshold, uint32_t id0,
+                                                     uint16_t* out_scores, uint32_t* out_ids) {
+    __m512i thr = _mm512_set1_epi32(threshold);
+    __m512i ids = _mm512_add_epi32(_mm512_set1_epi32(id0), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    __m512i step = _mm512_set1_epi32(16);
+    size_t cnt = 0, i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i x = _mm512_maskz_cvtepu16_epi32(0xFFFF, _mm256_loadu_si256((const __m256i*)(scores + i)));
+        __mmask16 mask = _mm512_cmpge_epu32_mask(x, thr);
+        if (mask) {
+            int c = __builtin_popcount(mask);
+            _mm512_mask_compressstoreu_epi32(out_ids + cnt, mask, ids);
+            _mm512_mask_cvtepi32_storeu_epi16(out_scores + cnt, (__mmask16)((1u << c) - 1), _mm512_maskz_compress_epi32(mask, x));
+            cnt += c;
+        }
+        ids = _mm512_add_epi32(ids, step);
+    }
+    return cnt + filter_u16_ge_scalar(scores + i, n - i, threshold, id0 + i, out_scores + cnt, out_ids + cnt);
+}
+
+// 一块16条向量正好一个zmm，每段一次gather
+ANN_KERNEL_AVX512 inline void pq_adc_scan_avx512(const uint8_t* codes, size_t n_blocks, const float* lut, size_t nsub, size_t ksub, float* out) {
+    for (size_t b = 0; b < n_blocks; ++b) {
+        __m512 acc = _mm512_setzero_ps();
+        for (size_t j = 0; j < nsub; ++j) {
+            __m128i c = _mm_loadu_si128((const __m128i*)(codes + (b * nsub + j) * kPQBlock));
+            __m512i idx = _mm512_maskz_cvtepu8_epi32(0xFFFF, c);
+            acc = _mm512_add_ps(acc, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, idx, lut + j * ksub, 4));
+        }
+        _mm512_storeu_ps(out + b * kPQBlock, acc);
+    }
+}
+#endif
+
+// ------------------------------- 函数表 -------------------------------
+
+// 整数点积在同一级别内再按CPU特性选一次：x86有VNNI时用vpdpbusd，ARM支持udot时用vdotq_u32
+typedef void (*SQ8DotBatchFn)(const uint8_t* codes, const int32_t* code_sums, size_t n, const int8_t* query,
+                              size_t vecdim, int32_t* out);
+
+inline SQ8DotBatchFn sq8_dot_batch_for(SimdLevel level) {
+    switch (level) {
+#ifdef ANN_SIMD_NEON
+    case SIMD_NEON:
+#ifdef ANN_SIMD_NEON_DOTPROD
+        if (SimdNeonDotProdCapable()) return sq8_dot_batch_neon_udot;
+#endif
+        return sq8_dot_batch_neon;
+#endif
+#ifdef ANN_SIMD_X86
+    case SIMD_SSE4:
+        return sq8_dot_batch_sse4;
+    case SIMD_AVX512:
+        if (SimdAVX512VNNICapable()) return sq8_dot_batch_avx512vnni;
+        // fall through
+    case SIMD_AVX2:
+#ifdef ANN_SIMD_AVXVNNI
+        if (SimdAVXVNNICapable()) return sq8_dot_batch_avxvnni;
+#endif
+        return sq8_dot_batch_avx2;
+#endif
+    default:
+        return sq8_dot_batch_scalar;
+    }
+}
+
+// 返回指定后端的函数表，当前CPU不支持时返回nullptr
+inline const SimdKernels* simd_kernels_for(SimdLevel level) {
+    if (!simd_level_supported(level)) return nullptr;
+
+    static const SimdKernels scalar = {
+        SIMD_SCALAR, "scalar", inner_product_scalar, inner_product_scalar, lut16_scan_scalar,
+        filter_u16_ge_scalar, inner_product_batch_scalar, inner_product_tile_scalar, pq_adc_scan_scalar,
+        inner_product_panels_scalar, sq8_inner_product_batch_scalar,
+        sq8_dot_batch_for(SIMD_SCALAR)};
+#ifdef ANN_SIMD_NEON
+    static const SimdKernels neon = {
+        SIMD_NEON, "neon", inner_product8_neon, inner_product16_neon, lut16_scan_neon,
+        filter_u16_ge_neon, inner_product_batch_neon, inner_product_tile_neon, pq_adc_scan_scalar,
+        inner_product_panels_neon, sq8_inner_product_batch_neon,
+        sq8_dot_batch_for(SIMD_NEON)};
+#endif
+#ifdef ANN_SIMD_X86
+    static const SimdKernels sse4 = {
+        SIMD_SSE4, "sse4", inner_product8_sse4, inner_product16_sse4, lut16_scan_sse4,
+        filter_u16_ge_sse4, inner_product_batch_sse4, inner_product_tile_sse4, pq_adc_scan_scalar,
+        inner_product_panels_sse4, sq8_inner_product_batch_sse4,
+        sq8_dot_batch_for(SIMD_SSE4)};
+    static const SimdKernels avx2 = {
+        SIMD_AVX2, "avx2", inner_product8_avx2, inner_product16_avx2, lut16_scan_avx2,
+        filter_u16_ge_avx2, inner_product_batch_avx2, inner_product_tile_avx2, pq_adc_scan_avx2,
+        inner_product_panels_avx2, sq8_inner_product_batch_avx2,
+        sq8_dot_batch_for(SIMD_AVX2)};
+    static const SimdKernels avx512 = {
+        SIMD_AVX512, "avx512", inner_product8_avx512, inner_product16_avx512, lut16_scan_avx2,
+        filter_u16_ge_avx512, inner_product_batch_avx512, inner_product_tile_avx512, pq_adc_scan_avx512,
+        inner_product_panels_avx512, sq8_inner_product_batch_avx512,
+        sq8_dot_batch_for(SIMD_AVX512)};
+#endif
+
+    switch (level) {
+#ifdef ANN_SIMD_NEON
+    case SIMD_NEON: return &neon;
+#endif
+#ifdef ANN_SIMD_X86
+    case SIMD_SSE4: return &sse4;
+    case SIMD_AVX2: return &avx2;
+    case SIMD_AVX512: return &avx512;
+#endif
+    default: return &scalar;
+    }
+}
+
+inline SimdLevel simd_select_level() {
+    SimdLevel best = simd_best_level();
+    const char* env = std::getenv("ANN_SIMD");
+    if (env == nullptr) return best;
+
+    for (int l = 0; l < SIMD_LEVEL_COUNT; ++l) {
+        if (std::strcmp(env, simd_level_name((SimdLevel)l)) == 0) {
+            if (simd_level_supported((SimdLevel)l)) return (SimdLevel)l;
+            break;
+        }
+    }
+    std::cerr << "ANN_SIMD=" << env << " not available, use " << simd_level_name(best) << "\n";
+    return best;
+}
+
+// 当前进程使用的函数表，第一次调用时完成检测
+inline const SimdKernels& simd_kernels() {
+    static const SimdKernels* kernels = simd_kernels_for(simd_select_level());
+    return *kernels;
+}
+
+// 分派后的内积，维度是16的倍数时走16路版本
+inline float InnerProductSIMD(const float* a, const float* b, size_t vecdim) {
+    assert(vecdim % 8 == 0);
+#ifdef ANN_SIMD_NEON
+    // ARM上只有NEON一个后端，直接内联调用
+    return vecdim % 16 == 0 ? inner_product16_neon(a, b, vecdim) : inner_product8_neon(a, b, vecdim);
+#else
+    const SimdKernels& kernels = simd_kernels();
+    return vecdim % 16 == 0 ? kernels.inner_product16(a, b, vecdim) : kernels.inner_product8(a, b, vecdim);
+#endif
+}
+
+// 连续n行（base[0..n)）与query的内积，结果写入out
+inline void InnerProductBatch(const float* base, const float* query, size_t n, size_t vecdim, float* out) {
+    assert(vecdim % 8 == 0);
+#ifdef ANN_SIMD_NEON
+    inner_product_batch_neon(base, nullptr, n, query, vecdim, out);
+#else
+    simd_kernels().inner_product_batch(base, nullptr, n, query, vecdim, out);
+#endif
+}
+
+// 按id取行的版本，用于重排和候选列表
+inline void InnerProductBatchIds(const float* base, const uint32_t* ids, size_t n,
+                                 const float* query, size_t vecdim, float* out) {
+    assert(vecdim % 8 == 0);
+#ifdef ANN_SIMD_NEON
+    inner_product_batch_neon(base, ids, n, query, vecdim, out);
+#else
+    simd_kernels().inner_product_batch(base, ids, n, query, vecdim, out);
+#endif
+}
+
+// 把base中从rows开始的至多16行转置打包成[vecdim][16]，不足16行的部分补0
+inline void PackTileRows(const float* rows, size_t n, size_t vecdim, float* packed) {
+    for (size_t d = 0; d < vecdim; ++d) {
+        for (size_t r = 0; r < kTileRows; ++r) {
+            packed[d * kTileRows + r] = r < n ? rows[r * vecdim + d] : 0.0f;
+        }
+    }
+}
+
+// 每段一个字节的4bit编码codes[n][nsub]（nsub为偶数）打包成lut16_scan的格式：
+// 每32条向量一块，块内每两段一组32字节，第l字节的低4位是第l条向量第2p段的编码、高4位是第2p+1段，
+// 最后一块不足32条的部分补0。packed需要 (n + 31) / 32 * nsub * 16 字节
+inline void PackFastScanCodes(const uint8_t* codes, size_t n, size_t nsub, uint8_t* packed) {
+    size_t n_blocks = (n + kFastScanBlock - 1) / kFastScanBlock;
+    for (size_t b = 0; b < n_blocks; ++b) {
+        for (size_t p = 0; p < nsub / 2; ++p) {
+            uint8_t* out = packed + (b * (nsub / 2) + p) * kFastScanBlock;
+            for (size_t l = 0; l < kFastScanBlock; ++l) {
+                size_t i = b * kFastScanBlock + l;
+                out[l] = i < n ? (codes[i * nsub + 2 * p] & 0x0F) | (codes[i * nsub + 2 * p + 1] << 4) : 0;
+            }
+        }
+    }
+}
+
+// nq条query与一组打包好的16行的内积，结果写入out[nq][16]
+inline void InnerProductTile(const float* packed, const float* query, size_t nq, size_t vecdim, float* out) {
+#ifdef ANN_SIMD_NEON
+    inner_product_tile_neon(packed, query, nq, vecdim, out);
+#else
+    simd_kernels().inner_product_tile(packed, query, nq, vecdim, out);
+#endif
+}
+
+// 单条query与n_panels组打包好的16行的内积，结果写入out[n_panels][16]
+inline void InnerProductPanels(const float* packed, size_t n_panels, const float* query, size_t vecdim, float* out) {
+#ifdef ANN_SIMD_NEON
+    inner_product_panels_neon(packed, n_panels, query, vecdim, out);
+#else
+    simd_kernels().inner_product_panels(packed, n_panels, query, vecdim, out);
+#endif
+}
+
+// n行8bit编码与float权重的内积，见SimdKernels::sq8_inner_product_batch
+inline void SQ8InnerProductBatch(const uint8_t* codes, size_t n, const float* weights, size_t vecdim, float* out) {
+#ifdef ANN_SIMD_NEON
+    sq8_inner_product_batch_neon(codes, n, weights, vecdim, out);
+#else
+    simd_kernels().sq8_inner_product_batch(codes, n, weights, vecdim, out);
+#endif
+}
+
+// n行8bit编码与int8权重的整数内积，见SimdKernels::sq8_dot_batch。
+// ARM上udot要运行时检查，也走函数表
+inline void SQ8DotBatch(const uint8_t* codes, const int32_t* code_sums, size_t n, const int8_t* query, size_t vecdim,
+                        int32_t* out) {
+    simd_kernels().sq8_dot_batch(codes, code_sums, n, query, vecdim, out);
+}
+
+// 阈值过滤，见SimdKernels::filter_u16_ge
+inline size_t FilterU16AtLeast(const uint16_t* scores, size_t n, uint16_t threshold, uint32_t id0,
+                               uint16_t* out_scores, uint32_t* out_ids) {
+#ifdef ANN_SIMD_NEON
+    return filter_u16_ge_neon(scores, n, threshold, id0, out_scores, out_ids);
+#else
+    return simd_kernels().filter_u16_ge(scores, n, threshold, id0, out_scores, out_ids);
+#endif
+}
+
+// n_blocks个打包块的FastScan查表累加，结果写入out[n_blocks * 32]
+inline void Lut16Scan(const uint8_t* codes, size_t n_blocks, const uint8_t* tables, size_t nsub, uint16_t* out) {
+    assert(nsub % 2 == 0);
+#ifdef ANN_SIMD_NEON
+    lut16_scan_neon(codes, n_blocks, tables, nsub, out);
+#else
+    simd_kernels().lut16_scan(codes, n_blocks, tables, nsub, out);
+#endif
+}
+
+// 每段一个字节的8bit编码codes[n][nsub]打包成pq_adc_scan的格式：
+// 每16条向量一块，块内按段存放，每段16字节依次是这16条向量该段的编码，最后一块不足16条的部分补0。
+// packed需要 (n + 15) / 16 * nsub * 16 字节
+inline void PackPQCodes(const uint8_t* codes, size_t n, size_t nsub, uint8_t* packed) {
+    size_t n_blocks = (n + kPQBlock - 1) / kPQBlock;
+    for (size_t b = 0; b < n_blocks; ++b) {
+        for (size_t j = 0; j < nsub; ++j) {
+            uint8_t* out = packed + (b * nsub + j) * kPQBlock;
+            for (size_t l = 0; l < kPQBlock; ++l) {
+                size_t i = b * kPQBlock + l;
+                out[l] = i < n ? codes[i * nsub + j] : 0;
+            }
+        }
+    }
+}
+
+// n_blocks个打包块的PQ查表累加，结果写入out[n_blocks * 16]
+inline void PQAdcScan(const uint8_t* codes, size_t n_blocks, const float* lut, size_t nsub, size_t ksub, float* out) {
+#ifdef ANN_SIMD_NEON
+    // 256项的float表放不进tbl的64字节，NEON上逐通道取表项
+    pq_adc_scan_scalar(codes, n_blocks, lut, nsub, ksub, out);
+#else
+    simd_kernels().pq_adc_scan(codes, n_blocks, lut, nsub, ksub, out);
+#endif
+}
+
+// 第[begin, end)条向量的查表累加，out[i - begin]对应第i条；begin、end不需要按块对齐，
+// 首尾不完整的块算完整块后只取需要的部分
+inline void PQAdcScanRange(const uint8_t* codes, size_t begin, size_t end, const float* lut, size_t nsub, size_t ksub, float* out) {
+    size_t block_bytes = nsub * kPQBlock;
+    float tmp[kPQBlock];
+    size_t i = begin;
+    if (i < end && i % kPQBlock != 0) {
+        size_t b = i / kPQBlock, stop = std::min(end, (b + 1) * kPQBlock);
+        PQAdcScan(codes + b * block_bytes, 1, lut, nsub, ksub, tmp);
+        for (; i < stop; ++i) out[i - begin] = tmp[i - b * kPQBlock];
+    }
+    size_t full = (end - i) / kPQBlock;
+    if (full > 0) {
+        PQAdcScan(codes + i / kPQBlock * block_bytes, full, lut, nsub, ksub, out + (i - begin));
+        i += full * kPQBlock;
+    }
+    if (i < end) {
+        PQAdcScan(codes + i / kPQBlock * block_bytes, 1, lut, nsub, ksub, tmp);
+        for (size_t l = 0; i < end; ++i, ++l) out[i - begin] = tmp[l];
+    }
+}
@@ -0,0 +1,736 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// 各指令集下的SIMD封装，接口统一为simd8float32/simd16float32的形式
+// ARM上只有NEON；x86上simd8float32用基线SSE实现，AVX2/AVX-512的类型需要在对应target的函数内使用
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define ANN_SIMD_NEON
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define ANN_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#ifdef ANN_SIMD_X86
+// 函数级target，编译时不需要-mavx2，运行时由simd_dispatch.h按CPUID选择
+#define ANN_TARGET_SSE4   __attribute__((target("sse4.1")))
+#define ANN_TARGET_AVX2   __attribute__((target("avx2,fma")))
+#define ANN_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+// 内核入口加flatten，把模板和封装类的成员全部内联进来
+#define ANN_KERNEL_SSE4   __attribute__((target("sse4.1"), flatten))
+#define ANN_KERNEL_AVX2   __attribute__((target("avx2,fma"), flatten))
+#define ANN_KERNEL_AVX512 __attribute__((target("avx512f,avx2,fma"), flatten))
+// 整数点积（vpdpbusd）：AVX512-VNNI带VL可以用在ymm上；AVX-VNNI是VEX编码的同一条指令，GCC 11起才认识
+#define ANN_TARGET_AVX512VNNI __attribute__((target("avx512vnni,avx512vl,avx512bw,avx512f,avx2,fma")))
+#define ANN_KERNEL_AVX512VNNI __attribute__((target("avx512vnni,avx512vl,avx512bw,avx512f,avx2,fma"), flatten))
+#if (defined(__clang__) && __clang_major__ >= 12) || (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 11)
+#define ANN_SIMD_AVXVNNI
+#define ANN_TARGET_AVXVNNI __attribute__((target("avxvnni,avx2,fma")))
+#define ANN_KERNEL_AVXVNNI __attribute__((target("avxvnni,avx2,fma"), flatten))
+#endif
+#endif
+
+// ARMv8.2的udot：编译时已打开（-march=armv8.2-a+dotprod）就直接用，
+// 否则GCC按函数单独打开，运行时再查HWCAP
+#if defined(__ARM_FEATURE_DOTPROD)
+#define ANN_SIMD_NEON_DOTPROD
+#define ANN_TARGET_NEON_DOTPROD
+#define ANN_KERNEL_NEON_DOTPROD
+#elif defined(ANN_SIMD_NEON) && defined(__aarch64__) && defined(__linux__) && defined(__GNUC__) && !defined(__clang__)
+#define ANN_SIMD_NEON_DOTPROD
+#define ANN_TARGET_NEON_DOTPROD __attribute__((target("arch=armv8.2-a+dotprod")))
+#define ANN_KERNEL_NEON_DOTPROD __attribute__((target("arch=armv8.2-a+dotprod"), flatten))
+#endif
+
+#if defined(ANN_SIMD_NEON)
+
+struct simd8float32 {
+    static const int kLanes = 8;
+    float32x4x2_t data;  // NEON的128位SIMD寄存器，两个4个浮点数的向量
+
+    simd8float32(){
+        data.val[0] = vdupq_n_f32(0.0f);
+        data.val[1] = vdupq_n_f32(0.0f);
+    }
+
+    explicit simd8float32(const float x){
+        data.val[0] = vdupq_n_f32(x);
+        data.val[1] = vdupq_n_f32(x);
+    }
+
+    explicit simd8float32(const float* x)
+        : data{vld1q_f32(x), vld1q_f32(x + 4)} {}
+
+    // 8个uint8编码转成float
+    explicit simd8float32(const uint8_t* x) {
+        uint16x8_t w = vmovl_u8(vld1_u8(x));
+        data.val[0] = vcvtq_f32_u32(vmovl_u16(vget_low_u16(w)));
+        data.val[1] = vcvtq_f32_u32(vmovl_u16(vget_high_u16(w)));
+    }
+
+    // 向量乘法
+    simd8float32 operator*(const simd8float32& other) const {
+        simd8float32 result;
+        result.data.val[0] = vmulq_f32(data.val[0], other.data.val[0]);
+        result.data.val[1] = vmulq_f32(data.val[1], other.data.val[1]);
+        return result;
+    }
+
+    // 向量加法
+    simd8float32 operator+(const simd8float32& other) const {
+        simd8float32 result;
+        result.data.val[0] = vaddq_f32(data.val[0], other.data.val[0]);
+        result.data.val[1] = vaddq_f32(data.val[1], other.data.val[1]);
+        return result;
+    }
+
+    // 向量减法
+    simd8float32 operator-(const simd8float32& other) const {
+        simd8float32 result;
+        result.data.val[0] = vsubq_f32(data.val[0], other.data.val[0]);
+        result.data.val[1] = vsubq_f32(data.val[1], other.data.val[1]);
+        return result;
+    }
+
+    simd8float32 max(const simd8float32& other) const {
+        simd8float32 result;
+        result.data.val[0] = vmaxq_f32(data.val[0], other.data.val[0]);
+        result.data.val[1] = vmaxq_f32(data.val[1], other.data.val[1]);
+        return result;
+    }
+
+    simd8float32 min(const simd8float32& other) const {
+        simd8float32 result;
+        result.data.val[0] = vminq_f32(data.val[0], other.data.val[0]);
+        result.data.val[1] = vminq_f32(data.val[1], other.data.val[1]);
+        return result;
+    }
+
+    // a * b + c
+    static simd8float32 fmadd(const simd8float32& a, const simd8float32& b, const simd8float32& c) {
+        simd8float32 result;
+        result.data.val[0] = vfmaq_f32(c.data.val[0], a.data.val[0], b.data.val[0]);
+        result.data.val[1] = vfmaq_f32(c.data.val[1], a.data.val[1], b.data.val[1]);
+        return result;
+    }
+
+    // 将SIMD结果存储到数组
+    void storeu(float* output) const {
+        vst1q_f32(output, data.val[0]);
+        vst1q_f32(output + 4, data.val[1]);
+    }
+
+    // 横向求和
+    float reduce_add() const {
+        return vaddvq_f32(data.val[0]) + vaddvq_f32(data.val[1]);
+    }
+
+
+    // 折叠成4路部分和
+    float32x4_t fold4() const {
+        return vaddq_f32(data.val[0], data.val[1]);
+    }
+
+    // 4个累加器一起规约，结果依次写入out[0..3]
+    static void reduce_add4(const simd8float32& a0, const simd8float32& a1,
+                            const simd8float32& a2, const simd8float32& a3, float* out) {
+        vst1q_f32(out, vpaddq_f32(vpaddq_f32(a0.fold4(), a1.fold4()), vpaddq_f32(a2.fold4(), a3.fold4())));
+    }
+};
+
+struct simd16float32 {
+    static const int kLanes = 16;
+    float32x4x4_t data;  // 4个累加寄存器互不依赖，流水线更满
+
+    simd16float32() {
+        data.val[0] = vdupq_n_f32(0.0f);
+        data.val[1] = vdupq_n_f32(0.0f);
+        data.val[2] = vdupq_n_f32(0.0f);
+        data.val[3] = vdupq_n_f32(0.0f);
+    }
+
+    explicit simd16float32(const float x) {
+        data.val[0] = vdupq_n_f32(x);
+        data.val[1] = vdupq_n_f32(x);
+        data.val[2] = vdupq_n_f32(x);
+        data.val[3] = vdupq_n_f32(x);
+    }
+
+    explicit simd16float32(const float* x) {
+        data.val[0] = vld1q_f32(x);
+        data.val[1] = vld1q_f32(x + 4);
+        data.val[2] = vld1q_f32(x + 8);
+        data.val[3] = vld1q_f32(x + 12);
+    }
+
+    explicit simd16float32(const uint8_t* x) {
+        uint8x16_t b = vld1q_u8(x);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(b));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(b));
+        data.val[0] = vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo)));
+        data.val[1] = vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo)));
+        data.val[2] = vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi)));
+        data.val[3] = vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi)));
+    }
+
+    simd16float32 operator*(const simd16float32& other) const {
+        simd16float32 result;
+        result.data.val[0] = vmulq_f32(data.val[0], other.data.val[0]);
+        result.data.val[1] = vmulq_f32(data.val[1], other.data.val[1]);
+        result.data.val[2] = vmulq_f32(data.val[2], other.data.val[2]);
+        result.data.val[3] = vmulq_f32(data.val[3], other.data.val[3]);
+        return result;
+    }
+
+    simd16float32 operator+(const simd16float32& other) const {
+        simd16float32 result;
+        result.data.val[0] = vaddq_f32(data.val[0], other.data.val[0]);
+        result.data.val[1] = vaddq_f32(data.val[1], other.data.val[1]);
+        result.data.val[2] = vaddq_f32(data.val[2], other.data.val[2]);
+        result.data.val[3] = vaddq_f32(data.val[3], other.data.val[3]);
+        return result;
+    }
+
+    simd16float32 operator-(const simd16float32& other) const {
+        simd16float32 result;
+        result.data.val[0] = vsubq_f32(data.val[0], other.data.val[0]);
+        result.data.val[1] = vsubq_f32(data.val[1], other.data.val[1]);
+        result.data.val[2] = vsubq_f32(data.val[2], other.data.val[2]);
+        result.data.val[3] = vsubq_f32(data.val[3], other.data.val[3]);
+        return result;
+    }
+
+    static simd16float32 fmadd(const simd16float32& a, const simd16float32& b, const simd16float32& c) {
+        simd16float32 result;
+        result.data.val[0] = vfmaq_f32(c.data.val[0], a.data.val[0], b.data.val[0]);
+        result.data.val[1] = vfmaq_f32(c.data.val[1], a.data.val[1], b.data.val[1]);
+        result.data.val[2] = vfmaq_f32(c.data.val[2], a.data.val[2], b.data.val[2]);
+        result.data.val[3] = vfmaq_f32(c.data.val[3], a.data.val[3], b.data.val[3]);
+        return result;
+    }
+
+    void storeu(float* output) const {
+        vst1q_f32(output, data.val[0]);
+        vst1q_f32(output + 4, data.val[1]);
+        vst1q_f32(output + 8, data.val[2]);
+        vst1q_f32(output + 12, data.val[3]);
+    }
+
+    float reduce_add() const {
+        float32x4_t s = vaddq_f32(vaddq_f32(data.val[0], data.val[1]), vaddq_f32(data.val[2], data.val[3]));
+        return vaddvq_f32(s);
+    }
+
+
+    // 折叠成4路部分和
+    float32x4_t fold4() const {
+        return vaddq_f32(vaddq_f32(data.val[0], data.val[1]), vaddq_f32(data.val[2], data.val[3]));
+    }
+
+    // 4个累加器一起规约，结果依次写入out[0..3]
+    static void reduce_add4(const simd16float32& a0, const simd16float32& a1,
+                            const simd16float32& a2, const simd16float32& a3, float* out) {
+        vst1q_f32(out, vpaddq_f32(vpaddq_f32(a0.fold4(), a1.fold4()), vpaddq_f32(a2.fold4(), a3.fold4())));
+    }
+};
+
+#elif defined(ANN_SIMD_X86)
+
+// 4个__m128分别横向求和，结果打包成一个__m128（转置后相加）
+static inline __m128 simd_hsum4_ps(__m128 s0, __m128 s1, __m128 s2, __m128 s3) {
+    _MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+    return _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3));
+}
+
+// 基线SSE实现（x86-64必然支持SSE2），用两个__m128拼成8路
+struct simd8float32 {
+    static const int kLanes = 8;
+    __m128 data[2];
+
+    simd8float32() {
+        data[0] = _mm_setzero_ps();
+        data[1] = _mm_setzero_ps();
+    }
+
+    explicit simd8float32(const float x) {
+        data[0] = _mm_set1_ps(x);
+        data[1] = _mm_set1_ps(x);
+    }
+
+    explicit simd8float32(const float* x) {
+        data[0] = _mm_loadu_ps(x);
+        data[1] = _mm_loadu_ps(x + 4);
+    }
+
+    // 8个uint8编码转成float，SSE2没有cvtepu8，与0交错展开
+    explicit simd8float32(const uint8_t* x) {
+        __m128i zero = _mm_setzero_si128();
+        __m128i w = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)x), zero);
+        data[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(w, zero));
+        data[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(w, zero));
+    }
+
+    simd8float32 operator*(const simd8float32& other) const {
+        simd8float32 result;
+        result.data[0] = _mm_mul_ps(data[0], other.data[0]);
+        result.data[1] = _mm_mul_ps(data[1], other.data[1]);
+        return result;
+    }
+
+    simd8float32 operator+(const simd8float32& other) const {
+        simd8float32 result;
+        result.data[0] = _mm_add_ps(data[0], other.data[0]);
+        result.data[1] = _mm_add_ps(data[1], other.data[1]);
+        return result;
+    }
+
+    simd8float32 operator-(const simd8float32& other) const {
+        simd8float32 result;
+        result.data[0] = _mm_sub_ps(data[0], other.data[0]);
+        result.data[1] = _mm_sub_ps(data[1], other.data[1]);
+        return result;
+    }
+
+    simd8float32 max(const simd8float32& other) const {
+        simd8float32 result;
+        result.data[0] = _mm_max_ps(data[0], other.data[0]);
+        result.data[1] = _mm_max_ps(data[1], other.data[1]);
+        return result;
+    }
+
+    simd8float32 min(const simd8float32& other) const {
+        simd8float32 result;
+        result.data[0] = _mm_min_ps(data[0], other.data[0]);
+        result.data[1] = _mm_min_ps(data[1], other.data[1]);
+        return result;
+    }
+
+    // SSE没有FMA，拆成乘加
+    static simd8float32 fmadd(const simd8float32& a, const simd8float32& b, const simd8float32& c) {
+        return a * b + c;
+    }
+
+    void storeu(float* output) const {
+        _mm_storeu_ps(output, data[0]);
+        _mm_storeu_ps(output + 4, data[1]);
+    }
+
+    float reduce_add() const {
+        __m128 s = _mm_add_ps(data[0], data[1]);
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    // 折叠成4路部分和
+    __m128 fold4() const {
+        return _mm_add_ps(data[0], data[1]);
+    }
+
+    // 4个累加器一起规约，结果依次写入out[0..3]
+    static void reduce_add4(const simd8float32& a0, const simd8float32& a1,
+                            const simd8float32& a2, const simd8float32& a3, float* out) {
+        _mm_storeu_ps(out, simd_hsum4_ps(a0.fold4(), a1.fold4(), a2.fold4(), a3.fold4()));
+    }
+};
+
+struct simd16float32 {
+    static const int kLanes = 16;
+    __m128 data[4];
+
+    simd16float32() {
+        data[0] = _mm_setzero_ps();
+        data[1] = _mm_setzero_ps();
+        data[2] = _mm_setzero_ps();
+        data[3] = _mm_setzero_ps();
+    }
+
+    explicit simd16float32(const float x) {
+        data[0] = _mm_set1_ps(x);
+        data[1] = _mm_set1_ps(x);
+        data[2] = _mm_set1_ps(x);
+        data[3] = _mm_set1_ps(x);
+    }
+
+    explicit simd16float32(const float* x) {
+        data[0] = _mm_loadu_ps(x);
+        data[1] = _mm_loadu_ps(x + 4);
+        data[2] = _mm_loadu_ps(x + 8);
+        data[3] = _mm_loadu_ps(x + 12);
+    }
+
+    explicit simd16float32(const uint8_t* x) {
+        __m128i zero = _mm_setzero_si128();
+        __m128i b = _mm_loadu_si128((const __m128i*)x);
+        __m128i lo = _mm_unpacklo_epi8(b, zero), hi = _mm_unpackhi_epi8(b, zero);
+        data[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+        data[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+        data[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+        data[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+    }
+
+    simd16float32 operator*(const simd16float32& other) const {
+        simd16float32 result;
+        result.data[0] = _mm_mul_ps(data[0], other.data[0]);
+        result.data[1] = _mm_mul_ps(data[1], other.data[1]);
+        result.data[2] = _mm_mul_ps(data[2], other.data[2]);
+        result.data[3] = _mm_mul_ps(data[3], other.data[3]);
+        return result;
+    }
+
+    simd16float32 operator+(const simd16float32& other) const {
+        simd16float32 result;
+        result.data[0] = _mm_add_ps(data[0], other.data[0]);
+        result.data[1] = _mm_add_ps(data[1], other.data[1]);
+        result.data[2] = _mm_add_ps(data[2], other.data[2]);
+        result.data[3] = _mm_add_ps(data[3], other.data[3]);
+        return result;
+    }
+
+    simd16float32 operator-(const simd16float32& other) const {
+        simd16float32 result;
+        result.data[0] = _mm_sub_ps(data[0], other.data[0]);
+        result.data[1] = _mm_sub_ps(data[1], other.data[1]);
+        result.data[2] = _mm_sub_ps(data[2], other.data[2]);
+        result.data[3] = _mm_sub_ps(data[3], other.data[3]);
+        return result;
+    }
+
+    static simd16float32 fmadd(const simd16float32& a, const simd16float32& b, const simd16float32& c) {
+        return a * b + c;
+    }
+
+    void storeu(float* output) const {
+        _mm_storeu_ps(output, data[0]);
+        _mm_storeu_ps(output + 4, data[1]);
+        _mm_storeu_ps(output + 8, data[2]);
+        _mm_storeu_ps(output + 12, data[3]);
+    }
+
+    float reduce_add() const {
+        __m128 s = _mm_add_ps(_mm_add_ps(data[0], data[1]), _mm_add_ps(data[2], data[3]));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    // 折叠成4路部分和
+    __m128 fold4() const {
+        return _mm_add_ps(_mm_add_ps(data[0], data[1]), _mm_add_ps(data[2], data[3]));
+    }
+
+    // 4个累加器一起规约，结果依次写入out[0..3]
+    static void reduce_add4(const simd16float32& a0, const simd16float32& a1,
+                            const simd16float32& a2, const simd16float32& a3, float* out) {
+        _mm_storeu_ps(out, simd_hsum4_ps(a0.fold4(), a1.fold4(), a2.fold4(), a3.fold4()));
+    }
+};
+
+// AVX2 + FMA，一个__m256就是8路
+struct simd8float32_avx2 {
+    static const int kLanes = 8;
+    __m256 data;
+
+    ANN_TARGET_AVX2 simd8float32_avx2() : data(_mm256_setzero_ps()) {}
+    ANN_TARGET_AVX2 explicit simd8float32_avx2(const float x) : data(_mm256_set1_ps(x)) {}
+    ANN_TARGET_AVX2 explicit simd8float32_avx2(const float* x) : data(_mm256_loadu_ps(x)) {}
+    ANN_TARGET_AVX2 explicit simd8float32_avx2(const uint8_t* x)
+        : data(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)x)))) {}
+
+    ANN_TARGET_AVX2 simd8float32_avx2 operator*(const simd8float32_avx2& other) const {
+        simd8float32_avx2 result;
+        result.data = _mm256_mul_ps(data, other.data);
+        return result;
+    }
+
+    ANN_TARGET_AVX2 simd8float32_avx2 operator+(const simd8float32_avx2& other) const {
+        simd8float32_avx2 result;
+        result.data = _mm256_add_ps(data, other.data);
+        return result;
+    }
+
+    ANN_TARGET_AVX2 simd8float32_avx2 operator-(const simd8float32_avx2& other) const {
+        simd8float32_avx2 result;
+        result.data = _mm256_sub_ps(data, other.data);
+        return result;
+    }
+
+    ANN_TARGET_AVX2 simd8float32_avx2 max(const simd8float32_avx2& other) const {
+        simd8float32_avx2 result;
+        result.data = _mm256_max_ps(data, other.data);
+        return result;
+    }
+
+    ANN_TARGET_AVX2 simd8float32_avx2 min(const simd8float32_avx2& other) const {
+        simd8float32_avx2 result;
+        result.data = _mm256_min_ps(data, other.data);
+        return result;
+    }
+
+    ANN_TARGET_AVX2 static simd8float32_avx2 fmadd(const simd8float32_avx2& a, const simd8float32_avx2& b,
+                                                   const simd8float32_avx2& c) {
+        simd8float32_avx2 result;
+        result.data = _mm256_fmadd_ps(a.data, b.data, c.data);
+        return result;
+    }
+
+    ANN_TARGET_AVX2 void storeu(float* output) const {
+        _mm256_storeu_ps(output, data);
+    }
+
+    ANN_TARGET_AVX2 float reduce_add() const {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(data), _mm256_extractf128_ps(data, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    // 折叠成4路部分和
+    ANN_TARGET_AVX2 __m128 fold4() const {
+        return _mm_add_ps(_mm256_castps256_ps128(data), _mm256_extractf128_ps(data, 1));
+    }
+
+    // 4个累加器一起规约，结果依次写入out[0..3]
+    ANN_TARGET_AVX2 static void reduce_add4(const simd8float32_avx2& a0, const simd8float32_avx2& a1,
+                                            const simd8float32_avx2& a2, const simd8float32_avx2& a3, float* out) {
+        _mm_storeu_ps(out, simd_hsum4_ps(a0.fold4(), a1.fold4(), a2.fold4(), a3.fold4()));
+    }
+};
+
+// AVX2下的16路：两个独立的__m256累加，掩盖FMA延迟
+struct simd16float32_avx2 {
+    static const int kLanes = 16;
+    __m256 data[2];
+
+    ANN_TARGET_AVX2 simd16float32_avx2() {
+        data[0] = _mm256_setzero_ps();
+        data[1] = _mm256_setzero_ps();
+    }
+
+    ANN_TARGET_AVX2 explicit simd16float32_avx2(const float x) {
+        data[0] = _mm256_set1_ps(x);
+        data[1] = _mm256_set1_ps(x);
+    }
+
+    ANN_TARGET_AVX2 explicit simd16float32_avx2(const float* x) {
+        data[0] = _mm256_loadu_ps(x);
+        data[1] = _mm256_loadu_ps(x + 8);
+    }
+
+    ANN_TARGET_AVX2 explicit simd16float32_avx2(const uint8_t* x) {
+        __m128i b = _mm_loadu_si128((const __m128i*)x);
+        data[0] = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b));
+        data[1] = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_unpackhi_epi64(b, b)));
+    }
+
+    ANN_TARGET_AVX2 simd16float32_avx2 operator*(const simd16float32_avx2& other) const {
+        simd16float32_avx2 result;
+        result.data[0] = _mm256_mul_ps(data[0], other.data[0]);
+        result.data[1] = _mm256_mul_ps(data[1], other.data[1]);
+        return result;
+    }
+
+    ANN_TARGET_AVX2 simd16float32_avx2 operator+(const simd16float32_avx2& other) const {
+        simd16float32_avx2 result;
+        result.data[0] = _mm256_add_ps(data[0], other.data[0]);
+        result.data[1] = _mm256_add_ps(data[1], other.data[1]);
+        return result;
+    }
+
+    ANN_TARGET_AVX2 simd16float32_avx2 operator-(const simd16float32_avx2& other) const {
+        simd16float32_avx2 result;
+        result.data[0] = _mm256_sub_ps(data[0], other.data[0]);
+        result.data[1] = _mm256_sub_ps(data[1], other.data[1]);
+        return result;
+    }
+
+    ANN_TARGET_AVX2 static simd16float32_avx2 fmadd(const simd16float32_avx2& a, const simd16float32_avx2& b,
+                                                    const simd16float32_avx2& c) {
+        simd16float32_avx2 result;
+        result.data[0] = _mm256_fmadd_ps(a.data[0], b.data[0], c.data[0]);
+        result.data[1] = _mm256_fmadd_ps(a.data[1], b.data[1], c.data[1]);
+        return result;
+    }
+
+    ANN_TARGET_AVX2 void storeu(float* output) const {
+        _mm256_storeu_ps(output, data[0]);
+        _mm256_storeu_ps(output + 8, data[1]);
+    }
+
+    ANN_TARGET_AVX2 float reduce_add() const {
+        __m256 v = _mm256_add_ps(data[0], data[1]);
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    // 折叠成4路部分和
+    ANN_TARGET_AVX2 __m128 fold4() const {
+        __m256 v = _mm256_add_ps(data[0], data[1]);
+        return _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    }
+
+    // 4个累加器一起规约，结果依次写入out[0..3]
+    ANN_TARGET_AVX2 static void reduce_add4(const simd16float32_avx2& a0, const simd16float32_avx2& a1,
+                                            const simd16float32_avx2& a2, const simd16float32_avx2& a3, float* out) {
+        _mm_storeu_ps(out, simd_hsum4_ps(a0.fold4(), a1.fold4(), a2.fold4(), a3.fold4()));
+    }
+};
+
+// AVX-512F，一个__m512就是16路
+struct simd16float32_avx512 {
+    static const int kLanes = 16;
+    __m512 data;
+
+    ANN_TARGET_AVX512 simd16float32_avx512() : data(_mm512_setzero_ps()) {}
+    ANN_TARGET_AVX512 explicit simd16float32_avx512(const float x) : data(_mm512_set1_ps(x)) {}
+    ANN_TARGET_AVX512 explicit simd16float32_avx512(const float* x) : data(_mm512_loadu_ps(x)) {}
+    ANN_TARGET_AVX512 explicit simd16float32_avx512(const uint8_t* x)
+        : data(_mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)x)))) {}
+
+    ANN_TARGET_AVX512 simd16float32_avx512 operator*(const simd16float32_avx512& other) const {
+        simd16float32_avx512 result;
+        result.data = _mm512_mul_ps(data, other.data);
+        return result;
+    }
+
+    ANN_TARGET_AVX512 simd16float32_avx512 operator+(const simd16float32_avx512& other) const {
+        simd16float32_avx512 result;
+        result.data = _mm512_add_ps(data, other.data);
+        return result;
+    }
+
+    ANN_TARGET_AVX512 simd16float32_avx512 operator-(const simd16float32_avx512& other) const {
+        simd16float32_avx512 result;
+        result.data = _mm512_sub_ps(data, other.data);
+        return result;
+    }
+
+    ANN_TARGET_AVX512 static simd16float32_avx512 fmadd(const simd16float32_avx512& a, const simd16float32_avx512& b,
+                                                        const simd16float32_avx512& c) {
+        simd16float32_avx512 result;
+        result.data = _mm512_fmadd_ps(a.data, b.data, c.data);
+        return result;
+    }
+
+    ANN_TARGET_AVX512 void storeu(float* output) const {
+        _mm512_storeu_ps(output, data);
+    }
+
+    // 取高低256位；用带掩码的extract并显式给出src，避开GCC 12中_mm512_undefined_*
+    // 在-Wall下的未初始化误报（GCC bug 105593）
+    ANN_TARGET_AVX512 __m256 half(int hi) const {
+        __m512d d = _mm512_castps_pd(data);
+        __m256d h = hi ? _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xFF, d, 1)
+                       : _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xFF, d, 0);
+        return _mm256_castpd_ps(h);
+    }
+
+    // 折叠成4路部分和
+    ANN_TARGET_AVX512 __m128 fold4() const {
+        __m256 v = _mm256_add_ps(half(0), half(1));
+        return _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    }
+
+    ANN_TARGET_AVX512 float reduce_add() const {
+        // 先对折到4路，再按SSE的方式继续规约
+        __m128 s = fold4();
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    // 4个累加器一起规约，结果依次写入out[0..3]
+    ANN_TARGET_AVX512 static void reduce_add4(const simd16float32_avx512& a0, const simd16float32_avx512& a1,
+                                              const simd16float32_avx512& a2, const simd16float32_avx512& a3,
+                                              float* out) {
+        _mm_storeu_ps(out, simd_hsum4_ps(a0.fold4(), a1.fold4(), a2.fold4(), a3.fold4()));
+    }
+};
+
+#else
+
+// 其它架构的标量退化版本，保证头文件在任何平台都能编译
+template <int N>
+struct simd_scalar_float32 {
+    static const int kLanes = N;
+    float data[N];
+
+    simd_scalar_float32() {
+        for (int i = 0; i < N; ++i) data[i] = 0.0f;
+    }
+
+    explicit simd_scalar_float32(const float x) {
+        for (int i = 0; i < N; ++i) data[i] = x;
+    }
+
+    explicit simd_scalar_float32(const float* x) {
+        for (int i = 0; i < N; ++i) data[i] = x[i];
+    }
+
+    explicit simd_scalar_float32(const uint8_t* x) {
+        for (int i = 0; i < N; ++i) data[i] = x[i];
+    }
+
+    simd_scalar_float32 operator*(const simd_scalar_float32& other) const {
+        simd_scalar_float32 result;
+        for (int i = 0; i < N; ++i) result.data[i] = data[i] * other.data[i];
+        return result;
+    }
+
+    simd_scalar_float32 operator+(const simd_scalar_float32& other) const {
+        simd_scalar_float32 result;
+        for (int i = 0; i < N; ++i) result.data[i] = data[i] + other.data[i];
+        return result;
+    }
+
+    simd_scalar_float32 operator-(const simd_scalar_float32& other) const {
+        simd_scalar_float32 result;
+        for (int i = 0; i < N; ++i) result.data[i] = data[i] - other.data[i];
+        return result;
+    }
+
+    simd_scalar_float32 max(const simd_scalar_float32& other) const {
+        simd_scalar_float32 result;
+        for (int i = 0; i < N; ++i) result.data[i] = data[i] > other.data[i] ? data[i] : other.data[i];
+        return result;
+    }
+
+    simd_scalar_float32 min(const simd_scalar_float32& other) const {
+        simd_scalar_float32 result;
+        for (int i = 0; i < N; ++i) result.data[i] = data[i] < other.data[i] ? data[i] : other.data[i];
+        return result;
+    }
+
+    static simd_scalar_float32 fmadd(const simd_scalar_float32& a, const simd_scalar_float32& b,
+                                     const simd_scalar_float32& c) {
+        return a * b + c;
+    }
+
+    void storeu(float* output) const {
+        for (int i = 0; i < N; ++i) output[i] = data[i];
+    }
+
+    float reduce_add() const {
+        float s = 0;
+        for (int i = 0; i < N; ++i) s += data[i];
+        return s;
+    }
+
+
+    static void reduce_add4(const simd_scalar_float32& a0, const simd_scalar_float32& a1,
+                            const simd_scalar_float32& a2, const simd_scalar_float32& a3, float* out) {
+        out[0] = a0.reduce_add();
+        out[1] = a1.reduce_add();
+        out[2] = a2.reduce_add();
+        out[3] = a3.reduce_add();
+    }
+};
+
+typedef simd_scalar_float32<8> simd8float32;
+typedef simd_scalar_float32<16> simd16float32;
+
+#endif
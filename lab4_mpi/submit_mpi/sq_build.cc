@@ -0,0 +1,108 @@
+// 离线训练按维度的8bit标量量化并编码，输出sq_simd_search（SQ8Codec重载）读入的文件：
+//   <prefix>.sq8.ubin  头部为行数、列数和每维的vmin、step，之后是N x vecdim的uint8编码，格式见SaveSQ8
+// 每维的范围取数据的clip与1 - clip分位数，clip = 0时就是最小、最大值。
+// 同时打印与原来固定[-1, 1]范围相比的均方误差。
+//
+// 编译：g++ sq_build.cc -o sq_build -O2 -std=c++11
+// 运行：./sq_build <base.fbin> <prefix> [-clip 0] [-sample 0] [-seed 1234]
+// 例如：./sq_build files/DEEP100K.base.100k.fbin files/DEEP100K.base.100k -clip 0.0001
+//       ./sq_build files/DEEP100K.base.100k.256.data.bin files/DEEP100K.base.100k.256（IVF-SQ8，见LoadIVFSQ8）
+#include <vector>
+#include <string>
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include "sq_simd_scan.h"
+#include "mapped_array.h"
+
+// 量化后重建的均方误差（每个向量的平方误差之和的平均）
+double sq_error(const float* base, size_t n, size_t vecdim, const SQ8Codec& codec, const uint8_t* codes) {
+    double err = 0;
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t d = 0; d < vecdim; ++d) {
+            float x = codec.vmin[d] + codes[i * vecdim + d] * codec.step[d];
+            err += (x - base[i * vecdim + d]) * (x - base[i * vecdim + d]);
+        }
+    }
+    return err / n;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " <base.fbin> <prefix> [-clip 0] [-sample 0] [-seed 1234]\n";
+        return 1;
+    }
+    std::string input = argv[1], prefix = argv[2];
+    float clip = 0;
+    size_t sample = 0;
+    unsigned seed = 1234;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        std::string opt = argv[i], val = argv[i + 1];
+        if (opt == "-clip") clip = std::atof(val.c_str());
+        else if (opt == "-sample") sample = std::atol(val.c_str());
+        else if (opt == "-seed") seed = std::atol(val.c_str());
+        else {
+            std::cerr << "unknown option " << opt << "\n";
+            return 1;
+        }
+    }
+    if (clip < 0 || clip >= 0.5f) {
+        std::cerr << "clip must be in [0, 0.5)\n";
+        return 1;
+    }
+
+    // 训练和编码都是顺序扫一遍base
+    MappedArray<float> base_file;
+    if (!base_file.open(input, kMapSequential)) return 1;
+    const float* base = base_file.data();
+    size_t base_number = base_file.rows(), vecdim = base_file.cols();
+
+    // 训练只用随机取的sample行
+    const float* train_data = base;
+    size_t train_n = base_number;
+    std::vector<float> sample_buf;
+    if (sample > 0 && sample < base_number) {
+        std::mt19937 gen(seed);
+        std::vector<size_t> perm(base_number);
+        for (size_t i = 0; i < base_number; ++i) perm[i] = i;
+        std::shuffle(perm.begin(), perm.end(), gen);
+        sample_buf.resize(sample * vecdim);
+        for (size_t i = 0; i < sample; ++i) memcpy(&sample_buf[i * vecdim], base + perm[i] * vecdim, vecdim * sizeof(float));
+        train_data = sample_buf.data();
+        train_n = sample;
+    }
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    SQ8Codec codec;
+    codec.train(train_data, train_n, vecdim, clip);
+    std::vector<uint8_t> codes(base_number * vecdim);
+    codec.encode(base, base_number, codes.data());
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+
+    // 原来的固定范围作为对照
+    SQ8Codec fixed;
+    fixed.vecdim = vecdim;
+    fixed.vmin.assign(vecdim, -1.0f);
+    fixed.step.assign(vecdim, 2.0f / 255.0f);
+    std::vector<uint8_t> fixed_codes(base_number * vecdim);
+    fixed.encode(base, base_number, fixed_codes.data());
+
+    float step_sum = 0;
+    for (size_t d = 0; d < vecdim; ++d) step_sum += codec.step[d];
+
+    std::string name = prefix + ".sq8.ubin";
+    if (!SaveSQ8(name, codec, codes.data(), base_number)) {
+        std::cerr << "failed to write " << name << "\n";
+        return 1;
+    }
+
+    std::cout << "train + encode " << seconds << "s, mean step " << step_sum / vecdim << " (fixed range "
+              << 2.0f / 255.0f << ")\n"
+              << "mean squared error " << sq_error(base, base_number, vecdim, codec, codes.data())
+              << ", fixed [-1, 1] range " << sq_error(base, base_number, vecdim, fixed, fixed_codes.data()) << "\n";
+
+    return 0;
+}
@@ -1,5 +1,10 @@
+#pragma once
 #include <queue>
-#include <arm_neon.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
 #include "plain_simd_scan.h"
 
 void Quantize(const float* input, uint8_t* output, size_t dim, float min_val, float max_val) {
@@ -22,8 +27,8 @@ void QuantizeSIMD(const float* input, uint8_t* output, size_t dim, float min_val
     simd8float32 scale_vec(scale);
     simd8float32 min_val_vec(min_val);
 
-    float32x4_t zero_vec = vdupq_n_f32(0.0f);
-    float32x4_t max_vec = vdupq_n_f32(255.0f);
+    simd8float32 zero_vec(0.0f);
+    simd8float32 max_vec(255.0f);
 
     for (size_t i = 0; i < dim; i += 8) {
         // 载入8个float
@@ -34,10 +39,7 @@ void QuantizeSIMD(const float* input, uint8_t* output, size_t dim, float min_val
         normalized = (x - min_val_vec) * scale_vec;
 
         // 限制到[0, 255]
-        normalized.data.val[0] = vmaxq_f32(normalized.data.val[0], zero_vec);
-        normalized.data.val[0] = vminq_f32(normalized.data.val[0], max_vec);
-        normalized.data.val[1] = vmaxq_f32(normalized.data.val[1], zero_vec);
-        normalized.data.val[1] = vminq_f32(normalized.data.val[1], max_vec);
+        normalized = normalized.max(zero_vec).min(max_vec);
 
         // 保存到临时数组
         float tmp[8];
@@ -50,10 +52,131 @@ void QuantizeSIMD(const float* input, uint8_t* output, size_t dim, float min_val
     }
 }
 
+// 按维度的8bit标量量化：第d维的编码c代表vmin[d] + c * step[d]。
+// 查询时把step折进query得到权重，<q, x> = bias + Σ_d weights[d] * c[d]，扫描只需一次u8与float的内积
+struct SQ8Codec {
+    size_t vecdim = 0;
+    std::vector<float> vmin, step;
+
+    // 每维取数据的clip与1 - clip分位数作为范围，clip = 0时就是最小、最大值。
+    // 少数离群值会把范围撑大，截掉一点尾部能让其余的值分到更多的编码
+    void train(const float* data, size_t n, size_t dim, float clip = 0) {
+        vecdim = dim;
+        vmin.assign(dim, 0);
+        step.assign(dim, 1.0f);
+        if (n == 0) return;
+        size_t lo = std::min((size_t)(clip * n), (n - 1) / 2), hi = n - 1 - lo;
+        std::vector<float> column(n);
+        for (size_t d = 0; d < dim; ++d) {
+            for (size_t i = 0; i < n; ++i) column[i] = data[i * dim + d];
+            std::nth_element(column.begin(), column.begin() + lo, column.end());
+            float a = column[lo];
+            std::nth_element(column.begin(), column.begin() + hi, column.end());
+            float b = column[hi];
+            vmin[d] = a;
+            if (b > a) step[d] = (b - a) / 255.0f;
+        }
+    }
+
+    // 四舍五入到最近的编码，超出范围的截断
+    void encode(const float* data, size_t n, uint8_t* codes) const {
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t d = 0; d < vecdim; ++d) {
+                float c = (data[i * vecdim + d] - vmin[d]) / step[d] + 0.5f;
+                codes[i * vecdim + d] = (uint8_t)std::min(std::max(c, 0.0f), 255.0f);
+            }
+        }
+    }
+
+    // 同时写出每行编码之和code_sums[n]，供整数扫描使用
+    void encode(const float* data, size_t n, uint8_t* codes, int32_t* code_sums) const {
+        encode(data, n, codes);
+        sums(codes, n, code_sums);
+    }
+
+    void sums(const uint8_t* codes, size_t n, int32_t* code_sums) const {
+        for (size_t i = 0; i < n; ++i) {
+            int32_t s = 0;
+            for (size_t d = 0; d < vecdim; ++d) s += codes[i * vecdim + d];
+            code_sums[i] = s;
+        }
+    }
+
+    // 写出权重weights[vecdim]，返回bias
+    float prepare_query(const float* query, float* weights) const {
+        float bias = 0;
+        for (size_t d = 0; d < vecdim; ++d) {
+            weights[d] = query[d] * step[d];
+            bias += query[d] * vmin[d];
+        }
+        return bias;
+    }
+
+    // 整数扫描用的权重：按最大绝对值缩放到[-127, 127]取整，
+    // Σ_d weights[d] * c[d] ≈ scale * Σ_d query_i8[d] * c[d]。写出query_i8[vecdim]和scale，返回bias
+    float prepare_query_i8(const float* query, int8_t* query_i8, float& scale) const {
+        float bias = 0, amax = 0;
+        for (size_t d = 0; d < vecdim; ++d) {
+            amax = std::max(amax, std::fabs(query[d] * step[d]));
+            bias += query[d] * vmin[d];
+        }
+        scale = amax > 0 ? amax / 127.0f : 1.0f;
+        for (size_t d = 0; d < vecdim; ++d) query_i8[d] = (int8_t)std::lrint(query[d] * step[d] / scale);
+        return bias;
+    }
+};
+
+// 训练好的量化文件（.ubin）：4字节行数、4字节列数，接着vecdim个float的vmin和vecdim个float的step，
+// 最后是N x vecdim的uint8编码
+bool SaveSQ8(const std::string& path, const SQ8Codec& codec, const uint8_t* codes, size_t n) {
+    std::ofstream fout(path, std::ios::out | std::ios::binary);
+    if (!fout.is_open()) return false;
+    uint32_t header[2] = {(uint32_t)n, (uint32_t)codec.vecdim};
+    fout.write((const char*)header, sizeof(header));
+    fout.write((const char*)codec.vmin.data(), codec.vecdim * sizeof(float));
+    fout.write((const char*)codec.step.data(), codec.vecdim * sizeof(float));
+    fout.write((const char*)codes, n * codec.vecdim);
+    return fout.good();
+}
+
+// 读入SaveSQ8写的文件。文件不存在、长度与头部的行数列数对不上或读取失败时返回false，
+// codec、codes清空，n为0
+bool LoadSQ8(const std::string& path, SQ8Codec& codec, std::vector<uint8_t>& codes, size_t& n) {
+    n = 0;
+    codec.vecdim = 0;
+    codec.vmin.clear();
+    codec.step.clear();
+    codes.clear();
+
+    std::ifstream fin(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!fin.is_open()) return false;
+    uint64_t file_size = (uint64_t)fin.tellg();
+    fin.seekg(0);
+    uint32_t header[2];
+    if (!fin.read((char*)header, sizeof(header))) return false;
+    uint64_t rows = header[0], dim = header[1];
+    if (dim == 0 || file_size != sizeof(header) + 2 * dim * sizeof(float) + rows * dim) return false;
+
+    SQ8Codec loaded;
+    loaded.vecdim = dim;
+    loaded.vmin.resize(dim);
+    loaded.step.resize(dim);
+    std::vector<uint8_t> loaded_codes(rows * dim);
+    fin.read((char*)loaded.vmin.data(), dim * sizeof(float));
+    fin.read((char*)loaded.step.data(), dim * sizeof(float));
+    fin.read((char*)loaded_codes.data(), loaded_codes.size());
+    if (!fin) return false;
+
+    codec = loaded;
+    codes.swap(loaded_codes);
+    n = rows;
+    return true;
+}
 
 float InnerProductSIMDNeonQuantized(const uint8_t* aq, const uint8_t* bq, size_t vecdim, float scale, float offset) {
     assert(vecdim % 16 == 0); // 确保是16的倍数
 
+#if defined(ANN_SIMD_NEON)
     uint32x4_t total_dot = vdupq_n_u32(0);
     uint32x4_t total_a = vdupq_n_u32(0);
     uint32x4_t total_b = vdupq_n_u32(0);
@@ -95,6 +218,41 @@ float InnerProductSIMDNeonQuantized(const uint8_t* aq, const uint8_t* bq, size_t
     uint32_t dot = vaddvq_u32(total_dot);
     uint32_t sum_a = vaddvq_u32(total_a);
     uint32_t sum_b = vaddvq_u32(total_b);
+#elif defined(ANN_SIMD_X86)
+    // x86基线SSE2：u8扩展成i16后用madd做乘加，结果不会溢出int32
+    __m128i zero = _mm_setzero_si128();
+    __m128i total_dot = zero, total_a = zero, total_b = zero;
+
+    for (size_t i = 0; i < vecdim; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(aq + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(bq + i));
+
+        __m128i va_low = _mm_unpacklo_epi8(va, zero);
+        __m128i va_high = _mm_unpackhi_epi8(va, zero);
+        __m128i vb_low = _mm_unpacklo_epi8(vb, zero);
+        __m128i vb_high = _mm_unpackhi_epi8(vb, zero);
+
+        total_dot = _mm_add_epi32(total_dot, _mm_madd_epi16(va_low, vb_low));
+        total_dot = _mm_add_epi32(total_dot, _mm_madd_epi16(va_high, vb_high));
+
+        // Σaq与Σbq用sad一次求出16个字节的和
+        total_a = _mm_add_epi64(total_a, _mm_sad_epu8(va, zero));
+        total_b = _mm_add_epi64(total_b, _mm_sad_epu8(vb, zero));
+    }
+
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, total_dot);
+    uint32_t dot = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    uint32_t sum_a = (uint32_t)(_mm_cvtsi128_si32(total_a) + _mm_cvtsi128_si32(_mm_srli_si128(total_a, 8)));
+    uint32_t sum_b = (uint32_t)(_mm_cvtsi128_si32(total_b) + _mm_cvtsi128_si32(_mm_srli_si128(total_b, 8)));
+#else
+    uint32_t dot = 0, sum_a = 0, sum_b = 0;
+    for (size_t i = 0; i < vecdim; ++i) {
+        dot += (uint32_t)aq[i] * bq[i];
+        sum_a += aq[i];
+        sum_b += bq[i];
+    }
+#endif
 
     // 反量化点积
     float inv_scale_sq = 1.0f / (scale * scale);
@@ -106,21 +264,25 @@ float InnerProductSIMDNeonQuantized(const uint8_t* aq, const uint8_t* bq, size_t
     return term1 - term2 + term3;
 }
 
-std::priority_queue<std::pair<float, uint32_t>> sq_simd_search(uint8_t* base, float* query, size_t base_number, size_t vecdim, size_t k, float* base_full) {
-    std::priority_queue<std::pair<float, uint32_t> > q;
+// [-1, 1]量化粗排默认保留的候选数（k的倍数）
+const size_t kSQRerankPerK = 2;
 
+// rerank为粗排保留、参与全精度重排的候选数，0表示k * kSQRerankPerK
+TopK<>& sq_simd_search(SearchContext& ctx, uint8_t* base, float* query, size_t base_number, size_t vecdim, size_t k,
+                       float* base_full, size_t rerank = 0) {
 	float min_val = -1.0f;
 	float max_val = 1.0f;
     float scale = 255.0f / (max_val - min_val);
     float offset = -min_val;
-    uint8_t* quantized_query = new uint8_t[vecdim];
+    uint8_t* quantized_query = SearchContext::buffer(ctx.quantized_query, vecdim);
 
 	// 先量化查询向量
 	QuantizeSIMD(query, quantized_query, vecdim, min_val, max_val);
 
     // 存储所有找到的候选近邻
-    size_t rerank = (size_t)(k * 2); // 设置rerank
-    std::priority_queue<std::pair<float, uint32_t>> candidates;
+    if (rerank == 0) rerank = k * kSQRerankPerK;
+    TopK<>& candidates = ctx.candidates;
+    candidates.reset(std::max(rerank, k));
 
 	for(int i = 0; i < base_number; ++i){
 		float dis = InnerProductSIMDNeonQuantized(base + i * vecdim, quantized_query, vecdim, scale, offset);
@@ -128,34 +290,88 @@ std::priority_queue<std::pair<float, uint32_t>> sq_simd_search(uint8_t* base, fl
         dis = 1-dis;
 
         // 存储候选项
-        if(candidates.size() < rerank){
-         candidates.push({dis, i});
-        }else{
-            if(dis < candidates.top().first){
-                candidates.push({dis, i});
-                candidates.pop();
-            }
+        candidates.push(dis, i);
+    }
+
+    // 进行全精度重排序，候选id取出后按块批量计算
+    candidates.compact();
+    TopK<>& q = ctx.result;
+    q.reset(k);
+    rerank_entries(candidates.begin(), candidates.end(), base_full, query, vecdim, q);
+    q.compact();
+    return q;
+}
+
+std::priority_queue<std::pair<float, uint32_t>> sq_simd_search(uint8_t* base, float* query, size_t base_number, size_t vecdim, size_t k,
+                                                               float* base_full, size_t rerank = 0) {
+    return sq_simd_search(thread_search_context(), base, query, base_number, vecdim, k, base_full, rerank).to_queue();
+}
+
+// 一条查询在SQ8Codec编码上的扫描。code_sums（每行编码之和，SQ8Codec::encode/sums）非空时
+// 权重再量化成int8，用整数点积SQ8DotBatch（VNNI/udot）；为空时用float权重的SQ8InnerProductBatch。
+// 权重放在ctx里，distances是const的，可以由多个线程同时调用
+class SQ8QueryScanner {
+public:
+    SQ8QueryScanner(SearchContext& ctx, const SQ8Codec& codec, const uint8_t* codes, const int32_t* code_sums,
+                    const float* query)
+        : codes_(codes), code_sums_(code_sums), vecdim_(codec.vecdim), weights_(nullptr), query_i8_(nullptr), scale_(1) {
+        if (code_sums != nullptr) {
+            query_i8_ = SearchContext::buffer(ctx.query_i8, vecdim_);
+            bias_ = codec.prepare_query_i8(query, query_i8_, scale_);
+        } else {
+            weights_ = SearchContext::buffer(ctx.lut, vecdim_);
+            bias_ = codec.prepare_query(query, weights_);
         }
     }
 
-    // 进行全精度重排序
-    while(!candidates.empty()){
-        auto cand = candidates.top();
-        candidates.pop();
-        int i = cand.second;
-        float dis = InnerProductSIMDNeon(base_full + i * vecdim, query, vecdim);
-        dis = 1 - dis;
-
-        // 维护最大堆
-        if (q.size() < k) {
-            q.push({dis, i});
+    // 从第start行起连续cnt行（cnt <= kBatchRows）的距离1 - <q, x>写入dis
+    void distances(size_t start, size_t cnt, float* dis) const {
+        const uint8_t* rows = codes_ + start * vecdim_;
+        if (query_i8_ != nullptr) {
+            int32_t dots[kBatchRows];
+            SQ8DotBatch(rows, code_sums_ + start, cnt, query_i8_, vecdim_, dots);
+            for (size_t j = 0; j < cnt; ++j) dis[j] = 1 - (bias_ + scale_ * dots[j]);
         } else {
-            if (dis < q.top().first) {
-                q.push({dis, i});
-                q.pop();
-            }
+            SQ8InnerProductBatch(rows, cnt, weights_, vecdim_, dis);
+            for (size_t j = 0; j < cnt; ++j) dis[j] = 1 - (bias_ + dis[j]);
         }
     }
-    delete[] quantized_query;
+
+private:
+    const uint8_t* codes_;
+    const int32_t* code_sums_;
+    size_t vecdim_;
+    float* weights_;
+    int8_t* query_i8_;
+    float scale_, bias_;
+};
+
+// 训练好的按维度量化（SQ8Codec）：量化步长折进query作为权重，扫描见SQ8QueryScanner，
+// 粗排保留rerank个候选后全精度重排。范围比[-1, 1]紧得多，候选可以少取
+TopK<>& sq_simd_search(SearchContext& ctx, const SQ8Codec& codec, const uint8_t* codes, float* query,
+                       size_t base_number, size_t vecdim, size_t k, float* base_full, size_t rerank,
+                       const int32_t* code_sums = nullptr) {
+    SQ8QueryScanner scanner(ctx, codec, codes, code_sums, query);
+
+    TopK<>& candidates = ctx.candidates;
+    candidates.reset(std::max(rerank, k));
+    float dis[kBatchRows];
+    for (size_t start = 0; start < base_number; start += kBatchRows) {
+        size_t cnt = std::min(kBatchRows, base_number - start);
+        scanner.distances(start, cnt, dis);
+        candidates.push_range(dis, cnt, start);
+    }
+
+    candidates.compact();
+    TopK<>& q = ctx.result;
+    q.reset(k);
+    rerank_entries(candidates.begin(), candidates.end(), base_full, query, vecdim, q);
+    q.compact();
     return q;
 }
+
+std::priority_queue<std::pair<float, uint32_t>> sq_simd_search(const SQ8Codec& codec, const uint8_t* codes, float* query,
+    size_t base_number, size_t vecdim, size_t k, float* base_full, size_t rerank, const int32_t* code_sums = nullptr) {
+    return sq_simd_search(thread_search_context(), codec, codes, query, base_number, vecdim, k, base_full, rerank,
+                          code_sums).to_queue();
+}
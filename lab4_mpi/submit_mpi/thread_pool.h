@@ -0,0 +1,163 @@
+#pragma once
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// 常驻线程池：代替每次查询都pthread_create/pthread_join。
+// 工作线程创建后绑核常驻，每次run()只需把任务交给它们：
+// 先自旋等待一小段时间（连续查询时基本都在这一步拿到任务），超时后在futex上睡眠，
+// 只有确实有线程在睡时才发起唤醒的系统调用。核数不够每个线程一个时不自旋，直接睡眠，
+// 否则自旋的线程会抢走干活线程的时间片。
+
+inline void pool_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+inline void pool_futex_wait(std::atomic<uint32_t>* addr, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+inline void pool_futex_wake(std::atomic<uint32_t>* addr) {
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+class ThreadPool {
+public:
+    // num_workers个工作线程，不含调用run()的线程
+    explicit ThreadPool(size_t num_workers) : spin_count_(0), stop_(false), generation_(0), running_(0),
+                                              sleeping_workers_(0), caller_sleeping_(0),
+                                              func_(nullptr), args_(nullptr), n_tasks_(0), next_task_(0) {
+        std::vector<int> cpus = allowed_cpus();
+        if (cpus.size() > num_workers) spin_count_ = kSpinCount;
+        // 可用的核够每个线程一个时才绑核，否则几个线程挤在同一个核上，不如交给调度器
+        bool pin = cpus.size() > num_workers && cpus.size() > 1;
+        threads_.resize(num_workers);
+        for (size_t i = 0; i < num_workers; ++i) {
+            pthread_create(&threads_[i], nullptr, worker_main, this);
+            // 调用者占cpus[0]，工作线程依次绑到后面允许的核上
+            if (pin) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpus[i + 1], &set);
+                pthread_setaffinity_np(threads_[i], sizeof(set), &set);
+            }
+        }
+    }
+
+    ~ThreadPool() {
+        stop_.store(true);
+        generation_.fetch_add(1);
+        pool_futex_wake(&generation_);
+        for (size_t i = 0; i < threads_.size(); ++i) pthread_join(threads_[i], nullptr);
+    }
+
+    size_t size() const { return threads_.size(); }
+
+    // 执行func(args[0..n))，调用线程也参与领取任务，返回时所有任务都已完成
+    void run(void* (*func)(void*), void** args, size_t n) {
+        if (threads_.empty() || n <= 1) {
+            for (size_t i = 0; i < n; ++i) func(args[i]);
+            return;
+        }
+
+        func_ = func;
+        args_ = args;
+        n_tasks_ = n;
+        next_task_.store(0);
+        running_.store(threads_.size());
+        generation_.fetch_add(1);
+        if (sleeping_workers_.load() > 0) pool_futex_wake(&generation_);
+
+        run_tasks();
+
+        // 等所有工作线程都离开这一轮，之后才能安全地开始下一轮
+        for (int spin = 0; running_.load() != 0; ++spin) {
+            if (spin < spin_count_) {
+                pool_cpu_relax();
+                continue;
+            }
+            caller_sleeping_.store(1);
+            uint32_t r = running_.load();
+            if (r != 0) pool_futex_wait(&running_, r);
+            caller_sleeping_.store(0);
+        }
+    }
+
+private:
+    // 本进程允许使用的核（taskset、cgroup等会限制），调用者当前所在的核排在最前面
+    static std::vector<int> allowed_cpus() {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) return cpus;
+        int self = sched_getcpu();
+        if (self >= 0 && CPU_ISSET(self, &set)) cpus.push_back(self);
+        for (int c = 0; c < CPU_SETSIZE; ++c) {
+            if (CPU_ISSET(c, &set) && c != self) cpus.push_back(c);
+        }
+        return cpus;
+    }
+
+    static const int kSpinCount = 2000;
+
+    void run_tasks() {
+        size_t i;
+        while ((i = next_task_.fetch_add(1)) < n_tasks_) func_(args_[i]);
+    }
+
+    static void* worker_main(void* arg) {
+        ThreadPool* pool = (ThreadPool*)arg;
+        uint32_t seen = 0;
+        while (true) {
+            // 等待新一轮任务
+            uint32_t gen;
+            for (int spin = 0; (gen = pool->generation_.load()) == seen; ++spin) {
+                if (spin < pool->spin_count_) {
+                    pool_cpu_relax();
+                    continue;
+                }
+                pool->sleeping_workers_.fetch_add(1);
+                if (pool->generation_.load() == seen) pool_futex_wait(&pool->generation_, seen);
+                pool->sleeping_workers_.fetch_sub(1);
+            }
+            seen = gen;
+            if (pool->stop_.load()) return nullptr;
+
+            pool->run_tasks();
+            if (pool->running_.fetch_sub(1) == 1 && pool->caller_sleeping_.load()) {
+                pool_futex_wake(&pool->running_);
+            }
+        }
+    }
+
+    std::vector<pthread_t> threads_;
+    int spin_count_;
+    std::atomic<bool> stop_;
+    std::atomic<uint32_t> generation_;       // 每轮run()加一，工作线程据此发现新任务
+    std::atomic<uint32_t> running_;          // 本轮还没结束的工作线程数
+    std::atomic<uint32_t> sleeping_workers_;
+    std::atomic<uint32_t> caller_sleeping_;
+
+    void* (*func_)(void*);
+    void** args_;
+    size_t n_tasks_;
+    std::atomic<size_t> next_task_;
+};
+
+// 进程内共用的线程池，需要的工作线程比现有的多时重建。
+// 和原来的pthread版本一样，假定同一时刻只有一个线程在发起查询
+inline ThreadPool& global_thread_pool(size_t num_workers) {
+    static std::unique_ptr<ThreadPool> pool;
+    if (!pool || pool->size() < num_workers) pool.reset(new ThreadPool(num_workers));
+    return *pool;
+}
@@ -0,0 +1,89 @@
+// 线程调度开销微基准：每次查询pthread_create/join与常驻线程池的对比
+// 编译：g++ thread_pool_bench.cc -o thread_pool_bench -O2 -lpthread -std=c++11
+// 运行：./thread_pool_bench [num_threads]
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include "thread_pool.h"
+#include "simd_dispatch.h"
+
+struct ScanArg {
+    const float* base;
+    const float* query;
+    size_t rows;
+    size_t vecdim;
+    float* out;
+};
+
+void* empty_task(void*) {
+    return nullptr;
+}
+
+// 模拟一个线程扫自己分到的簇
+void* scan_task(void* arg_void) {
+    ScanArg* arg = (ScanArg*)arg_void;
+    InnerProductBatch(arg->base, arg->query, arg->rows, arg->vecdim, arg->out);
+    return nullptr;
+}
+
+// 原来的做法：num_threads-1个新线程加主线程各执行一个任务
+void spawn_run(void* (*func)(void*), void** args, size_t n) {
+    std::vector<pthread_t> threads(n - 1);
+    for (size_t i = 0; i < n - 1; ++i) pthread_create(&threads[i], nullptr, func, args[i]);
+    func(args[n - 1]);
+    for (size_t i = 0; i < n - 1; ++i) pthread_join(threads[i], nullptr);
+}
+
+// 返回每次查询的平均微秒数
+template <class F>
+double TimePerQuery(F f, size_t repeat)
+{
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < repeat; ++r) f();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::micro>(t2 - t1).count() / repeat;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t num_threads = argc > 1 ? std::atoi(argv[1]) : 8;
+    const size_t vecdim = 96, repeat = 2000;
+    // DEEP100K上m=256时基本要扫完全部100000行，平分给各线程
+    const size_t total_rows = 100000;
+    size_t rows = total_rows / num_threads;
+
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> dist(-0.1f, 0.1f);
+    std::vector<float> base(rows * num_threads * vecdim), query(vecdim);
+    for (auto& x : base) x = dist(gen);
+    for (auto& x : query) x = dist(gen);
+    std::vector<float> out(rows * num_threads);
+
+    std::vector<ScanArg> scan_args(num_threads);
+    std::vector<void*> args(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        scan_args[i] = ScanArg{base.data() + i * rows * vecdim, query.data(), rows, vecdim, out.data() + i * rows};
+        args[i] = &scan_args[i];
+    }
+
+    ThreadPool pool(num_threads - 1);
+
+    double spawn_empty = TimePerQuery([&]() { spawn_run(empty_task, args.data(), num_threads); }, repeat);
+    double pool_empty = TimePerQuery([&]() { pool.run(empty_task, args.data(), num_threads); }, repeat);
+    double spawn_scan = TimePerQuery([&]() { spawn_run(scan_task, args.data(), num_threads); }, repeat / 10);
+    double pool_scan = TimePerQuery([&]() { pool.run(scan_task, args.data(), num_threads); }, repeat / 10);
+    // 单线程扫同样的行数，作为纯计算时间的参考
+    double serial_scan = TimePerQuery([&]() {
+        for (size_t i = 0; i < num_threads; ++i) scan_task(args[i]);
+    }, repeat / 10);
+
+    std::cout << num_threads << " threads, " << rows << " rows per thread, us per query\n";
+    std::cout << std::left << std::setw(10) << "" << std::setw(14) << "dispatch only" << std::setw(14) << "scan"
+              << "scan (1 thread: " << std::fixed << std::setprecision(1) << serial_scan << ")\n";
+    std::cout << std::setw(10) << "spawn" << std::setw(14) << spawn_empty << std::setw(14) << spawn_scan << "\n";
+    std::cout << std::setw(10) << "pool" << std::setw(14) << pool_empty << std::setw(14) << pool_scan << "\n";
+    return 0;
+}
@@ -0,0 +1,91 @@
+// top-k选择器微基准：对比std::priority_queue与TopK，k=10（最终结果）和k=1000（rerank = k*100）
+// 编译：g++ topk_bench.cc -o topk_bench -O2 -std=c++11
+// 运行：./topk_bench
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include "topk.h"
+
+// 距离流：uniform为随机顺序；descending为越来越近，每个元素都会替换堆顶，是堆的最坏情况
+std::vector<float> MakeDistances(size_t n, bool descending, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dist(0.0f, 2.0f);
+    std::vector<float> dis(n);
+    for (size_t i = 0; i < n; ++i) dis[i] = dist(gen);
+    if (descending) std::sort(dis.begin(), dis.end(), std::greater<float>());
+    return dis;
+}
+
+float HeapSelect(const std::vector<float>& dis, size_t k)
+{
+    std::priority_queue<std::pair<float, uint32_t>> q;
+    for (size_t i = 0; i < dis.size(); ++i) {
+        if (q.size() < k) {
+            q.push({dis[i], (uint32_t)i});
+        } else if (dis[i] < q.top().first) {
+            q.push({dis[i], (uint32_t)i});
+            q.pop();
+        }
+    }
+    return q.top().first;
+}
+
+template <class T>
+float TopKSelect(const std::vector<float>& dis, size_t k)
+{
+    T q(k);
+    for (size_t i = 0; i < dis.size(); ++i) q.push(dis[i], i);
+    return q.to_queue().top().first;
+}
+
+template <class T>
+float TopKSelectRange(const std::vector<float>& dis, size_t k)
+{
+    T q(k);
+    q.push_range(dis.data(), dis.size(), 0);
+    return q.to_queue().top().first;
+}
+
+// 返回每个元素的平均纳秒数
+template <class F>
+double Time(F f, const std::vector<float>& dis, size_t k, size_t repeat, float& kth)
+{
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < repeat; ++r) kth = f(dis, k);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(t2 - t1).count() / (dis.size() * repeat);
+}
+
+template <size_t K>
+void Run(const std::vector<float>& dis, const char* name, size_t repeat)
+{
+    float h = 0, a = 0, b = 0, c = 0;
+    double th = Time(HeapSelect, dis, K, repeat, h);
+    double ta = Time(TopKSelect<TopK<K>>, dis, K, repeat, a);
+    double tb = Time(TopKSelectRange<TopK<K>>, dis, K, repeat, b);
+    double tc = Time(TopKSelectRange<TopK<>>, dis, K, repeat, c);
+    std::cout << std::left << std::setw(12) << name << std::setw(6) << K << std::fixed << std::setprecision(2)
+              << std::setw(10) << th << std::setw(10) << ta << std::setw(10) << tb << std::setw(10) << tc
+              << (h == a && h == b && h == c ? "ok" : "MISMATCH") << "\n";
+}
+
+int main()
+{
+    const size_t n = 100000, repeat = 50;
+    std::vector<float> uniform = MakeDistances(n, false, 1);
+    std::vector<float> descending = MakeDistances(n, true, 1);
+
+    std::cout << "ns per element, " << n << " distances x " << repeat << "\n";
+    std::cout << std::left << std::setw(12) << "stream" << std::setw(6) << "k" << std::setw(10) << "heap"
+              << std::setw(10) << "push" << std::setw(10) << "push16" << std::setw(10) << "dyn16" << "check\n";
+    Run<10>(uniform, "uniform", repeat);
+    Run<1000>(uniform, "uniform", repeat);
+    Run<10>(descending, "descending", repeat);
+    Run<1000>(descending, "descending", repeat);
+    return 0;
+}
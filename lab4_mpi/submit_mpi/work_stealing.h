@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// 探测簇的工作窃取调度：选中的簇按kStealChunkRows行切成小块，
+// 依次平均分到每个线程的双端队列里。线程先从自己队列的头部取，取空后从别的线程队列尾部偷，
+// 这样某个簇特别大或者某个线程被耽搁时，剩下的块会被空闲线程分走。
+// 队列在查询开始前一次填好，运行期间只出不进，所以每个队列只需一个64位原子量
+// （高32位为头、低32位为尾），取和偷都用CAS，不需要锁。
+
+const uint32_t kStealChunkRows = 256;
+
+struct ScanChunk {
+    uint32_t begin;   // new_base中的行区间[begin, end)
+    uint32_t end;
+    float bias;       // 块内所有行共用的附加项（IVFPQ里是簇中心的内积），不需要时为0
+};
+
+class ChunkQueues {
+public:
+    explicit ChunkQueues(size_t num_threads) : slots_(num_threads) {}
+
+    // 清空后给下一条查询复用，已有的块缓冲不释放
+    void reset(size_t num_threads) {
+        chunks_.clear();
+        if (slots_.size() != num_threads) slots_ = std::vector<Slot>(num_threads);
+    }
+
+    // 把簇[begin, end)切块追加，之后调用distribute()分配到各线程
+    void add_cluster(uint32_t begin, uint32_t end, float bias = 0) {
+        for (uint32_t b = begin; b < end; b += kStealChunkRows) {
+            chunks_.push_back(ScanChunk{b, std::min(end, b + kStealChunkRows), bias});
+        }
+    }
+
+    // 第i块分给第i % num_threads个线程，每个线程都分到远近不同的簇
+    // （IVFPQ每个线程只保留有限的粗排候选，集中把最近的簇给一个线程会降低召回）
+    void distribute() {
+        size_t n = chunks_.size(), t = slots_.size();
+        ordered_.clear();
+        for (size_t i = 0; i < t; ++i) {
+            uint64_t head = ordered_.size();
+            for (size_t j = i; j < n; j += t) ordered_.push_back(chunks_[j]);
+            slots_[i].range.store(head << 32 | ordered_.size());
+        }
+        chunks_.swap(ordered_);
+    }
+
+    size_t num_threads() const { return slots_.size(); }
+
+    // 取下一块：先取自己的，再按tid+1, tid+2...的顺序去偷
+    bool next(size_t tid, ScanChunk& out) {
+        if (pop_front(tid, out)) return true;
+        for (size_t i = 1; i < slots_.size(); ++i) {
+            if (pop_back((tid + i) % slots_.size(), out)) return true;
+        }
+        return false;
+    }
+
+private:
+    bool pop_front(size_t tid, ScanChunk& out) {
+        std::atomic<uint64_t>& range = slots_[tid].range;
+        uint64_t r = range.load();
+        while (true) {
+            uint64_t head = r >> 32, tail = r & 0xFFFFFFFFu;
+            if (head >= tail) return false;
+            if (range.compare_exchange_weak(r, (head + 1) << 32 | tail)) {
+                out = chunks_[head];
+                return true;
+            }
+        }
+    }
+
+    bool pop_back(size_t victim, ScanChunk& out) {
+        std::atomic<uint64_t>& range = slots_[victim].range;
+        uint64_t r = range.load();
+        while (true) {
+            uint64_t head = r >> 32, tail = r & 0xFFFFFFFFu;
+            if (head >= tail) return false;
+            if (range.compare_exchange_weak(r, head << 32 | (tail - 1))) {
+                out = chunks_[tail - 1];
+                return true;
+            }
+        }
+    }
+
+    // 每个队列占满64字节，避免线程之间的伪共享。C++11的std::allocator不保证alignas(64)的对齐，
+    // 所以不靠对齐而是显式填充：相邻两个range相隔64字节，无论数组从哪里开始都落在不同的cache line上
+    struct Slot {
+        std::atomic<uint64_t> range;
+        char pad[64 - sizeof(std::atomic<uint64_t>)];
+        Slot() : range(0) {}
+    };
+
+    std::vector<ScanChunk> chunks_;
+    std::vector<ScanChunk> ordered_;  // distribute()的临时缓冲，与chunks_交换使用
+    std::vector<Slot> slots_;
+};
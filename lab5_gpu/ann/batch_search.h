@@ -1,4 +1,19 @@
+#pragma once
 #include <queue>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <omp.h>
+#include "simd_dispatch.h"
+#include "topk.h"
+#include "coarse_quantizer.h"
+
+// CPU批量暴力搜索，按GEMM的方式分块：
+// base按kBatchBaseBlock行一块分给各线程，块内再打包成16行一组（PackTileRows）；
+// query按kBatchQueryBlock条一块，打包好的16行与一块query用InnerProductTile算出距离tile，
+// 随后整段送进该线程自己的每条query的TopK，最后按query合并各线程的结果
+const size_t kBatchBaseBlock = 512;   // 512行*96维打包后192KB，留在L2
+const size_t kBatchQueryBlock = 64;   // 64条query共24KB，留在L1
 
 std::vector<std::priority_queue<std::pair<float, uint32_t>>> flat_batch_search(
     float* base,           // base[n][d]
@@ -8,24 +23,155 @@ std::vector<std::priority_queue<std::pair<float, uint32_t>>> flat_batch_search(
     size_t vecdim,         // d
     size_t k
 ) {
+    int num_threads = omp_get_max_threads();
+    // 每个线程对每条query维护一个局部top-k
+    std::vector<std::vector<TopK<>>> local_topks(num_threads, std::vector<TopK<>>(query_number, TopK<>(k)));
+    size_t n_blocks = (base_number + kBatchBaseBlock - 1) / kBatchBaseBlock;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        auto& topks = local_topks[omp_get_thread_num()];
+        std::vector<float> packed(kBatchBaseBlock * vecdim);
+        std::vector<float> tile(kBatchQueryBlock * kTileRows);
+
+        #pragma omp for schedule(dynamic)
+        for (long long b = 0; b < (long long)n_blocks; ++b) {
+            size_t begin = b * kBatchBaseBlock;
+            size_t rows = std::min(kBatchBaseBlock, base_number - begin);
+            size_t n_panels = (rows + kTileRows - 1) / kTileRows;
+
+            // 打包：每16行转置成[vecdim][16]
+            for (size_t p = 0; p < n_panels; ++p) {
+                size_t cnt = std::min(kTileRows, rows - p * kTileRows);
+                PackTileRows(base + (begin + p * kTileRows) * vecdim, cnt, vecdim, packed.data() + p * kTileRows * vecdim);
+            }
+
+            for (size_t q0 = 0; q0 < query_number; q0 += kBatchQueryBlock) {
+                size_t nq = std::min(kBatchQueryBlock, query_number - q0);
+
+                for (size_t p = 0; p < n_panels; ++p) {
+                    size_t cnt = std::min(kTileRows, rows - p * kTileRows);
+                    InnerProductTile(packed.data() + p * kTileRows * vecdim, query + q0 * vecdim, nq, vecdim, tile.data());
+
+                    for (size_t qi = 0; qi < nq; ++qi) {
+                        float* dis = tile.data() + qi * kTileRows;
+                        for (size_t r = 0; r < cnt; ++r) dis[r] = 1 - dis[r];
+                        topks[q0 + qi].push_range(dis, cnt, begin + p * kTileRows);
+                    }
+                }
+            }
+        }
+    }
+
+    // 合并各线程的top-k
     std::vector<std::priority_queue<std::pair<float, uint32_t>>> result(query_number);
+    #pragma omp parallel for num_threads(num_threads)
+    for (long long qid = 0; qid < (long long)query_number; ++qid) {
+        TopK<> final_topk(k);
+        for (int t = 0; t < num_threads; ++t) final_topk.merge(local_topks[t][qid]);
+        result[qid] = final_topk.to_queue();
+    }
+    return result;
+}
 
-    for (size_t i = 0; i < base_number; ++i) {
-        for (size_t qid = 0; qid < query_number; ++qid) {
-            float dis = 0.0f;
-            for (size_t d = 0; d < vecdim; ++d) {
-                dis += base[i * vecdim + d] * query[qid * vecdim + d];
+// 批量IVF搜索，参数与ivf_search_cuda一致。
+// 1. 粗排：CoarseQuantizer把整批query与打包好的centroids按小GEMM计算，每条query选出最近的m个簇
+// 2. 按簇把探测它的query归到一起
+// 3. 每个簇只扫一次：簇内的行打包后与探测它的所有query一起用InnerProductTile计算，
+//    同一簇的new_base只从内存读一次，后续都命中缓存
+std::vector<std::priority_queue<std::pair<float, uint32_t>>> ivf_batch_search(
+    float* query,           // [batch][vecdim]
+    float* centroids,       // [n_clusters][vecdim]
+    float* new_base,        // [N][vecdim]
+    uint32_t* new_to_old,   // [N]
+    uint32_t* cluster_start,// [n_clusters + 1]
+    size_t vecdim,          // 向量维度
+    size_t k,               // top-k
+    size_t n_clusters,      // 聚类中心数量
+    size_t m,               // nprobe（每个query选择m个簇）
+    size_t batch_size       // 查询向量数量
+) {
+    int num_threads = omp_get_max_threads();
+    m = std::min(m, n_clusters);
+
+    // 1. 粗排
+    const CoarseQuantizer& quantizer = shared_coarse_quantizer(centroids, n_clusters, vecdim);
+    std::vector<uint32_t> probes(batch_size * m);
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+    for (long long q0 = 0; q0 < (long long)batch_size; q0 += kBatchQueryBlock) {
+        size_t nq = std::min(kBatchQueryBlock, batch_size - (size_t)q0);
+        quantizer.search_batch(query + q0 * vecdim, nq, m, probes.data() + q0 * m);
+    }
+
+    // 2. 倒排：每个簇被哪些query探测
+    std::vector<std::vector<uint32_t>> cluster_queries(n_clusters);
+    for (size_t qid = 0; qid < batch_size; ++qid) {
+        for (size_t j = 0; j < m; ++j) cluster_queries[probes[qid * m + j]].push_back(qid);
+    }
+
+    // 大簇、被探测多的簇先做，减少最后的负载不均
+    std::vector<uint32_t> order;
+    for (size_t c = 0; c < n_clusters; ++c) {
+        if (!cluster_queries[c].empty()) order.push_back(c);
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return (size_t)(cluster_start[a + 1] - cluster_start[a]) * cluster_queries[a].size() >
+               (size_t)(cluster_start[b + 1] - cluster_start[b]) * cluster_queries[b].size();
+    });
+
+    // 3. 按簇扫描，每个线程对每条query维护一个局部top-k
+    std::vector<std::vector<TopK<>>> local_topks(num_threads, std::vector<TopK<>>(batch_size, TopK<>(k)));
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        auto& topks = local_topks[omp_get_thread_num()];
+        std::vector<float> packed;
+        std::vector<float> query_block(kBatchQueryBlock * vecdim);
+        std::vector<float> tile(kBatchQueryBlock * kTileRows);
+
+        #pragma omp for schedule(dynamic)
+        for (long long oi = 0; oi < (long long)order.size(); ++oi) {
+            uint32_t cid = order[oi];
+            uint32_t begin = cluster_start[cid];
+            size_t rows = cluster_start[cid + 1] - begin;
+            size_t n_panels = (rows + kTileRows - 1) / kTileRows;
+            const std::vector<uint32_t>& qids = cluster_queries[cid];
+
+            // 簇内的行打包一次，供所有探测它的query共用
+            packed.resize(n_panels * kTileRows * vecdim);
+            for (size_t p = 0; p < n_panels; ++p) {
+                size_t cnt = std::min(kTileRows, rows - p * kTileRows);
+                PackTileRows(new_base + (begin + p * kTileRows) * vecdim, cnt, vecdim, packed.data() + p * kTileRows * vecdim);
             }
-            dis = 1.0f - dis;
-
-            auto& q = result[qid];
-            if (q.size() < k) {
-                q.emplace(dis, i);
-            } else if (dis < q.top().first) {
-                q.emplace(dis, i);
-                q.pop();
+
+            for (size_t q0 = 0; q0 < qids.size(); q0 += kBatchQueryBlock) {
+                size_t nq = std::min(kBatchQueryBlock, qids.size() - q0);
+                // 探测该簇的query不连续，先收集到一块
+                for (size_t qi = 0; qi < nq; ++qi) {
+                    memcpy(query_block.data() + qi * vecdim, query + (size_t)qids[q0 + qi] * vecdim, vecdim * sizeof(float));
+                }
+
+                for (size_t p = 0; p < n_panels; ++p) {
+                    size_t cnt = std::min(kTileRows, rows - p * kTileRows);
+                    InnerProductTile(packed.data() + p * kTileRows * vecdim, query_block.data(), nq, vecdim, tile.data());
+
+                    for (size_t qi = 0; qi < nq; ++qi) {
+                        float* dis = tile.data() + qi * kTileRows;
+                        for (size_t r = 0; r < cnt; ++r) dis[r] = 1 - dis[r];
+                        topks[qids[q0 + qi]].push_ids(dis, cnt, new_to_old + begin + p * kTileRows);
+                    }
+                }
             }
         }
     }
+
+    // 合并各线程的top-k
+    std::vector<std::priority_queue<std::pair<float, uint32_t>>> result(batch_size);
+    #pragma omp parallel for num_threads(num_threads)
+    for (long long qid = 0; qid < (long long)batch_size; ++qid) {
+        TopK<> final_topk(k);
+        for (int t = 0; t < num_threads; ++t) final_topk.merge(local_topks[t][qid]);
+        result[qid] = final_topk.to_queue();
+    }
     return result;
 }
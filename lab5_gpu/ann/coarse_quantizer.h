@@ -0,0 +1,110 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+#include "simd_dispatch.h"
+#include "topk.h"
+
+// IVF粗排：给query选出内积最大（距离1 - 内积最小）的m个簇中心。
+// 中心每kTileRows个一组转置打包（PackTileRows），用inner_product_tile一次算一组query与16个中心的内积，
+// 多条query时就是一个小GEMM；每组16个距离整块送进TopK，组内最小值不低于阈值时整组跳过。
+// 簇很多（4096以上）时这一步比逐个中心算点积再partial_sort快得多。
+
+// search_batch每次一起计算的query数，64条96维query共24KB，留在L1
+const size_t kCoarseQueryBlock = 64;
+// search每次计算的中心组数，16组共256个中心
+const size_t kCoarsePanels = 16;
+
+class CoarseQuantizer {
+public:
+    typedef std::pair<float, uint32_t> Entry;
+
+    CoarseQuantizer(const float* centroids, size_t n_clusters, size_t vecdim)
+        : centroids_(centroids), n_clusters_(n_clusters), vecdim_(vecdim),
+          n_panels_((n_clusters + kTileRows - 1) / kTileRows), packed_(n_panels_ * kTileRows * vecdim) {
+        for (size_t p = 0; p < n_panels_; ++p) {
+            size_t cnt = std::min(kTileRows, n_clusters - p * kTileRows);
+            PackTileRows(centroids + p * kTileRows * vecdim, cnt, vecdim, packed_.data() + p * kTileRows * vecdim);
+        }
+    }
+
+    const float* centroids() const { return centroids_; }
+    size_t n_clusters() const { return n_clusters_; }
+    size_t vecdim() const { return vecdim_; }
+
+    // 单条query：topk需已设为k = m，选出的m个簇按距离从小到大写入out[0..m)，返回实际个数（不超过n_clusters）
+    size_t search(const float* query, size_t m, TopK<>& topk, Entry* out) const {
+        m = std::min(m, n_clusters_);
+        topk.clear();
+        // 每次kCoarsePanels组，多组的累加器交替计算
+        float tile[kCoarsePanels * kTileRows];
+        for (size_t p = 0; p < n_panels_; p += kCoarsePanels) {
+            size_t np = std::min(kCoarsePanels, n_panels_ - p);
+            InnerProductPanels(packed_.data() + p * kTileRows * vecdim_, np, query, vecdim_, tile);
+            for (size_t i = 0; i < np; ++i) push_panel(tile + i * kTileRows, p + i, topk);
+        }
+        return finish(topk, m, out);
+    }
+
+    // 多条query：queries[nq][vecdim]，第q条的m个簇按距离从小到大写入labels[q*m ..]，
+    // distances非空时同时写入距离。m超过n_clusters时多出的位置填UINT32_MAX
+    void search_batch(const float* queries, size_t nq, size_t m, uint32_t* labels, float* distances = nullptr) const {
+        size_t mm = std::min(m, n_clusters_);
+        std::vector<TopK<>> topks(std::min(nq, kCoarseQueryBlock), TopK<>(std::max<size_t>(mm, 1)));
+        std::vector<float> tiles(kCoarseQueryBlock * kTileRows);
+        std::vector<Entry> sorted(mm);
+        for (size_t q0 = 0; q0 < nq; q0 += kCoarseQueryBlock) {
+            size_t cnt = std::min(kCoarseQueryBlock, nq - q0);
+            for (size_t q = 0; q < cnt; ++q) topks[q].clear();
+            // 中心的一组16个在寄存器里复用给整块query
+            for (size_t p = 0; p < n_panels_; ++p) {
+                InnerProductTile(packed_.data() + p * kTileRows * vecdim_, queries + q0 * vecdim_, cnt, vecdim_, tiles.data());
+                for (size_t q = 0; q < cnt; ++q) push_panel(tiles.data() + q * kTileRows, p, topks[q]);
+            }
+            for (size_t q = 0; q < cnt; ++q) {
+                size_t got = finish(topks[q], mm, sorted.data());
+                for (size_t j = 0; j < m; ++j) {
+                    labels[(q0 + q) * m + j] = j < got ? sorted[j].second : UINT32_MAX;
+                    if (distances) distances[(q0 + q) * m + j] = j < got ? sorted[j].first : 1e30f;
+                }
+            }
+        }
+    }
+
+private:
+    // 一组内积转成距离后送进top-k，最后一组只取实际存在的中心
+    void push_panel(float* tile, size_t p, TopK<>& topk) const {
+        size_t cnt = std::min(kTileRows, n_clusters_ - p * kTileRows);
+        for (size_t r = 0; r < kTileRows; ++r) tile[r] = 1 - tile[r];
+        topk.push_range(tile, cnt, p * kTileRows);
+    }
+
+    size_t finish(TopK<>& topk, size_t m, Entry* out) const {
+        topk.compact();
+        size_t n = std::min(m, topk.size());
+        std::copy(topk.begin(), topk.begin() + n, out);
+        std::sort(out, out + n);
+        return n;
+    }
+
+    const float* centroids_;
+    size_t n_clusters_;
+    size_t vecdim_;
+    size_t n_panels_;
+    std::vector<float> packed_;   // [n_panels][vecdim][16]
+};
+
+// 按centroids指针缓存打包好的粗排器，供只拿到centroids指针的search函数共用。
+// centroids的内容在进程内不再改变；查找加锁，多个线程可以同时查询
+inline const CoarseQuantizer& shared_coarse_quantizer(const float* centroids, size_t n_clusters, size_t vecdim) {
+    static std::vector<std::unique_ptr<CoarseQuantizer>> cache;
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& q : cache) {
+        if (q->centroids() == centroids && q->n_clusters() == n_clusters && q->vecdim() == vecdim) return *q;
+    }
+    cache.emplace_back(new CoarseQuantizer(centroids, n_clusters, vecdim));
+    return *cache.back();
+}
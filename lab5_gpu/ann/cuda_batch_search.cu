@@ -287,9 +287,9 @@ __global__ void ivf_batch_search_kernel(
     }
 }
 
-std::vector<std::priority_queue<std::pair<float, uint32_t>>> ivf_search_cuda(
+// 粗排已在CPU上完成，selected_clusters[batch][m]为每个query选中的簇
+std::vector<std::priority_queue<std::pair<float, uint32_t>>> ivf_search_cuda_probes(
     float* query,           // [batch][vecdim]
-    float* centroids,       // [n_clusters][vecdim]
     float* new_base,        // [N][vecdim]
     uint32_t* new_to_old,   // [N]
     uint32_t* cluster_start,// [n_clusters + 1]
@@ -297,24 +297,9 @@ std::vector<std::priority_queue<std::pair<float, uint32_t>>> ivf_search_cuda(
     size_t k,             
     size_t n_clusters,     
     size_t m,               
-    size_t batch_size     
+    size_t batch_size,
+    const uint32_t* selected_clusters
 ) {
-    std::vector<uint32_t> selected_clusters(batch_size * m);
-    for (size_t qid = 0; qid < batch_size; ++qid) {
-        std::vector<std::pair<float, uint32_t>> dist_id;
-        for (size_t cid = 0; cid < n_clusters; ++cid) {
-            float dot = 0.0f;
-            for (size_t j = 0; j < vecdim; ++j) {
-                dot += query[qid * vecdim + j] * centroids[cid * vecdim + j];
-            }
-            float dist = 1.0f - dot;
-            dist_id.emplace_back(dist, cid);
-        }
-        std::partial_sort(dist_id.begin(), dist_id.begin() + m, dist_id.end());
-        for (size_t i = 0; i < m; ++i) {
-            selected_clusters[qid * m + i] = dist_id[i].second;
-        }
-    }
 
     // 分配显存
     float *d_query, *d_new_base, *d_out_dist;
@@ -334,7 +319,7 @@ std::vector<std::priority_queue<std::pair<float, uint32_t>>> ivf_search_cuda(
     CUDA_CHECK(cudaMemcpy(d_new_base, new_base, total_base * vecdim * sizeof(float), cudaMemcpyHostToDevice));
     CUDA_CHECK(cudaMemcpy(d_new_to_old, new_to_old, total_base * sizeof(uint32_t), cudaMemcpyHostToDevice));
     CUDA_CHECK(cudaMemcpy(d_cluster_start, cluster_start, (n_clusters + 1) * sizeof(uint32_t), cudaMemcpyHostToDevice));
-    CUDA_CHECK(cudaMemcpy(d_selected_clusters, selected_clusters.data(), batch_size * m * sizeof(uint32_t), cudaMemcpyHostToDevice));
+    CUDA_CHECK(cudaMemcpy(d_selected_clusters, selected_clusters, batch_size * m * sizeof(uint32_t), cudaMemcpyHostToDevice));
 
     // 启动核函数
     size_t threads = 128;
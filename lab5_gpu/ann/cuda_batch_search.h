@@ -7,7 +7,27 @@ std::vector<std::priority_queue<std::pair<float, uint32_t>>> flat_search_cuda(
     size_t n, size_t m, size_t d, size_t k
 );
 
-std::vector<std::priority_queue<std::pair<float, uint32_t>>> ivf_search_cuda(
+// 扫描部分，selected_clusters[batch][m]为每个query要探测的簇
+std::vector<std::priority_queue<std::pair<float, uint32_t>>> ivf_search_cuda_probes(
+    float* query,           // [batch][vecdim]
+    float* new_base,        // [N][vecdim]
+    uint32_t* new_to_old,   // [N]
+    uint32_t* cluster_start,// [n_clusters + 1]
+    size_t vecdim,          // 向量维度
+    size_t k,               // top-k
+    size_t n_clusters,      // 聚类中心数量
+    size_t m,               // nprobe（每个query选择m个簇）
+    size_t batch_size,      // 查询向量数量
+    const uint32_t* selected_clusters
+);
+
+// 粗排用的SIMD内核nvcc编译不了，这部分只在主机侧的翻译单元里定义
+#ifndef __CUDACC__
+#include <omp.h>
+#include "coarse_quantizer.h"
+
+// 粗排在CPU上用CoarseQuantizer批量完成，再交给GPU扫描选中的簇
+inline std::vector<std::priority_queue<std::pair<float, uint32_t>>> ivf_search_cuda(
     float* query,           // [batch][vecdim]
     float* centroids,       // [n_clusters][vecdim]
     float* new_base,        // [N][vecdim]
@@ -18,4 +38,16 @@ std::vector<std::priority_queue<std::pair<float, uint32_t>>> ivf_search_cuda(
     size_t n_clusters,      // 聚类中心数量
     size_t m,               // nprobe（每个query选择m个簇）
     size_t batch_size       // 查询向量数量
-);
+) {
+    m = std::min(m, n_clusters);
+    const CoarseQuantizer& quantizer = shared_coarse_quantizer(centroids, n_clusters, vecdim);
+    std::vector<uint32_t> selected_clusters(batch_size * m);
+    #pragma omp parallel for schedule(dynamic)
+    for (long long q0 = 0; q0 < (long long)batch_size; q0 += kCoarseQueryBlock) {
+        size_t nq = std::min(kCoarseQueryBlock, batch_size - (size_t)q0);
+        quantizer.search_batch(query + q0 * vecdim, nq, m, selected_clusters.data() + q0 * m);
+    }
+    return ivf_search_cuda_probes(query, new_base, new_to_old, cluster_start, vecdim, k, n_clusters, m, batch_size,
+                                  selected_clusters.data());
+}
+#endif
@@ -134,6 +134,9 @@ int main(int argc, char *argv[])
         // cpu-batch
         // auto res = flat_batch_search(base, test_query + i * vecdim, base_number, actual_batch, vecdim, k);
 
+        // cpu-ivf-batch
+        // auto res = ivf_batch_search(test_query + i * vecdim, ivf_center, ivf_data, ivf_index, ivf_offset, vecdim, k, ivf_n_clusters, 256, actual_batch);
+
         // gpu-cuda
 		// std::vector<std::priority_queue<std::pair<float, uint32_t>>> res(actual_batch);
 		if(i == 0) std::cout<<"begin\n";
@@ -0,0 +1,543 @@
+#pragma once
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "simd_types.h"
+
+#ifdef ANN_SIMD_X86
+#include <cpuid.h>
+#endif
+
+// 运行时SIMD分派：启动时按CPUID选出最高可用的后端，所有内核通过SimdKernels函数表调用
+// 可以用环境变量 ANN_SIMD=scalar/neon/sse4/avx2/avx512 强制指定（不支持时退回最高可用级别）
+
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_NEON,
+    SIMD_SSE4,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    SIMD_LEVEL_COUNT
+};
+
+struct SimdKernels {
+    SimdLevel level;
+    const char* name;
+    // 8路/16路累加的内积，vecdim需是对应路数的倍数
+    float (*inner_product8)(const float* a, const float* b, size_t vecdim);
+    float (*inner_product16)(const float* a, const float* b, size_t vecdim);
+    // 16项查表累加：out[l] = Σ_j tables[j*16 + idx[j*16 + l]]，共nsub段
+    void (*lut16_sum)(const uint8_t* tables, const uint8_t* idx, size_t nsub, uint16_t* out);
+    // n行与同一个query的内积：ids为空时取base中连续的n行，否则取base[ids[i]]行
+    void (*inner_product_batch)(const float* base, const uint32_t* ids, size_t n,
+                                const float* query, size_t vecdim, float* out);
+    // GEMM式分块内积：packed为PackTileRows打包好的16行base，out[q*16 + r]为第q条query与第r行的内积
+    void (*inner_product_tile)(const float* packed, const float* query, size_t nq, size_t vecdim, float* out);
+    // 单条query与n_panels组PackTileRows打包好的16行（每组vecdim * 16个float，依次相连）的内积，
+    // out[p*16 + r]为第p组第r行的内积
+    void (*inner_product_panels)(const float* packed, size_t n_panels, const float* query, size_t vecdim, float* out);
+};
+
+// inner_product_tile一次处理的base行数
+const size_t kTileRows = 16;
+
+inline const char* simd_level_name(SimdLevel level) {
+    static const char* names[SIMD_LEVEL_COUNT] = {"scalar", "neon", "sse4", "avx2", "avx512"};
+    return level < SIMD_LEVEL_COUNT ? names[level] : "unknown";
+}
+
+// ------------------------------- CPU检测 -------------------------------
+// 参照hnswlib.h中AVXCapable()/AVX512Capable()的做法，额外检查AVX2与FMA
+
+#ifdef ANN_SIMD_X86
+static inline void simd_cpuid(unsigned int out[4], unsigned int leaf, unsigned int subleaf) {
+    __cpuid_count(leaf, subleaf, out[0], out[1], out[2], out[3]);
+}
+
+static inline uint64_t simd_xgetbv(unsigned int index) {
+    uint32_t eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((uint64_t)edx << 32) | eax;
+}
+
+inline bool SimdSSE4Capable() {
+    unsigned int info[4];
+    if (__get_cpuid_max(0, nullptr) < 1) return false;
+    simd_cpuid(info, 1, 0);
+    bool ssse3 = (info[2] & (1u << 9)) != 0;
+    bool sse41 = (info[2] & (1u << 19)) != 0;
+    return ssse3 && sse41;
+}
+
+inline bool SimdAVX2Capable() {
+    unsigned int info[4];
+    if (__get_cpuid_max(0, nullptr) < 7) return false;
+
+    // CPU support
+    simd_cpuid(info, 1, 0);
+    bool fma = (info[2] & (1u << 12)) != 0;
+    bool osxsave = (info[2] & (1u << 27)) != 0;
+    bool avx = (info[2] & (1u << 28)) != 0;
+    simd_cpuid(info, 7, 0);
+    bool avx2 = (info[1] & (1u << 5)) != 0;
+    if (!(fma && osxsave && avx && avx2)) return false;
+
+    // OS support，需要保存XMM/YMM状态
+    return (simd_xgetbv(0) & 0x6) == 0x6;
+}
+
+inline bool SimdAVX512Capable() {
+    if (!SimdAVX2Capable()) return false;
+
+    unsigned int info[4];
+    simd_cpuid(info, 7, 0);
+    bool avx512f = (info[1] & (1u << 16)) != 0;
+
+    // OS support，还需要保存opmask与ZMM状态
+    return avx512f && (simd_xgetbv(0) & 0xe6) == 0xe6;
+}
+#endif
+
+inline bool simd_level_supported(SimdLevel level) {
+    switch (level) {
+    case SIMD_SCALAR:
+        return true;
+#ifdef ANN_SIMD_NEON
+    case SIMD_NEON:
+        return true;
+#endif
+#ifdef ANN_SIMD_X86
+    case SIMD_SSE4:
+        return SimdSSE4Capable();
+    case SIMD_AVX2:
+        return SimdAVX2Capable();
+    case SIMD_AVX512:
+        return SimdAVX512Capable();
+#endif
+    default:
+        return false;
+    }
+}
+
+inline SimdLevel simd_best_level() {
+    for (int l = SIMD_LEVEL_COUNT - 1; l > SIMD_SCALAR; --l) {
+        if (simd_level_supported((SimdLevel)l)) return (SimdLevel)l;
+    }
+    return SIMD_SCALAR;
+}
+
+// ------------------------------- 内核 -------------------------------
+
+// 通用内积模板，V为各后端的simd封装
+template <class V>
+inline float InnerProductKernel(const float* a, const float* b, size_t vecdim) {
+    V sum;
+    for (size_t i = 0; i < vecdim; i += V::kLanes) {
+        sum = V::fmadd(V(a + i), V(b + i), sum);
+    }
+    return sum.reduce_add();
+}
+
+// 多行分块内积：R行为一组，每段query只载入一次供R行共用，
+// R个累加器互不依赖，横向规约推迟到整行算完后4个一起做
+template <class V, int R>
+inline void InnerProductRows(const float* const* rows, const float* query, size_t vecdim, float* out) {
+    V acc[R];
+    for (size_t i = 0; i < vecdim; i += V::kLanes) {
+        V q(query + i);
+#pragma GCC unroll 8
+        for (int r = 0; r < R; ++r) acc[r] = V::fmadd(V(rows[r] + i), q, acc[r]);
+    }
+#pragma GCC unroll 2
+    for (int r = 0; r < R; r += 4) V::reduce_add4(acc[r], acc[r + 1], acc[r + 2], acc[r + 3], out + r);
+}
+
+inline const float* BatchRow(const float* base, const uint32_t* ids, size_t i, size_t vecdim) {
+    return ids ? base + (size_t)ids[i] * vecdim : base + i * vecdim;
+}
+
+// 维度编译期已知（DEEP100K为96维）时，query整段预先放进寄存器，块与块之间不再重新读取
+template <class V, int R, size_t D>
+inline void InnerProductBatchFixed(const float* base, const uint32_t* ids, size_t n, const float* query, float* out) {
+    const int kChunks = D / V::kLanes;
+    V q[kChunks];
+#pragma GCC unroll 16
+    for (int j = 0; j < kChunks; ++j) q[j] = V(query + j * V::kLanes);
+
+    size_t i = 0;
+    for (; i + R <= n; i += R) {
+        const float* rows[R];
+        for (int r = 0; r < R; ++r) rows[r] = BatchRow(base, ids, i + r, D);
+        if (ids != nullptr && i + 2 * R <= n) {
+            // 按id取行是随机访问，提前预取下一组
+            for (int r = 0; r < R; ++r) {
+                const float* next = BatchRow(base, ids, i + R + r, D);
+                for (size_t off = 0; off < D; off += 16) __builtin_prefetch(next + off);
+            }
+        }
+
+        V acc[R];
+#pragma GCC unroll 16
+        for (int j = 0; j < kChunks; ++j) {
+#pragma GCC unroll 8
+            for (int r = 0; r < R; ++r) acc[r] = V::fmadd(V(rows[r] + j * V::kLanes), q[j], acc[r]);
+        }
+#pragma GCC unroll 2
+        for (int r = 0; r < R; r += 4) V::reduce_add4(acc[r], acc[r + 1], acc[r + 2], acc[r + 3], out + i + r);
+    }
+    for (; i < n; ++i) out[i] = InnerProductKernel<V>(BatchRow(base, ids, i, D), query, D);
+}
+
+template <class V, int R>
+inline void InnerProductBatchKernel(const float* base, const uint32_t* ids, size_t n,
+                                    const float* query, size_t vecdim, float* out) {
+    if (vecdim == 96) {
+        InnerProductBatchFixed<V, R, 96>(base, ids, n, query, out);
+        return;
+    }
+    size_t i = 0;
+    for (; i + R <= n; i += R) {
+        const float* rows[R];
+        for (int r = 0; r < R; ++r) rows[r] = BatchRow(base, ids, i + r, vecdim);
+        InnerProductRows<V, R>(rows, query, vecdim, out + i);
+    }
+    for (; i < n; ++i) out[i] = InnerProductKernel<V>(BatchRow(base, ids, i, vecdim), query, vecdim);
+}
+
+// GEMM式微内核：16行base按维度转置打包，每一维广播MR条query的一个分量与之相乘，
+// MR x 16个结果一直留在累加器里，没有横向规约；V必须是16路的封装
+template <class V, int MR>
+inline void InnerProductTileRows(const float* packed, const float* query, size_t vecdim, float* out) {
+    V acc[MR];
+    for (size_t d = 0; d < vecdim; ++d) {
+        V b(packed + d * kTileRows);
+#pragma GCC unroll 16
+        for (int m = 0; m < MR; ++m) acc[m] = V::fmadd(V(query[m * vecdim + d]), b, acc[m]);
+    }
+#pragma GCC unroll 16
+    for (int m = 0; m < MR; ++m) acc[m].storeu(out + m * kTileRows);
+}
+
+template <class V, int MR>
+inline void InnerProductTileKernel(const float* packed, const float* query, size_t nq, size_t vecdim, float* out) {
+    size_t q = 0;
+    for (; q + MR <= nq; q += MR) {
+        InnerProductTileRows<V, MR>(packed, query + q * vecdim, vecdim, out + q * kTileRows);
+    }
+    // 尾部先按2条一组，最后单条
+    for (; q + 2 <= nq; q += 2) {
+        InnerProductTileRows<V, 2>(packed, query + q * vecdim, vecdim, out + q * kTileRows);
+    }
+    if (q < nq) {
+        InnerProductTileRows<V, 1>(packed, query + q * vecdim, vecdim, out + q * kTileRows);
+    }
+}
+
+// 单条query与多组16行：NP组的累加器互不依赖，掩盖fma的延迟
+// （InnerProductTileRows<V, 1>每一维都要等上一次fma的结果）
+template <class V, int NP>
+inline void InnerProductPanelsKernel(const float* packed, size_t n_panels, const float* query, size_t vecdim, float* out) {
+    size_t panel = kTileRows * vecdim;
+    size_t p = 0;
+    for (; p + NP <= n_panels; p += NP) {
+        const float* base = packed + p * panel;
+        V acc[NP];
+        for (size_t d = 0; d < vecdim; ++d) {
+            V q(query[d]);
+#pragma GCC unroll 16
+            for (int i = 0; i < NP; ++i) acc[i] = V::fmadd(q, V(base + i * panel + d * kTileRows), acc[i]);
+        }
+#pragma GCC unroll 16
+        for (int i = 0; i < NP; ++i) acc[i].storeu(out + (p + i) * kTileRows);
+    }
+    for (; p < n_panels; ++p) InnerProductTileRows<V, 1>(packed + p * panel, query, vecdim, out + p * kTileRows);
+}
+
+inline float inner_product_scalar(const float* a, const float* b, size_t vecdim) {
+    float dis = 0;
+    for (size_t d = 0; d < vecdim; ++d) {
+        dis += a[d] * b[d];
+    }
+    return dis;
+}
+
+inline void inner_product_batch_scalar(const float* base, const uint32_t* ids, size_t n,
+                                       const float* query, size_t vecdim, float* out) {
+    for (size_t i = 0; i < n; ++i) out[i] = inner_product_scalar(BatchRow(base, ids, i, vecdim), query, vecdim);
+}
+
+inline void inner_product_tile_scalar(const float* packed, const float* query, size_t nq, size_t vecdim, float* out) {
+    for (size_t q = 0; q < nq; ++q) {
+        float* o = out + q * kTileRows;
+        for (size_t r = 0; r < kTileRows; ++r) o[r] = 0;
+        for (size_t d = 0; d < vecdim; ++d) {
+            for (size_t r = 0; r < kTileRows; ++r) o[r] += query[q * vecdim + d] * packed[d * kTileRows + r];
+        }
+    }
+}
+
+inline void inner_product_panels_scalar(const float* packed, size_t n_panels, const float* query, size_t vecdim, float* out) {
+    for (size_t p = 0; p < n_panels; ++p) inner_product_tile_scalar(packed + p * kTileRows * vecdim, query, 1, vecdim, out + p * kTileRows);
+}
+
+inline void lut16_sum_scalar(const uint8_t* tables, const uint8_t* idx, size_t nsub, uint16_t* out) {
+    for (int l = 0; l < 16; ++l) out[l] = 0;
+    for (size_t j = 0; j < nsub; ++j) {
+        for (int l = 0; l < 16; ++l) {
+            out[l] += tables[j * 16 + (idx[j * 16 + l] & 0x0F)];
+        }
+    }
+}
+
+#ifdef ANN_SIMD_NEON
+inline float inner_product8_neon(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd8float32>(a, b, vecdim);
+}
+
+inline float inner_product16_neon(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd16float32>(a, b, vecdim);
+}
+
+// NEON有32个寄存器，96维query占24个，4行一组时累加器正好放得下
+inline void inner_product_batch_neon(const float* base, const uint32_t* ids, size_t n,
+                                     const float* query, size_t vecdim, float* out) {
+    InnerProductBatchKernel<simd8float32, 4>(base, ids, n, query, vecdim, out);
+}
+
+// 16路占4个q寄存器，6条query的累加器共24个，加上base和广播值正好在32个以内
+inline void inner_product_tile_neon(const float* packed, const float* query, size_t nq, size_t vecdim, float* out) {
+    InnerProductTileKernel<simd16float32, 6>(packed, query, nq, vecdim, out);
+}
+
+// 4组共16个累加器
+inline void inner_product_panels_neon(const float* packed, size_t n_panels, const float* query, size_t vecdim, float* out) {
+    InnerProductPanelsKernel<simd16float32, 4>(packed, n_panels, query, vecdim, out);
+}
+
+inline void lut16_sum_neon(const uint8_t* tables, const uint8_t* idx, size_t nsub, uint16_t* out) {
+    uint16x8_t lo = vdupq_n_u16(0), hi = vdupq_n_u16(0);
+    for (size_t j = 0; j < nsub; ++j) {
+        uint8x16_t v = vqtbl1q_u8(vld1q_u8(tables + j * 16), vld1q_u8(idx + j * 16));
+        lo = vaddw_u8(lo, vget_low_u8(v));
+        hi = vaddw_u8(hi, vget_high_u8(v));
+    }
+    vst1q_u16(out, lo);
+    vst1q_u16(out + 8, hi);
+}
+#endif
+
+#ifdef ANN_SIMD_X86
+ANN_KERNEL_SSE4 inline float inner_product8_sse4(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd8float32>(a, b, vecdim);
+}
+
+ANN_KERNEL_SSE4 inline float inner_product16_sse4(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd16float32>(a, b, vecdim);
+}
+
+ANN_KERNEL_SSE4 inline void inner_product_batch_sse4(const float* base, const uint32_t* ids, size_t n,
+                                                     const float* query, size_t vecdim, float* out) {
+    InnerProductBatchKernel<simd8float32, 4>(base, ids, n, query, vecdim, out);
+}
+
+// SSE只有16个xmm，16路占4个，2条query一组
+ANN_KERNEL_SSE4 inline void inner_product_tile_sse4(const float* packed, const float* query, size_t nq,
+                                                    size_t vecdim, float* out) {
+    InnerProductTileKernel<simd16float32, 2>(packed, query, nq, vecdim, out);
+}
+
+ANN_KERNEL_SSE4 inline void inner_product_panels_sse4(const float* packed, size_t n_panels, const float* query,
+                                                      size_t vecdim, float* out) {
+    InnerProductPanelsKernel<simd16float32, 2>(packed, n_panels, query, vecdim, out);
+}
+
+// pshufb查表，SSSE3起可用，AVX2/AVX-512也共用这一版
+ANN_KERNEL_SSE4 inline void lut16_sum_sse4(const uint8_t* tables, const uint8_t* idx, size_t nsub, uint16_t* out) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = zero, hi = zero;
+    __m128i mask = _mm_set1_epi8(0x0F);
+    for (size_t j = 0; j < nsub; ++j) {
+        __m128i t = _mm_loadu_si128((const __m128i*)(tables + j * 16));
+        __m128i i = _mm_and_si128(_mm_loadu_si128((const __m128i*)(idx + j * 16)), mask);
+        __m128i v = _mm_shuffle_epi8(t, i);
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+    }
+    _mm_storeu_si128((__m128i*)out, lo);
+    _mm_storeu_si128((__m128i*)(out + 8), hi);
+}
+
+ANN_KERNEL_AVX2 inline float inner_product8_avx2(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd8float32_avx2>(a, b, vecdim);
+}
+
+ANN_KERNEL_AVX2 inline float inner_product16_avx2(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd16float32_avx2>(a, b, vecdim);
+}
+
+ANN_KERNEL_AVX2 inline void inner_product_batch_avx2(const float* base, const uint32_t* ids, size_t n,
+                                                     const float* query, size_t vecdim, float* out) {
+    InnerProductBatchKernel<simd8float32_avx2, 4>(base, ids, n, query, vecdim, out);
+}
+
+// 6x16的经典sgemm微内核：12个ymm累加器 + 2个base + 1个广播
+ANN_KERNEL_AVX2 inline void inner_product_tile_avx2(const float* packed, const float* query, size_t nq,
+                                                    size_t vecdim, float* out) {
+    InnerProductTileKernel<simd16float32_avx2, 6>(packed, query, nq, vecdim, out);
+}
+
+// 4组共8个ymm累加器
+ANN_KERNEL_AVX2 inline void inner_product_panels_avx2(const float* packed, size_t n_panels, const float* query,
+                                                      size_t vecdim, float* out) {
+    InnerProductPanelsKernel<simd16float32_avx2, 4>(packed, n_panels, query, vecdim, out);
+}
+
+ANN_KERNEL_AVX512 inline float inner_product8_avx512(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd8float32_avx2>(a, b, vecdim);
+}
+
+ANN_KERNEL_AVX512 inline float inner_product16_avx512(const float* a, const float* b, size_t vecdim) {
+    return InnerProductKernel<simd16float32_avx512>(a, b, vecdim);
+}
+
+// 96维query只占6个zmm；实测8行一组时行指针计算被向量化反而更慢，与AVX2一样取4行
+ANN_KERNEL_AVX512 inline void inner_product_batch_avx512(const float* base, const uint32_t* ids, size_t n,
+                                                         const float* query, size_t vecdim, float* out) {
+    if (vecdim % 16 == 0) {
+        InnerProductBatchKernel<simd16float32_avx512, 4>(base, ids, n, query, vecdim, out);
+    } else {
+        InnerProductBatchKernel<simd8float32_avx2, 4>(base, ids, n, query, vecdim, out);
+    }
+}
+// 16路只占1个zmm，8条query一组；试过12条，实测没有更快
+ANN_KERNEL_AVX512 inline void inner_product_tile_avx512(const float* packed, const float* query, size_t nq,
+                                                        size_t vecdim, float* out) {
+    InnerProductTileKernel<simd16float32_avx512, 8>(packed, query, nq, vecdim, out);
+}
+
+ANN_KERNEL_AVX512 inline void inner_product_panels_avx512(const float* packed, size_t n_panels, const float* query,
+                                                          size_t vecdim, float* out) {
+    InnerProductPanelsKernel<simd16float32_avx512, 8>(packed, n_panels, query, vecdim, out);
+}
+#endif
+
+// ------------------------------- 函数表 -------------------------------
+
+// 返回指定后端的函数表，当前CPU不支持时返回nullptr
+inline const SimdKernels* simd_kernels_for(SimdLevel level) {
+    if (!simd_level_supported(level)) return nullptr;
+
+    static const SimdKernels scalar = {
+        SIMD_SCALAR, "scalar", inner_product_scalar, inner_product_scalar, lut16_sum_scalar,
+        inner_product_batch_scalar, inner_product_tile_scalar, inner_product_panels_scalar};
+#ifdef ANN_SIMD_NEON
+    static const SimdKernels neon = {
+        SIMD_NEON, "neon", inner_product8_neon, inner_product16_neon, lut16_sum_neon,
+        inner_product_batch_neon, inner_product_tile_neon, inner_product_panels_neon};
+#endif
+#ifdef ANN_SIMD_X86
+    static const SimdKernels sse4 = {
+        SIMD_SSE4, "sse4", inner_product8_sse4, inner_product16_sse4, lut16_sum_sse4,
+        inner_product_batch_sse4, inner_product_tile_sse4, inner_product_panels_sse4};
+    static const SimdKernels avx2 = {
+        SIMD_AVX2, "avx2", inner_product8_avx2, inner_product16_avx2, lut16_sum_sse4,
+        inner_product_batch_avx2, inner_product_tile_avx2, inner_product_panels_avx2};
+    static const SimdKernels avx512 = {
+        SIMD_AVX512, "avx512", inner_product8_avx512, inner_product16_avx512, lut16_sum_sse4,
+        inner_product_batch_avx512, inner_product_tile_avx512, inner_product_panels_avx512};
+#endif
+
+    switch (level) {
+#ifdef ANN_SIMD_NEON
+    case SIMD_NEON: return &neon;
+#endif
+#ifdef ANN_SIMD_X86
+    case SIMD_SSE4: return &sse4;
+    case SIMD_AVX2: return &avx2;
+    case SIMD_AVX512: return &avx512;
+#endif
+    default: return &scalar;
+    }
+}
+
+inline SimdLevel simd_select_level() {
+    SimdLevel best = simd_best_level();
+    const char* env = std::getenv("ANN_SIMD");
+    if (env == nullptr) return best;
+
+    for (int l = 0; l < SIMD_LEVEL_COUNT; ++l) {
+        if (std::strcmp(env, simd_level_name((SimdLevel)l)) == 0) {
+            if (simd_level_supported((SimdLevel)l)) return (SimdLevel)l;
+            break;
+        }
+    }
+    std::cerr << "ANN_SIMD=" << env << " not available, use " << simd_level_name(best) << "\n";
+    return best;
+}
+
+// 当前进程使用的函数表，第一次调用时完成检测
+inline const SimdKernels& simd_kernels() {
+    static const SimdKernels* kernels = simd_kernels_for(simd_select_level());
+    return *kernels;
+}
+
+// 分派后的内积，维度是16的倍数时走16路版本
+inline float InnerProductSIMD(const float* a, const float* b, size_t vecdim) {
+    assert(vecdim % 8 == 0);
+#ifdef ANN_SIMD_NEON
+    // ARM上只有NEON一个后端，直接内联调用
+    return vecdim % 16 == 0 ? inner_product16_neon(a, b, vecdim) : inner_product8_neon(a, b, vecdim);
+#else
+    const SimdKernels& kernels = simd_kernels();
+    return vecdim % 16 == 0 ? kernels.inner_product16(a, b, vecdim) : kernels.inner_product8(a, b, vecdim);
+#endif
+}
+
+// 连续n行（base[0..n)）与query的内积，结果写入out
+inline void InnerProductBatch(const float* base, const float* query, size_t n, size_t vecdim, float* out) {
+    assert(vecdim % 8 == 0);
+#ifdef ANN_SIMD_NEON
+    inner_product_batch_neon(base, nullptr, n, query, vecdim, out);
+#else
+    simd_kernels().inner_product_batch(base, nullptr, n, query, vecdim, out);
+#endif
+}
+
+// 按id取行的版本，用于重排和候选列表
+inline void InnerProductBatchIds(const float* base, const uint32_t* ids, size_t n,
+                                 const float* query, size_t vecdim, float* out) {
+    assert(vecdim % 8 == 0);
+#ifdef ANN_SIMD_NEON
+    inner_product_batch_neon(base, ids, n, query, vecdim, out);
+#else
+    simd_kernels().inner_product_batch(base, ids, n, query, vecdim, out);
+#endif
+}
+
+// 把base中从rows开始的至多16行转置打包成[vecdim][16]，不足16行的部分补0
+inline void PackTileRows(const float* rows, size_t n, size_t vecdim, float* packed) {
+    for (size_t d = 0; d < vecdim; ++d) {
+        for (size_t r = 0; r < kTileRows; ++r) {
+            packed[d * kTileRows + r] = r < n ? rows[r * vecdim + d] : 0.0f;
+        }
+    }
+}
+
+// nq条query与一组打包好的16行的内积，结果写入out[nq][16]
+inline void InnerProductTile(const float* packed, const float* query, size_t nq, size_t vecdim, float* out) {
+#ifdef ANN_SIMD_NEON
+    inner_product_tile_neon(packed, query, nq, vecdim, out);
+#else
+    simd_kernels().inner_product_tile(packed, query, nq, vecdim, out);
+#endif
+}
+
+// 单条query与n_panels组打包好的16行的内积，结果写入out[n_panels][16]
+inline void InnerProductPanels(const float* packed, size_t n_panels, const float* query, size_t vecdim, float* out) {
+#ifdef ANN_SIMD_NEON
+    inner_product_panels_neon(packed, n_panels, query, vecdim, out);
+#else
+    simd_kernels().inner_product_panels(packed, n_panels, query, vecdim, out);
+#endif
+}
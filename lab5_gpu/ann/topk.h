@@ -0,0 +1,107 @@
+#pragma once
+#include <queue>
+#include <vector>
+#include <limits>
+#include <cassert>
+#include <cstdint>
+#include <algorithm>
+
+// 定长top-k选择器，替代搜索热路径里的std::priority_queue：
+// 距离不小于当前阈值（已知第k小）的直接丢弃；小于阈值的追加进缓冲，
+// 缓冲攒到2k个时用nth_element选出前k个并更新阈值。
+// K>0时缓冲放在对象内部（k不超过K），K=0时按运行时的k分配一次
+template <size_t K = 0>
+class TopK {
+public:
+    typedef std::pair<float, uint32_t> Entry;
+
+    explicit TopK(size_t k = K) : k_(k), size_(0), threshold_(std::numeric_limits<float>::infinity()) {
+        assert(k > 0 && (K == 0 || k <= K));
+        if (K == 0) dynamic_buf_.resize(Capacity(k));
+    }
+
+    size_t k() const { return k_; }
+    // 缓冲中的元素数，compact()之后不超过k
+    size_t size() const { return size_; }
+    // 当前第k小的距离，不足k个时为inf
+    float threshold() const { return threshold_; }
+
+    void push(float dis, uint32_t id) {
+        if (dis >= threshold_) return;
+        data()[size_++] = Entry(dis, id);
+        if (size_ >= 2 * k_) compact();
+    }
+
+    // 连续n个距离，编号为first_id, first_id+1, ...
+    void push_range(const float* dis, size_t n, uint32_t first_id) {
+        size_t i = 0;
+        for (; i + kBlock <= n; i += kBlock) push16(dis + i, first_id + i, nullptr);
+        for (; i < n; ++i) push(dis[i], first_id + i);
+    }
+
+    // n个距离，编号取ids[i]
+    void push_ids(const float* dis, size_t n, const uint32_t* ids) {
+        size_t i = 0;
+        for (; i + kBlock <= n; i += kBlock) push16(dis + i, 0, ids + i);
+        for (; i < n; ++i) push(dis[i], ids[i]);
+    }
+
+    void merge(const TopK& other) {
+        for (size_t i = 0; i < other.size_; ++i) push(other.data()[i].first, other.data()[i].second);
+    }
+
+    // 只保留前k个（无序）
+    void compact() {
+        if (size_ < k_) return;
+        Entry* buf = data();
+        if (size_ > k_) std::nth_element(buf, buf + k_ - 1, buf + size_);
+        size_ = k_;
+        threshold_ = std::max_element(buf, buf + k_)->first;
+    }
+
+    const Entry* begin() const { return data(); }
+    const Entry* end() const { return data() + size_; }
+
+    void clear() {
+        size_ = 0;
+        threshold_ = std::numeric_limits<float>::infinity();
+    }
+
+    // 转成原来的大顶堆返回类型，main.cc不用改
+    std::priority_queue<Entry> to_queue() {
+        compact();
+        return std::priority_queue<Entry>(data(), data() + size_);
+    }
+
+private:
+    static const size_t kBlock = 16;
+
+    static size_t Capacity(size_t k) { return 2 * k + kBlock; }
+
+    // 一次16个：先判断整组的最小值是否低于阈值，大部分组在这里就整组跳过；
+    // 否则无分支地把每个元素写进缓冲，下标只在距离小于阈值时前进
+    void push16(const float* dis, uint32_t first_id, const uint32_t* ids) {
+        float min_dis = dis[0];
+        for (size_t i = 1; i < kBlock; ++i) min_dis = std::min(min_dis, dis[i]);
+        if (min_dis >= threshold_) return;
+
+        Entry* buf = data();
+        float thr = threshold_;
+        size_t n = size_;
+        for (size_t i = 0; i < kBlock; ++i) {
+            buf[n] = Entry(dis[i], ids ? ids[i] : first_id + (uint32_t)i);
+            n += dis[i] < thr;
+        }
+        size_ = n;
+        if (size_ >= 2 * k_) compact();
+    }
+
+    Entry* data() { return K ? inline_buf_ : dynamic_buf_.data(); }
+    const Entry* data() const { return K ? inline_buf_ : dynamic_buf_.data(); }
+
+    size_t k_;
+    size_t size_;
+    float threshold_;
+    Entry inline_buf_[K ? 2 * K + kBlock : 1];
+    std::vector<Entry> dynamic_buf_;
+};